@@ -19,6 +19,12 @@ typedef void (*on_transfer_progress_update_callback)(const char* transfer_id, fl
 typedef void (*on_transfer_completed_callback)(const char* transfer_id, bool success, const char* error_message);
 typedef void (*on_error_callback)(const char* error_message);
 
+// Extended progress event: transfer_id plus a JSON object with total_bytes,
+// transferred_bytes, total_files, completed_files, progress_percent,
+// bytes_per_second (smoothed), elapsed_seconds, eta_seconds (null until a
+// rate is known) and stalled. Delivered alongside on_transfer_progress_update.
+typedef void (*on_transfer_stats_update_callback)(const char* transfer_id, const char* stats_json);
+
 // Callbacks struct containing all event callbacks
 typedef struct {
     on_peer_discovered_callback on_peer_discovered;
@@ -36,6 +42,32 @@ int warpdeck_start(WarpDeckHandle* handle, const char* device_name, int desired_
 void warpdeck_stop(WarpDeckHandle* handle);
 void warpdeck_set_device_name(WarpDeckHandle* handle, const char* new_name);
 void warpdeck_initiate_transfer(WarpDeckHandle* handle, const char* device_id, const char* files_json);
+// Caps progress callbacks per transfer (default 20 per second); <= 0 delivers every update
+void warpdeck_set_progress_update_rate(WarpDeckHandle* handle, double updates_per_second);
+void warpdeck_set_transfer_stats_callback(WarpDeckHandle* handle, on_transfer_stats_update_callback callback);
+// Keeps up to max_bytes of received file chunks under the config dir, so content
+// this device has received before is rebuilt locally instead of sent again.
+// Off by default; 0 turns it off and deletes the stored chunks.
+void warpdeck_set_chunk_store_size(WarpDeckHandle* handle, uint64_t max_bytes);
+// A sender sends files of a transfer with identical content once; the copies are
+// made here (as reflinks where the filesystem supports them). Allowing hardlinks
+// makes them share one inode, so editing one edits all. Off by default.
+void warpdeck_set_hardlink_duplicates(WarpDeckHandle* handle, bool allow);
+// Uncompressed file data is sent straight from the page cache (sendfile/splice)
+// where the connection allows it; disabling this copies it through user space,
+// which can help with network drivers that handle it poorly. On by default.
+void warpdeck_set_zero_copy(WarpDeckHandle* handle, bool enabled);
+// Bandwidth limits in bytes per second on transfer traffic, sent and received
+// alike: for all transfers together, per peer device and per transfer; 0
+// removes one. Transfers move at the strictest limit that applies, and a
+// change takes effect at once, running transfers included.
+void warpdeck_set_bandwidth_limit(WarpDeckHandle* handle, uint64_t bytes_per_second);
+void warpdeck_set_peer_bandwidth_limit(WarpDeckHandle* handle, const char* device_id, uint64_t bytes_per_second);
+void warpdeck_set_transfer_bandwidth_limit(WarpDeckHandle* handle, const char* transfer_id,
+                                           uint64_t bytes_per_second);
+// Same JSON as the stats event plus a "files" array of per-file transferred_bytes;
+// NULL if the transfer is unknown or finished. Free with warpdeck_free_string.
+const char* warpdeck_get_transfer_stats(WarpDeckHandle* handle, const char* transfer_id);
 void warpdeck_respond_to_transfer(WarpDeckHandle* handle, const char* transfer_id, bool accept);
 void warpdeck_cancel_transfer(WarpDeckHandle* handle, const char* transfer_id);
 const char* warpdeck_get_trusted_devices(WarpDeckHandle* handle);
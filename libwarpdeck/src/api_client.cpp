@@ -1,5 +1,9 @@
 #include "api_client.h"
 #include "utils.h"
+#include "file_io.h"
+#include "compression.h"
+#include "delta.h"
+#include "logger.h"
 #include <nlohmann/json.hpp>
 #include <httplib.h>
 #include <openssl/sha.h>
@@ -7,10 +11,76 @@
 #include <openssl/pem.h>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace warpdeck {
 
-APIClient::APIClient() {}
+namespace {
+
+// Produces a bundle body piece by piece: a frame header, then the file's bytes,
+// then the next header. Each piece stays valid until the next call.
+class BundleFramer {
+public:
+    BundleFramer(const std::vector<BundleEntry>& entries, bool bulk_io)
+        : entries_(entries), bulk_io_(bulk_io), entry_index_(0), header_sent_(false), entry_offset_(0) {}
+    
+    bool done() const {
+        return entry_index_ >= entries_.size();
+    }
+    
+    // Fails once done, or if a file can't be read or shrank since it was announced
+    bool next(const char*& data, size_t& size) {
+        if (done()) {
+            return false;
+        }
+        const BundleEntry& entry = entries_[entry_index_];
+        
+        if (!header_sent_) {
+            uint32_t index = static_cast<uint32_t>(entry.file_index);
+            for (int i = 0; i < 4; ++i) {
+                header_[i] = static_cast<char>((index >> (24 - 8 * i)) & 0xff);
+            }
+            for (int i = 0; i < 8; ++i) {
+                header_[4 + i] = static_cast<char>((entry.size >> (56 - 8 * i)) & 0xff);
+            }
+            data = header_;
+            size = sizeof(header_);
+            header_sent_ = true;
+            entry_offset_ = 0;
+            // The previous file's last block has been consumed by now
+            file_.close();
+            if (!file_.open(entry.file_path, 0, entry.size, bulk_io_)) {
+                return false;
+            }
+        } else {
+            if (!file_.next(data, size)) {
+                return false;
+            }
+            entry_offset_ += size;
+        }
+        
+        if (entry_offset_ == entry.size) {
+            header_sent_ = false;
+            ++entry_index_;
+        }
+        return true;
+    }
+
+private:
+    const std::vector<BundleEntry>& entries_;
+    bool bulk_io_;
+    size_t entry_index_;
+    bool header_sent_;
+    uint64_t entry_offset_;
+    char header_[BUNDLE_FRAME_HEADER_SIZE];
+    FileReader file_;
+};
+
+} // namespace
+
+APIClient::APIClient() : zero_copy_enabled_(true), zero_copy_bytes_(0), copied_bytes_(0) {}
 
 APIClient::~APIClient() {}
 
@@ -19,12 +89,118 @@ APIResponse APIClient::get_device_info(const std::string& host, int port,
     APIResponse response;
     
     try {
-        // For now, use regular HTTP client - SSL will be implemented later
-        httplib::Client client(host, port);
+        ConnectionLease connection(*this, host, port);
+        
+        auto result = connection.client().Get("/api/v1/info");
+        
+        if (result) {
+            connection.mark_reusable();
+            response.status_code = result->status;
+            response.body = result->body;
+            response.success = (result->status == 200);
+            
+            if (!response.success) {
+                response.error_message = "HTTP " + std::to_string(result->status);
+            }
+        } else {
+            response.success = false;
+            response.status_code = 0;
+            response.error_message = "Connection failed";
+        }
+    
+    } catch (const std::exception& e) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = e.what();
+    }
+    
+    return response;
+}
+
+APIResponse APIClient::send_manifest_page(const std::string& host, int port,
+                                        const std::string& /* expected_fingerprint */,
+                                        const std::string& transfer_id,
+                                        const std::vector<FileMetadata>& files, size_t begin, size_t end) {
+    APIResponse response;
+    
+    try {
+        ConnectionLease connection(*this, host, port);
+        
+        std::string endpoint = "/api/v1/transfer/" + transfer_id + "/manifest?first_file=" + std::to_string(begin);
+        auto result = connection.client().Post(endpoint, utils::manifest_page_to_json(files, begin, end),
+                                               "application/json");
+        
+        if (result) {
+            connection.mark_reusable();
+            response.status_code = result->status;
+            response.body = result->body;
+            response.success = (result->status == 200);
+            
+            if (!response.success) {
+                response.error_message = "HTTP " + std::to_string(result->status);
+            }
+        } else {
+            response.success = false;
+            response.status_code = 0;
+            response.error_message = "Connection failed";
+        }
+        
+    } catch (const std::exception& e) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = e.what();
+    }
+    
+    return response;
+}
+
+APIResponse APIClient::get_transfer_status(const std::string& host, int port,
+                                         const std::string& /* expected_fingerprint */,
+                                         const std::string& transfer_id) {
+    APIResponse response;
+    
+    try {
+        ConnectionLease connection(*this, host, port);
+        
+        auto result = connection.client().Get("/api/v1/transfer/" + transfer_id + "/status");
+        
+        if (result) {
+            connection.mark_reusable();
+            response.status_code = result->status;
+            response.body = result->body;
+            response.success = (result->status == 200);
+            
+            if (!response.success) {
+                response.error_message = "HTTP " + std::to_string(result->status);
+            }
+        } else {
+            response.success = false;
+            response.status_code = 0;
+            response.error_message = "Connection failed";
+        }
+        
+    } catch (const std::exception& e) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = e.what();
+    }
+    
+    return response;
+}
+
+APIResponse APIClient::get_delta_signature(const std::string& host, int port,
+                                         const std::string& /* expected_fingerprint */,
+                                         const std::string& transfer_id, int file_index) {
+    APIResponse response;
+    
+    try {
+        ConnectionLease connection(*this, host, port);
         
-        auto result = client.Get("/api/v1/info");
+        auto result = connection.client().Get("/api/v1/transfer/" + transfer_id + "/" +
+                                              std::to_string(file_index) + "/signature");
         
         if (result) {
+            connection.mark_reusable();
             response.status_code = result->status;
             response.body = result->body;
             response.success = (result->status == 200);
@@ -53,13 +229,17 @@ APIResponse APIClient::request_transfer(const std::string& host, int port,
     APIResponse response;
     
     try {
-        // For now, use regular HTTP client - SSL will be implemented later
-        httplib::Client client(host, port);
+        ConnectionLease connection(*this, host, port);
+        
+        // The receiver holds the request open until the user accepts or declines
+        connection.client().set_read_timeout(TRANSFER_APPROVAL_TIMEOUT_SECONDS + 10, 0);
         
         std::string json_body = utils::transfer_request_to_json(request);
-        auto result = client.Post("/api/v1/transfer/request", json_body, "application/json");
+        auto result = connection.client().Post("/api/v1/transfer/request", json_body, "application/json");
+        connection.client().set_read_timeout(READ_TIMEOUT_SECONDS, 0);
         
         if (result) {
+            connection.mark_reusable();
             response.status_code = result->status;
             response.body = result->body;
             response.success = (result->status == 202);
@@ -89,15 +269,15 @@ APIResponse APIClient::upload_file(const std::string& host, int port,
     APIResponse response;
     
     try {
-        // For now, use regular HTTP client - SSL will be implemented later
-        httplib::Client client(host, port);
+        ConnectionLease connection(*this, host, port);
         
         std::string endpoint = "/api/v1/transfer/" + transfer_id + "/" + std::to_string(file_index);
-        std::string data(file_data.begin(), file_data.end());
         
-        auto result = client.Post(endpoint.c_str(), data, "application/octet-stream");
+        auto result = connection.client().Post(endpoint.c_str(), reinterpret_cast<const char*>(file_data.data()),
+                                               file_data.size(), "application/octet-stream");
         
         if (result) {
+            connection.mark_reusable();
             response.status_code = result->status;
             response.body = result->body;
             response.success = (result->status == 200);
@@ -120,11 +300,363 @@ APIResponse APIClient::upload_file(const std::string& host, int port,
     return response;
 }
 
+APIResponse APIClient::upload_file_range(const std::string& host, int port,
+                                       const std::string& /* expected_fingerprint */,
+                                       const std::string& transfer_id, int file_index,
+                                       const std::string& file_path, uint64_t offset, uint64_t length,
+                                       bool bulk_io, TransferCompressor* compressor,
+                                       UploadProgressCallback progress_callback) {
+    std::string endpoint = "/api/v1/transfer/" + transfer_id + "/" + std::to_string(file_index) +
+                           "/chunk?offset=" + std::to_string(offset);
+    if (!compressor) {
+        return stream_file_range(host, port, endpoint, file_path, offset, length, bulk_io, progress_callback);
+    }
+    
+    FileReader file;
+    if (!file.open(file_path, offset, length, bulk_io)) {
+        APIResponse response;
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = "Cannot open " + file_path;
+        return response;
+    }
+    
+    endpoint += "&length=" + std::to_string(length) + "&encoding=" + BLOCK_ENCODING;
+    uint64_t position = 0;
+    return post_chunked(host, port, endpoint, compressor,
+        [&](const char*& data, size_t& size) {
+            if (position == length) {
+                size = 0;
+                return true;
+            }
+            if (!file.next(data, size)) {
+                return false;
+            }
+            position += size;
+            return true;
+        },
+        progress_callback);
+}
+
+APIResponse APIClient::stream_file_range(const std::string& host, int port, const std::string& endpoint,
+                                       const std::string& file_path, uint64_t offset, uint64_t length,
+                                       bool bulk_io, UploadProgressCallback progress_callback) {
+    APIResponse response;
+    
+    if (zero_copy_enabled_ && length >= ZERO_COPY_MIN_LENGTH &&
+        send_zero_copy(host, port, endpoint, file_path, offset, length, bulk_io, progress_callback, response)) {
+        return response;
+    }
+    
+    FileReader file;
+    if (!file.open(file_path, offset, length, bulk_io)) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = "Cannot open " + file_path;
+        return response;
+    }
+    
+    try {
+        ConnectionLease connection(*this, host, port);
+        
+        uint64_t position = 0;
+        bool aborted = false;
+        
+        auto result = connection.client().Post(endpoint.c_str(), static_cast<size_t>(length),
+            [&](size_t body_offset, size_t /* body_length */, httplib::DataSink& sink) {
+                // The reader only moves forward
+                const char* data = nullptr;
+                size_t read_bytes = 0;
+                if (body_offset != position || !file.next(data, read_bytes)) {
+                    return false;
+                }
+                position += read_bytes;
+                
+                if (!sink.write(data, read_bytes)) {
+                    return false;
+                }
+                
+                if (progress_callback && !progress_callback(body_offset + read_bytes)) {
+                    aborted = true;
+                    return false;
+                }
+                return true;
+            },
+            "application/octet-stream");
+        
+        if (result) {
+            connection.mark_reusable();
+            copied_bytes_ += length;
+            response.status_code = result->status;
+            response.body = result->body;
+            response.success = (result->status == 200);
+            
+            if (!response.success) {
+                response.error_message = "HTTP " + std::to_string(result->status);
+            }
+        } else {
+            response.success = false;
+            response.status_code = 0;
+            response.error_message = aborted ? "Upload aborted" : "Connection failed";
+        }
+        
+    } catch (const std::exception& e) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = e.what();
+    }
+    
+    return response;
+}
+
+bool APIClient::send_zero_copy(const std::string& host, int port, const std::string& endpoint,
+                               const std::string& file_path, uint64_t offset, uint64_t length, bool bulk_io,
+                               const UploadProgressCallback& progress_callback, APIResponse& response) {
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    std::string key = host + ":" + std::to_string(port);
+    auto connection = acquire_zero_copy_connection(host, port);
+    if (!connection) {
+        ::close(fd);
+        return false;
+    }
+    
+    CacheAdvisor advisor;
+    if (bulk_io) {
+        advisor.begin(fd, CacheAdvisor::Direction::READ, offset, length);
+    }
+    
+    bool aborted = false;
+    int status = 0;
+    std::string body;
+    bool sent = connection->post_file_range(endpoint, fd, offset, length,
+        [&](uint64_t bytes_sent) {
+            advisor.advance(offset + bytes_sent);
+            if (progress_callback && !progress_callback(bytes_sent)) {
+                aborted = true;
+                return false;
+            }
+            return true;
+        }, status, body);
+    advisor.end(offset + length);
+    ::close(fd);
+    
+    if (!sent && !aborted) {
+        // The receiver discards partial ranges, so the httplib path can resend it
+        LOG_API_WARN() << "Zero-copy upload to " << key << " failed, falling back to buffered send";
+        release_zero_copy_connection(key, nullptr);
+        return false;
+    }
+    
+    release_zero_copy_connection(key, connection->is_reusable() ? std::move(connection) : nullptr);
+    
+    if (!sent) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = "Upload aborted";
+        return true;
+    }
+    
+    zero_copy_bytes_ += length;
+    response.status_code = status;
+    response.body = body;
+    response.success = (status == 200);
+    if (!response.success) {
+        response.error_message = "HTTP " + std::to_string(status);
+    }
+    return true;
+}
+
+APIResponse APIClient::upload_bundle(const std::string& host, int port,
+                                   const std::string& /* expected_fingerprint */,
+                                   const std::string& transfer_id,
+                                   const std::vector<BundleEntry>& entries, bool bulk_io,
+                                   TransferCompressor* compressor, UploadProgressCallback progress_callback) {
+    APIResponse response;
+    std::string endpoint = "/api/v1/transfer/" + transfer_id + "/bundle";
+    BundleFramer framer(entries, bulk_io);
+    
+    if (compressor) {
+        // Frames are small; gather about a read buffer's worth into each block
+        std::string staged;
+        return post_chunked(host, port, endpoint + "?encoding=" + BLOCK_ENCODING, compressor,
+            [&](const char*& data, size_t& size) {
+                staged.clear();
+                while (staged.size() < IO_BUFFER_SIZE && !framer.done()) {
+                    const char* piece = nullptr;
+                    size_t piece_size = 0;
+                    if (!framer.next(piece, piece_size)) {
+                        return false;
+                    }
+                    staged.append(piece, piece_size);
+                }
+                data = staged.data();
+                size = staged.size();
+                return true;
+            },
+            progress_callback);
+    }
+    
+    uint64_t content_length = 0;
+    for (const auto& entry : entries) {
+        content_length += BUNDLE_FRAME_HEADER_SIZE + entry.size;
+    }
+    
+    try {
+        ConnectionLease connection(*this, host, port);
+        
+        bool aborted = false;
+        
+        auto result = connection.client().Post(endpoint.c_str(), static_cast<size_t>(content_length),
+            [&](size_t offset, size_t /* length */, httplib::DataSink& sink) {
+                const char* data = nullptr;
+                size_t written = 0;
+                if (!framer.next(data, written) || !sink.write(data, written)) {
+                    return false;
+                }
+                
+                if (progress_callback && !progress_callback(offset + written)) {
+                    aborted = true;
+                    return false;
+                }
+                return true;
+            },
+            "application/octet-stream");
+        
+        if (result) {
+            connection.mark_reusable();
+            response.status_code = result->status;
+            response.body = result->body;
+            response.success = (result->status == 200);
+            
+            if (!response.success) {
+                response.error_message = "HTTP " + std::to_string(result->status);
+            }
+        } else {
+            response.success = false;
+            response.status_code = 0;
+            response.error_message = aborted ? "Upload aborted" : "Connection failed";
+        }
+        
+    } catch (const std::exception& e) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = e.what();
+    }
+    
+    return response;
+}
+
+APIResponse APIClient::upload_delta(const std::string& host, int port,
+                                  const std::string& /* expected_fingerprint */,
+                                  const std::string& transfer_id, int file_index,
+                                  DeltaEncoder& encoder, TransferCompressor* compressor,
+                                  UploadProgressCallback progress_callback) {
+    std::string endpoint = "/api/v1/transfer/" + transfer_id + "/" + std::to_string(file_index) + "/delta";
+    if (compressor) {
+        endpoint += "?encoding=" + std::string(BLOCK_ENCODING);
+    }
+    
+    return post_chunked(host, port, endpoint, compressor,
+        [&](const char*& data, size_t& size) {
+            return encoder.next(data, size);
+        },
+        [&](uint64_t /* delta_bytes */) {
+            return !progress_callback || progress_callback(encoder.encoded_bytes());
+        });
+}
+
+APIResponse APIClient::post_chunked(const std::string& host, int port, const std::string& endpoint,
+                                  TransferCompressor* compressor,
+                                  const std::function<bool(const char*& data, size_t& size)>& next_block,
+                                  const UploadProgressCallback& progress_callback) {
+    APIResponse response;
+    
+    try {
+        ConnectionLease connection(*this, host, port);
+        
+        uint64_t raw_sent = 0;
+        bool aborted = false;
+        std::string encoded;
+        
+        auto result = connection.client().Post(endpoint.c_str(),
+            [&](size_t /* offset */, httplib::DataSink& sink) {
+                const char* data = nullptr;
+                size_t size = 0;
+                if (!next_block(data, size)) {
+                    return false;
+                }
+                if (size == 0) {
+                    sink.done();
+                    return true;
+                }
+                
+                if (compressor) {
+                    encoded.clear();
+                    for (size_t done = 0; done < size; done += MAX_COMPRESSION_BLOCK_SIZE) {
+                        compressor->encode(data + done, std::min(size - done, MAX_COMPRESSION_BLOCK_SIZE), encoded);
+                    }
+                    if (!sink.write(encoded.data(), encoded.size())) {
+                        return false;
+                    }
+                } else if (!sink.write(data, size)) {
+                    return false;
+                }
+                raw_sent += size;
+                
+                if (progress_callback && !progress_callback(raw_sent)) {
+                    aborted = true;
+                    return false;
+                }
+                return true;
+            },
+            "application/octet-stream");
+        
+        if (result) {
+            connection.mark_reusable();
+            copied_bytes_ += raw_sent;
+            response.status_code = result->status;
+            response.body = result->body;
+            response.success = (result->status == 200);
+            
+            if (!response.success) {
+                response.error_message = "HTTP " + std::to_string(result->status);
+            }
+        } else {
+            response.success = false;
+            response.status_code = 0;
+            response.error_message = aborted ? "Upload aborted" : "Connection failed";
+        }
+        
+    } catch (const std::exception& e) {
+        response.success = false;
+        response.status_code = 0;
+        response.error_message = e.what();
+    }
+    
+    return response;
+}
+
 void APIClient::set_client_certificate(const std::string& cert_file, const std::string& key_file) {
     client_cert_file_ = cert_file;
     client_key_file_ = key_file;
 }
 
+void APIClient::set_zero_copy_enabled(bool enabled) {
+    zero_copy_enabled_ = enabled;
+}
+
+uint64_t APIClient::get_zero_copy_bytes() const {
+    return zero_copy_bytes_;
+}
+
+uint64_t APIClient::get_copied_bytes() const {
+    return copied_bytes_;
+}
+
 bool APIClient::verify_server_certificate(const std::string& expected_fingerprint, 
                                          const std::string& server_cert) {
     std::string actual_fingerprint = calculate_certificate_fingerprint(server_cert);
@@ -164,4 +696,152 @@ std::string APIClient::calculate_certificate_fingerprint(const std::string& cert
     return ss.str();
 }
 
+APIClient::ConnectionLease::ConnectionLease(APIClient& owner, const std::string& host, int port)
+    : owner_(owner), key_(host + ":" + std::to_string(port)),
+      client_(owner.acquire_connection(host, port)), reusable_(false) {}
+
+APIClient::ConnectionLease::~ConnectionLease() {
+    owner_.release_connection(key_, reusable_ ? std::move(client_) : nullptr);
+}
+
+httplib::Client& APIClient::ConnectionLease::client() {
+    return *client_;
+}
+
+void APIClient::ConnectionLease::mark_reusable() {
+    reusable_ = true;
+}
+
+std::unique_ptr<httplib::Client> APIClient::acquire_connection(const std::string& host, int port) {
+    std::string key = host + ":" + std::to_string(port);
+    
+    while (true) {
+        IdleConnection idle;
+        {
+            std::unique_lock<std::mutex> lock(connections_mutex_);
+            expire_idle_connections(std::chrono::steady_clock::now());
+            
+            PeerConnections& peer = connections_[key];
+            ++peer.waiting;
+            connections_cv_.wait(lock, [&]() {
+                return !peer.idle.empty() || peer.leased < MAX_CONNECTIONS_PER_PEER;
+            });
+            --peer.waiting;
+            
+            ++peer.leased;
+            if (peer.idle.empty()) {
+                break;
+            }
+            
+            // Most recently used first, it is the most likely to still be open
+            idle = std::move(peer.idle.back());
+            peer.idle.pop_back();
+        }
+        
+        if (std::chrono::steady_clock::now() - idle.idle_since < HEALTH_CHECK_AFTER ||
+            is_connection_healthy(*idle.client)) {
+            return std::move(idle.client);
+        }
+        
+        // Dead connection: give the slot back and try the next one
+        release_connection(key, nullptr);
+    }
+    
+    // For now, use regular HTTP client - SSL will be implemented later
+    auto client = std::make_unique<httplib::Client>(host, port);
+    client->set_keep_alive(true);
+    client->set_tcp_nodelay(true);
+    client->set_read_timeout(READ_TIMEOUT_SECONDS, 0);
+    return client;
+}
+
+void APIClient::release_connection(const std::string& key, std::unique_ptr<httplib::Client> client) {
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        PeerConnections& peer = connections_[key];
+        --peer.leased;
+        if (client) {
+            peer.idle.push_back({std::move(client), std::chrono::steady_clock::now()});
+        }
+        expire_idle_connections(std::chrono::steady_clock::now());
+    }
+    connections_cv_.notify_all();
+}
+
+void APIClient::expire_idle_connections(std::chrono::steady_clock::time_point now) {
+    for (auto it = connections_.begin(); it != connections_.end();) {
+        auto& idle = it->second.idle;
+        idle.erase(std::remove_if(idle.begin(), idle.end(), [&](const IdleConnection& connection) {
+            return now - connection.idle_since >= IDLE_CONNECTION_TIMEOUT;
+        }), idle.end());
+        
+        if (idle.empty() && it->second.leased == 0 && it->second.waiting == 0) {
+            it = connections_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    
+    for (auto it = zero_copy_connections_.begin(); it != zero_copy_connections_.end();) {
+        auto& idle = it->second;
+        idle.erase(std::remove_if(idle.begin(), idle.end(), [&](const IdleZeroCopyConnection& connection) {
+            return now - connection.idle_since >= IDLE_CONNECTION_TIMEOUT;
+        }), idle.end());
+        it = idle.empty() ? zero_copy_connections_.erase(it) : std::next(it);
+    }
+}
+
+bool APIClient::is_connection_healthy(httplib::Client& client) {
+    if (!client.is_socket_open()) {
+        return false;
+    }
+    auto result = client.Get("/health");
+    return result && result->status == 200;
+}
+
+std::unique_ptr<ZeroCopyConnection> APIClient::acquire_zero_copy_connection(const std::string& host, int port) {
+    std::string key = host + ":" + std::to_string(port);
+    
+    // Zero-copy connections share the per-peer limit with the httplib ones
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex_);
+        expire_idle_connections(std::chrono::steady_clock::now());
+        
+        PeerConnections& peer = connections_[key];
+        ++peer.waiting;
+        connections_cv_.wait(lock, [&]() { return peer.leased < MAX_CONNECTIONS_PER_PEER; });
+        --peer.waiting;
+        ++peer.leased;
+        
+        auto found = zero_copy_connections_.find(key);
+        while (found != zero_copy_connections_.end() && !found->second.empty()) {
+            auto connection = std::move(found->second.back().connection);
+            found->second.pop_back();
+            if (connection->is_alive()) {
+                return connection;
+            }
+        }
+    }
+    
+    auto connection = std::make_unique<ZeroCopyConnection>(host, port);
+    if (!connection->connect()) {
+        release_zero_copy_connection(key, nullptr);
+        return nullptr;
+    }
+    return connection;
+}
+
+void APIClient::release_zero_copy_connection(const std::string& key,
+                                             std::unique_ptr<ZeroCopyConnection> connection) {
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        --connections_[key].leased;
+        if (connection) {
+            zero_copy_connections_[key].push_back({std::move(connection), std::chrono::steady_clock::now()});
+        }
+        expire_idle_connections(std::chrono::steady_clock::now());
+    }
+    connections_cv_.notify_all();
+}
+
 } // namespace warpdeck
\ No newline at end of file
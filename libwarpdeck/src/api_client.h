@@ -4,10 +4,19 @@
 #include <functional>
 #include <memory>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
 #include "api_server.h"
+#include "zero_copy_sender.h"
 
 namespace warpdeck {
 
+class TransferCompressor;
+class DeltaEncoder;
+
 struct APIResponse {
     int status_code;
     std::string body;
@@ -15,8 +24,28 @@ struct APIResponse {
     std::string error_message;
 };
 
+struct BundleEntry {
+    int file_index;
+    std::string file_path;
+    uint64_t size;
+};
+
 class APIClient {
 public:
+    // Called with the bytes of the current upload sent so far; return false to abort it
+    using UploadProgressCallback = std::function<bool(uint64_t bytes_sent)>;
+
+    // Connection pool limits. Idle connections expire before the server's
+    // keep-alive timeout, and ones idle longer than HEALTH_CHECK_AFTER are
+    // probed with /health before reuse.
+    static constexpr int MAX_CONNECTIONS_PER_PEER = 16;
+    static constexpr std::chrono::seconds IDLE_CONNECTION_TIMEOUT{20};
+    static constexpr std::chrono::seconds HEALTH_CHECK_AFTER{2};
+    static constexpr int READ_TIMEOUT_SECONDS = 30;
+    
+    // Ranges smaller than this go through httplib; the zero-copy setup is not worth it
+    static constexpr uint64_t ZERO_COPY_MIN_LENGTH = 1024 * 1024;
+
     APIClient();
     ~APIClient();
 
@@ -29,18 +58,129 @@ public:
                                 const std::string& expected_fingerprint,
                                 const TransferRequest& request);
     
+    // Sends files [begin, end) as the manifest page starting at file `begin`
+    APIResponse send_manifest_page(const std::string& host, int port,
+                                   const std::string& expected_fingerprint,
+                                   const std::string& transfer_id,
+                                   const std::vector<FileMetadata>& files, size_t begin, size_t end);
+    
+    // Received and missing ranges of a transfer on the peer (TransferReceiveStatus JSON)
+    APIResponse get_transfer_status(const std::string& host, int port,
+                                    const std::string& expected_fingerprint,
+                                    const std::string& transfer_id);
+    
+    // Delta signature (delta.h wire form) of the peer's older copy of a file
+    APIResponse get_delta_signature(const std::string& host, int port,
+                                    const std::string& expected_fingerprint,
+                                    const std::string& transfer_id, int file_index);
+    
     // File upload endpoint
     APIResponse upload_file(const std::string& host, int port,
                            const std::string& expected_fingerprint,
                            const std::string& transfer_id, int file_index,
                            const std::vector<uint8_t>& file_data);
+    
+    // Offset-addressed upload of [offset, offset + length) of a file; chunks may
+    // arrive in any order since the receiver writes each one at its offset.
+    // With a compressor the body is block-encoded (see compression.h).
+    APIResponse upload_file_range(const std::string& host, int port,
+                                  const std::string& expected_fingerprint,
+                                  const std::string& transfer_id, int file_index,
+                                  const std::string& file_path, uint64_t offset, uint64_t length,
+                                  bool bulk_io, TransferCompressor* compressor,
+                                  UploadProgressCallback progress_callback);
+    
+    // Sends several small files in one framed request body (see BUNDLE_FRAME_HEADER_SIZE),
+    // block-encoded when a compressor is given
+    APIResponse upload_bundle(const std::string& host, int port,
+                              const std::string& expected_fingerprint,
+                              const std::string& transfer_id,
+                              const std::vector<BundleEntry>& entries, bool bulk_io,
+                              TransferCompressor* compressor, UploadProgressCallback progress_callback);
+
+    // Sends the whole file as the delta `encoder` produces against that copy,
+    // block-encoded when a compressor is given. Progress counts bytes of the
+    // file covered, not bytes sent.
+    APIResponse upload_delta(const std::string& host, int port,
+                             const std::string& expected_fingerprint,
+                             const std::string& transfer_id, int file_index,
+                             DeltaEncoder& encoder, TransferCompressor* compressor,
+                             UploadProgressCallback progress_callback);
 
     void set_client_certificate(const std::string& cert_file, const std::string& key_file);
+    
+    // File range uploads over plain connections use sendfile/splice when enabled
+    void set_zero_copy_enabled(bool enabled);
+    uint64_t get_zero_copy_bytes() const;
+    uint64_t get_copied_bytes() const;
 
 private:
     bool verify_server_certificate(const std::string& expected_fingerprint, 
                                   const std::string& server_cert);
     std::string calculate_certificate_fingerprint(const std::string& cert_pem);
+    // bulk_io reads the file without leaving it in the page cache
+    APIResponse stream_file_range(const std::string& host, int port, const std::string& endpoint,
+                                  const std::string& file_path, uint64_t offset, uint64_t length,
+                                  bool bulk_io, UploadProgressCallback progress_callback);
+    bool send_zero_copy(const std::string& host, int port, const std::string& endpoint,
+                        const std::string& file_path, uint64_t offset, uint64_t length, bool bulk_io,
+                        const UploadProgressCallback& progress_callback, APIResponse& response);
+    // Posts the blocks next_block produces (size 0 once there are no more), block-encoded
+    // when a compressor is given, with chunked transfer encoding since the length isn't
+    // known up front. Progress counts bytes before encoding.
+    APIResponse post_chunked(const std::string& host, int port, const std::string& endpoint,
+                             TransferCompressor* compressor,
+                             const std::function<bool(const char*& data, size_t& size)>& next_block,
+                             const UploadProgressCallback& progress_callback);
+    
+    // Exclusive use of one pooled keep-alive connection; hands it back to the
+    // pool on destruction if the last request on it completed
+    class ConnectionLease {
+    public:
+        ConnectionLease(APIClient& owner, const std::string& host, int port);
+        ~ConnectionLease();
+        
+        httplib::Client& client();
+        void mark_reusable();
+        
+    private:
+        APIClient& owner_;
+        std::string key_;
+        std::unique_ptr<httplib::Client> client_;
+        bool reusable_;
+    };
+    
+    struct IdleConnection {
+        std::unique_ptr<httplib::Client> client;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+    
+    struct PeerConnections {
+        std::vector<IdleConnection> idle;
+        int leased = 0;
+        int waiting = 0;
+    };
+    
+    struct IdleZeroCopyConnection {
+        std::unique_ptr<ZeroCopyConnection> connection;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+    
+    std::unique_ptr<httplib::Client> acquire_connection(const std::string& host, int port);
+    void release_connection(const std::string& key, std::unique_ptr<httplib::Client> client);
+    void expire_idle_connections(std::chrono::steady_clock::time_point now);
+    static bool is_connection_healthy(httplib::Client& client);
+    std::unique_ptr<ZeroCopyConnection> acquire_zero_copy_connection(const std::string& host, int port);
+    void release_zero_copy_connection(const std::string& key, std::unique_ptr<ZeroCopyConnection> connection);
+    
+    std::mutex connections_mutex_;
+    std::condition_variable connections_cv_;
+    std::map<std::string, PeerConnections> connections_;
+    std::map<std::string, std::vector<IdleZeroCopyConnection>> zero_copy_connections_;
+    
+    std::atomic<bool> zero_copy_enabled_;
+    std::atomic<uint64_t> zero_copy_bytes_;
+    std::atomic<uint64_t> copied_bytes_;
     
     std::string client_cert_file_;
     std::string client_key_file_;
@@ -1,5 +1,6 @@
 #include "api_server.h"
 #include "utils.h"
+#include "compression.h"
 #include <nlohmann/json.hpp>
 #include <thread>
 #include <iostream>
@@ -7,6 +8,31 @@
 
 namespace warpdeck {
 
+namespace {
+
+bool is_block_encoded(const httplib::Request& req) {
+    return req.has_param("encoding") && req.get_param_value("encoding") == BLOCK_ENCODING;
+}
+
+// Block-encoded bodies are decoded on the way to the receiver, which sees only the original bytes
+BodyReader make_body_reader(const httplib::ContentReader& content_reader, bool block_encoded) {
+    if (!block_encoded) {
+        return [&content_reader](std::function<bool(const char*, size_t)> receiver) {
+            return content_reader([&receiver](const char* data, size_t length) {
+                return receiver(data, length);
+            });
+        };
+    }
+    return [&content_reader](std::function<bool(const char*, size_t)> receiver) {
+        BlockDecoder decoder;
+        return content_reader([&decoder, &receiver](const char* data, size_t length) {
+            return decoder.feed(data, length, receiver);
+        }) && decoder.at_block_boundary();
+    };
+}
+
+} // namespace
+
 APIServer::APIServer() : port_(0), running_(false) {}
 
 APIServer::~APIServer() {
@@ -26,6 +52,11 @@ bool APIServer::start(int port, const DeviceInfo& device_info) {
         return false;
     }
     
+    // Parallel upload streams hold their connections open, so size the pool for them
+    server_->new_task_queue = [] { return new httplib::ThreadPool(SERVER_THREAD_COUNT); };
+    server_->set_keep_alive_timeout(SERVER_KEEP_ALIVE_TIMEOUT_SECONDS);
+    server_->set_keep_alive_max_count(SERVER_KEEP_ALIVE_MAX_REQUESTS);
+    
     // Setup routes
     setup_routes();
     
@@ -90,6 +121,30 @@ void APIServer::set_file_upload_callback(FileUploadCallback callback) {
     file_upload_callback_ = callback;
 }
 
+void APIServer::set_chunk_upload_callback(ChunkUploadCallback callback) {
+    chunk_upload_callback_ = callback;
+}
+
+void APIServer::set_bundle_upload_callback(BundleUploadCallback callback) {
+    bundle_upload_callback_ = callback;
+}
+
+void APIServer::set_manifest_page_callback(ManifestPageCallback callback) {
+    manifest_page_callback_ = callback;
+}
+
+void APIServer::set_transfer_status_callback(TransferStatusCallback callback) {
+    transfer_status_callback_ = callback;
+}
+
+void APIServer::set_delta_signature_callback(DeltaSignatureCallback callback) {
+    delta_signature_callback_ = callback;
+}
+
+void APIServer::set_delta_upload_callback(DeltaUploadCallback callback) {
+    delta_upload_callback_ = callback;
+}
+
 void APIServer::set_ssl_certificate(const std::string& cert_file, const std::string& key_file) {
     // Store certificate paths for use when creating the server
     cert_file_ = cert_file;
@@ -147,19 +202,25 @@ void APIServer::setup_routes() {
             
             // Handle through callback
             if (transfer_request_callback_) {
-                transfer_request_callback_(client_fingerprint, transfer_req, 
-                    [&res](bool approved, const std::string& transfer_id) {
+                transfer_request_callback_(client_fingerprint, req.remote_addr, transfer_req, 
+                    [&res, &transfer_req](bool approved, const std::string& transfer_id) {
                         if (approved) {
                             TransferSession session;
                             session.transfer_id = transfer_id;
                             session.status = "ready_to_receive";
                             session.expires_at = utils::get_expiry_timestamp(30);
+                            session.compression = compression_codec_name(
+                                choose_compression_codec(transfer_req.compression));
                             
                             nlohmann::json response_json;
                             response_json["transfer_id"] = session.transfer_id;
                             response_json["status"] = session.status;
                             response_json["expires_at"] = session.expires_at;
                             
+                            if (!session.compression.empty()) {
+                                response_json["compression"] = session.compression;
+                            }
+                            
                             res.status = 202;
                             res.set_content(response_json.dump(), "application/json");
                         } else {
@@ -182,14 +243,215 @@ void APIServer::setup_routes() {
     });
     
     // POST /api/v1/transfer/{transfer_id}/{file_index} - File upload endpoint
-    server_->Post(R"(/api/v1/transfer/([^/]+)/(\d+))", [this](const httplib::Request& req, httplib::Response& res) {
+    // The body is streamed to the handler instead of being buffered in req.body
+    server_->Post(R"(/api/v1/transfer/([^/]+)/(\d+))", [this](const httplib::Request& req, httplib::Response& res,
+                                                              const httplib::ContentReader& content_reader) {
         try {
             std::string transfer_id = req.matches[1];
             int file_index = std::stoi(req.matches[2]);
+            uint64_t content_length = req.has_header("Content-Length") ?
+                std::stoull(req.get_header_value("Content-Length")) : 0;
+            
+            BodyReader read_body = make_body_reader(content_reader, is_block_encoded(req));
             
             // Handle through callback
             if (file_upload_callback_) {
-                file_upload_callback_(transfer_id, file_index, req.body,
+                file_upload_callback_(transfer_id, file_index, content_length, read_body,
+                    [&res](bool success, const std::string& error) {
+                        if (success) {
+                            res.status = 200;
+                        } else {
+                            res.status = 500;
+                            nlohmann::json error_json;
+                            error_json["error_code"] = "UPLOAD_FAILED";
+                            error_json["message"] = error.empty() ? "Upload failed" : error;
+                            res.set_content(error_json.dump(), "application/json");
+                        }
+                    });
+            } else {
+                res.status = 500;
+                res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"No upload handler configured\"}", 
+                               "application/json");
+            }
+            
+        } catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"Internal server error\"}", 
+                           "application/json");
+        }
+    });
+    
+    // POST /api/v1/transfer/{transfer_id}/{file_index}/chunk?offset=N - Offset-addressed chunk upload
+    // The body length (Content-Length) is the chunk length; with ?encoding=blocks&length=L
+    // the body is block-encoded (see compression.h) and decodes to L bytes
+    server_->Post(R"(/api/v1/transfer/([^/]+)/(\d+)/chunk)", [this](const httplib::Request& req, httplib::Response& res,
+                                                                    const httplib::ContentReader& content_reader) {
+        try {
+            std::string transfer_id = req.matches[1];
+            int file_index = std::stoi(req.matches[2]);
+            
+            // A block-encoded body is sent chunked, so its decoded length comes as a parameter
+            bool block_encoded = is_block_encoded(req);
+            if (!req.has_param("offset") ||
+                !(block_encoded ? req.has_param("length") : req.has_header("Content-Length"))) {
+                res.status = 400;
+                res.set_content("{\"error_code\":\"INVALID_REQUEST\",\"message\":\"Chunk offset and length are required\"}", 
+                               "application/json");
+                return;
+            }
+            
+            uint64_t offset = std::stoull(req.get_param_value("offset"));
+            uint64_t length = std::stoull(block_encoded ? req.get_param_value("length") :
+                                                          req.get_header_value("Content-Length"));
+            
+            BodyReader read_body = make_body_reader(content_reader, block_encoded);
+            
+            if (chunk_upload_callback_) {
+                chunk_upload_callback_(transfer_id, file_index, offset, length, read_body,
+                    [&res](bool success, const std::string& error) {
+                        if (success) {
+                            res.status = 200;
+                        } else {
+                            res.status = 500;
+                            nlohmann::json error_json;
+                            error_json["error_code"] = "UPLOAD_FAILED";
+                            error_json["message"] = error.empty() ? "Upload failed" : error;
+                            res.set_content(error_json.dump(), "application/json");
+                        }
+                    });
+            } else {
+                res.status = 500;
+                res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"No upload handler configured\"}", 
+                               "application/json");
+            }
+            
+        } catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"Internal server error\"}", 
+                           "application/json");
+        }
+    });
+    
+    // POST /api/v1/transfer/{transfer_id}/bundle - Many small files in one framed body
+    server_->Post(R"(/api/v1/transfer/([^/]+)/bundle)", [this](const httplib::Request& req, httplib::Response& res,
+                                                             const httplib::ContentReader& content_reader) {
+        try {
+            std::string transfer_id = req.matches[1];
+            
+            BodyReader read_body = make_body_reader(content_reader, is_block_encoded(req));
+            
+            if (bundle_upload_callback_) {
+                bundle_upload_callback_(transfer_id, read_body,
+                    [&res](bool success, const std::string& error) {
+                        if (success) {
+                            res.status = 200;
+                        } else {
+                            res.status = 500;
+                            nlohmann::json error_json;
+                            error_json["error_code"] = "UPLOAD_FAILED";
+                            error_json["message"] = error.empty() ? "Upload failed" : error;
+                            res.set_content(error_json.dump(), "application/json");
+                        }
+                    });
+            } else {
+                res.status = 500;
+                res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"No upload handler configured\"}", 
+                               "application/json");
+            }
+            
+        } catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"Internal server error\"}", 
+                           "application/json");
+        }
+    });
+    
+    // POST /api/v1/transfer/{transfer_id}/manifest?first_file=N - Next page of a paged manifest
+    server_->Post(R"(/api/v1/transfer/([^/]+)/manifest)", [this](const httplib::Request& req, httplib::Response& res) {
+        try {
+            std::string transfer_id = req.matches[1];
+            
+            std::vector<FileMetadata> files;
+            if (!req.has_param("first_file") || !utils::parse_manifest_page(req.body, files) ||
+                files.size() > MANIFEST_PAGE_FILES) {
+                res.status = 400;
+                res.set_content("{\"error_code\":\"INVALID_REQUEST\",\"message\":\"Invalid manifest page\"}", 
+                               "application/json");
+                return;
+            }
+            uint64_t first_file = std::stoull(req.get_param_value("first_file"));
+            
+            if (!manifest_page_callback_ || !manifest_page_callback_(transfer_id, first_file, files)) {
+                res.status = 409;
+                res.set_content("{\"error_code\":\"MANIFEST_REJECTED\",\"message\":\"Manifest page not accepted\"}", 
+                               "application/json");
+                return;
+            }
+            res.status = 200;
+        } catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"Internal server error\"}", 
+                           "application/json");
+        }
+    });
+    
+    // GET /api/v1/transfer/{transfer_id}/status - Received and missing ranges, for resuming
+    server_->Get(R"(/api/v1/transfer/([^/]+)/status)", [this](const httplib::Request& req, httplib::Response& res) {
+        try {
+            std::string transfer_id = req.matches[1];
+            
+            TransferReceiveStatus status;
+            if (!transfer_status_callback_ || !transfer_status_callback_(transfer_id, status)) {
+                res.status = 404;
+                res.set_content("{\"error_code\":\"TRANSFER_NOT_FOUND\",\"message\":\"Unknown transfer\"}", 
+                               "application/json");
+                return;
+            }
+            
+            res.set_content(utils::transfer_receive_status_to_json(status), "application/json");
+            res.status = 200;
+        } catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"Internal server error\"}", 
+                           "application/json");
+        }
+    });
+    
+    // GET /api/v1/transfer/{transfer_id}/{file_index}/signature - Delta signature of the receiver's older copy
+    server_->Get(R"(/api/v1/transfer/([^/]+)/(\d+)/signature)", [this](const httplib::Request& req, httplib::Response& res) {
+        try {
+            std::string transfer_id = req.matches[1];
+            int file_index = std::stoi(req.matches[2]);
+            
+            std::string signature;
+            if (!delta_signature_callback_ || !delta_signature_callback_(transfer_id, file_index, signature)) {
+                res.status = 404;
+                res.set_content("{\"error_code\":\"NO_DELTA_BASIS\",\"message\":\"No older copy to send a delta against\"}", 
+                               "application/json");
+                return;
+            }
+            
+            res.set_content(signature, "application/octet-stream");
+            res.status = 200;
+        } catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content("{\"error_code\":\"SERVER_ERROR\",\"message\":\"Internal server error\"}", 
+                           "application/json");
+        }
+    });
+    
+    // POST /api/v1/transfer/{transfer_id}/{file_index}/delta - Whole file as a delta against that copy
+    // The delta (see delta.h) may itself be block-encoded with ?encoding=blocks
+    server_->Post(R"(/api/v1/transfer/([^/]+)/(\d+)/delta)", [this](const httplib::Request& req, httplib::Response& res,
+                                                                    const httplib::ContentReader& content_reader) {
+        try {
+            std::string transfer_id = req.matches[1];
+            int file_index = std::stoi(req.matches[2]);
+            
+            BodyReader read_body = make_body_reader(content_reader, is_block_encoded(req));
+            
+            if (delta_upload_callback_) {
+                delta_upload_callback_(transfer_id, file_index, read_body,
                     [&res](bool success, const std::string& error) {
                         if (success) {
                             res.status = 200;
@@ -3,6 +3,8 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <vector>
+#include <utility>
 #include <httplib.h>
 
 namespace warpdeck {
@@ -17,29 +19,113 @@ struct DeviceInfo {
 struct FileMetadata {
     std::string name;
     uint64_t size;
-    std::string hash; // optional SHA256 hash
+    std::string hash; // optional Merkle root over chunk_hashes (see tree_hash.h)
+    uint64_t chunk_size = 0; // leaf size of the tree hash; 0 without one
+    std::vector<std::string> chunk_hashes; // SHA-256 of each leaf
+    int64_t mtime_ns = 0; // sender's modification time, kept on the received copy; 0 if not sent
+    int64_t duplicate_of = -1; // an earlier file of the transfer with the same content, sent only once
 };
 
+// Transfers of many files send their manifest in pages: the request carries
+// the first page, and the rest follow to /manifest once it is accepted. A
+// page ends at MANIFEST_PAGE_FILES files or, past its first file, at
+// MANIFEST_PAGE_CHUNKS chunk hashes.
+constexpr size_t MANIFEST_PAGE_FILES = 1000;
+constexpr size_t MANIFEST_PAGE_CHUNKS = 32768;
+constexpr uint64_t MAX_MANIFEST_FILES = 1000000;
+// Bound on a transfer's announced bytes, so sums of file sizes can't wrap
+constexpr uint64_t MAX_TRANSFER_BYTES = 1ULL << 60;
+
 struct TransferRequest {
-    std::vector<FileMetadata> files;
+    std::vector<FileMetadata> files; // the first manifest page
+    uint64_t file_count = 0;  // files in the whole manifest; beyond files.size() if it continues in pages
+    uint64_t total_bytes = 0; // their combined size, with file_count
+    bool bulk_io = false; // receiver should write without filling its page cache
+    std::vector<std::string> compression; // codecs the sender can encode uploads with, preferred first
+    bool sync = false;          // files the receiver already holds with the same content are skipped
+    bool delete_extras = false; // with sync, files under the synced directories the sender lacks are removed
+    std::string sender_device_id; // the ID the sender advertises in discovery
 };
 
+// How long the receiver holds a transfer request open waiting for the user
+constexpr int TRANSFER_APPROVAL_TIMEOUT_SECONDS = 120;
+
+// Each upload stream keeps a connection, and with it a server thread, busy
+constexpr size_t SERVER_THREAD_COUNT = 32;
+
+// Let senders keep pooled connections open across many chunk requests
+constexpr time_t SERVER_KEEP_ALIVE_TIMEOUT_SECONDS = 30;
+constexpr size_t SERVER_KEEP_ALIVE_MAX_REQUESTS = 100000;
+
 struct TransferSession {
     std::string transfer_id;
     std::string status;
     std::string expires_at;
+    std::string compression; // codec the receiver accepted for block-encoded uploads; empty for none
 };
 
+// What the receiver already holds of a transfer, so an interrupted sender
+// resends only the gaps
+struct FileReceiveStatus {
+    uint64_t size = 0;
+    uint64_t received_bytes = 0;
+    bool complete = false; // finalized into the download folder
+    bool delta_basis = false; // an older copy is in place, so the file can be sent as a delta (see delta.h)
+    std::vector<std::pair<uint64_t, uint64_t>> missing; // (offset, length)
+};
+
+struct TransferReceiveStatus {
+    std::string transfer_id;
+    std::string status; // "pending_approval" or "ready_to_receive"
+    std::vector<FileReceiveStatus> files;
+};
+
+// Pulls a request body through `receiver` piece by piece; returns false if the
+// connection failed or the receiver asked to stop
+using BodyReader = std::function<bool(std::function<bool(const char* data, size_t length)> receiver)>;
+
+// A bundle upload carries many small files in one request body as a sequence of
+// frames: [u32 file_index][u64 length] (big-endian) followed by `length` bytes
+constexpr size_t BUNDLE_FRAME_HEADER_SIZE = 12;
+
 class APIServer {
 public:
     using TransferRequestCallback = std::function<void(const std::string& client_fingerprint, 
+                                                       const std::string& remote_address,
                                                        const TransferRequest& request,
                                                        std::function<void(bool approved, const std::string& transfer_id)> response_callback)>;
     using FileUploadCallback = std::function<void(const std::string& transfer_id, 
                                                    int file_index, 
-                                                   const std::string& data,
+                                                   uint64_t content_length,
+                                                   const BodyReader& read_body,
                                                    std::function<void(bool success, const std::string& error)> response_callback)>;
+    using ChunkUploadCallback = std::function<void(const std::string& transfer_id,
+                                                    int file_index,
+                                                    uint64_t offset,
+                                                    uint64_t length,
+                                                    const BodyReader& read_body,
+                                                    std::function<void(bool success, const std::string& error)> response_callback)>;
+
+    using BundleUploadCallback = std::function<void(const std::string& transfer_id,
+                                                     const BodyReader& read_body,
+                                                     std::function<void(bool success, const std::string& error)> response_callback)>;
 
+    // Appends files starting at index first_file to an accepted transfer's manifest
+    using ManifestPageCallback = std::function<bool(const std::string& transfer_id, uint64_t first_file,
+                                                    const std::vector<FileMetadata>& files)>;
+
+    // Fills `signature` (delta.h wire form) for the receiver's older copy of a file; false if there is none
+    using DeltaSignatureCallback = std::function<bool(const std::string& transfer_id, int file_index,
+                                                      std::string& signature)>;
+    // The body is a delta against that copy and rebuilds the whole file
+    using DeltaUploadCallback = std::function<void(const std::string& transfer_id,
+                                                    int file_index,
+                                                    const BodyReader& read_body,
+                                                    std::function<void(bool success, const std::string& error)> response_callback)>;
+
+    // Fills `status` and returns true if the transfer is known
+    using TransferStatusCallback = std::function<bool(const std::string& transfer_id, TransferReceiveStatus& status)>;
+    
     APIServer();
     ~APIServer();
 
@@ -49,6 +135,12 @@ public:
     
     void set_transfer_request_callback(TransferRequestCallback callback);
     void set_file_upload_callback(FileUploadCallback callback);
+    void set_chunk_upload_callback(ChunkUploadCallback callback);
+    void set_bundle_upload_callback(BundleUploadCallback callback);
+    void set_manifest_page_callback(ManifestPageCallback callback);
+    void set_transfer_status_callback(TransferStatusCallback callback);
+    void set_delta_signature_callback(DeltaSignatureCallback callback);
+    void set_delta_upload_callback(DeltaUploadCallback callback);
     
     void set_ssl_certificate(const std::string& cert_file, const std::string& key_file);
 
@@ -66,6 +158,12 @@ private:
     
     TransferRequestCallback transfer_request_callback_;
     FileUploadCallback file_upload_callback_;
+    ChunkUploadCallback chunk_upload_callback_;
+    BundleUploadCallback bundle_upload_callback_;
+    ManifestPageCallback manifest_page_callback_;
+    TransferStatusCallback transfer_status_callback_;
+    DeltaSignatureCallback delta_signature_callback_;
+    DeltaUploadCallback delta_upload_callback_;
 };
 
 } // namespace warpdeck
\ No newline at end of file
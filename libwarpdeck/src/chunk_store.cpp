@@ -0,0 +1,219 @@
+#include "chunk_store.h"
+#include "tree_hash.h"
+#include "utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace warpdeck {
+
+namespace {
+
+int64_t now_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool is_leaf_hash(const std::string& name) {
+    return name.size() == HASH_DIGEST_SIZE * 2 &&
+           std::all_of(name.begin(), name.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+} // namespace
+
+ChunkStore::ChunkStore() : max_size_(0), total_size_(0), next_temp_id_(0) {}
+
+bool ChunkStore::open(const std::string& directory, uint64_t max_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    total_size_ = 0;
+    directory_.clear();
+    max_size_ = max_size;
+
+    std::error_code error;
+    if (max_size == 0) {
+        std::filesystem::remove_all(directory, error);
+        return true;
+    }
+    if (!utils::create_directory(directory)) {
+        return false;
+    }
+
+    // Rebuild the index from the files; leftovers of interrupted stores go
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, error);
+         !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (!it->is_regular_file(error)) {
+            continue;
+        }
+        std::string name = it->path().filename().string();
+        struct stat st;
+        if (!is_leaf_hash(name) || ::stat(it->path().c_str(), &st) != 0) {
+            std::filesystem::remove(it->path(), error);
+            error.clear();
+            continue;
+        }
+#ifdef WARPDECK_PLATFORM_MACOS
+        int64_t mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        entries_[name] = {static_cast<uint64_t>(st.st_size), mtime_ns};
+        total_size_ += static_cast<uint64_t>(st.st_size);
+    }
+
+    directory_ = directory;
+    evict(max_size_);
+    LOG_TRANSFER_INFO() << "Chunk store holds " << entries_.size() << " chunk(s), " << total_size_ << " of "
+                        << max_size_ << " bytes";
+    return true;
+}
+
+bool ChunkStore::is_open() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !directory_.empty();
+}
+
+bool ChunkStore::contains(const std::string& leaf_hash, uint64_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(leaf_hash);
+    return it != entries_.end() && it->second.size == length;
+}
+
+bool ChunkStore::copy_to(const std::string& leaf_hash, int fd, uint64_t offset, uint64_t length) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(leaf_hash);
+        if (directory_.empty() || it == entries_.end() || it->second.size != length) {
+            return false;
+        }
+        it->second.last_used = now_nanoseconds();
+        path = chunk_path(leaf_hash);
+    }
+
+    // A chunk evicted meanwhile is simply a miss
+    int chunk_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (chunk_fd < 0) {
+        return false;
+    }
+    bool copied = utils::copy_file_data(chunk_fd, 0, fd, offset, length);
+    ::futimens(chunk_fd, nullptr);
+    ::close(chunk_fd);
+    return copied;
+}
+
+void ChunkStore::store_file(const std::string& path, const FileMetadata& file) {
+    if (file.chunk_hashes.empty() || file.chunk_size == 0) {
+        return;
+    }
+
+    int fd = -1;
+    for (size_t index = 0; index < file.chunk_hashes.size(); ++index) {
+        const std::string& leaf_hash = file.chunk_hashes[index];
+        uint64_t offset = index * file.chunk_size;
+        uint64_t length = std::min(file.chunk_size, file.size - offset);
+        if (length < MIN_CHUNK_SIZE) {
+            continue;
+        }
+
+        std::string chunk;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (directory_.empty() || length > max_size_) {
+                break;
+            }
+            auto it = entries_.find(leaf_hash);
+            if (it != entries_.end()) {
+                it->second.last_used = now_nanoseconds();
+                continue;
+            }
+            chunk = chunk_path(leaf_hash);
+        }
+
+        if (fd < 0) {
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+        }
+
+        // Written under a private name and renamed, so readers never see a partial chunk
+        std::string temp = chunk + "." + std::to_string(next_temp_id_++) + ".tmp";
+        if (!utils::create_directory(utils::get_parent_directory(chunk))) {
+            break;
+        }
+        int chunk_fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (chunk_fd < 0) {
+            break;
+        }
+        bool copied = utils::copy_file_data(fd, offset, chunk_fd, 0, length);
+        ::close(chunk_fd);
+        if (!copied || ::rename(temp.c_str(), chunk.c_str()) != 0) {
+            ::unlink(temp.c_str());
+            LOG_TRANSFER_WARN() << "Cannot add a chunk of " << file.name << " to the chunk store";
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (entries_.emplace(leaf_hash, Entry{length, now_nanoseconds()}).second) {
+            total_size_ += length;
+        }
+        if (total_size_ > max_size_) {
+            // Evict a quarter at a time rather than a chunk per store
+            evict(max_size_ - max_size_ / 4);
+        }
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void ChunkStore::remove(const std::string& leaf_hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(leaf_hash);
+    if (it == entries_.end()) {
+        return;
+    }
+    total_size_ -= it->second.size;
+    ::unlink(chunk_path(leaf_hash).c_str());
+    entries_.erase(it);
+}
+
+std::string ChunkStore::chunk_path(const std::string& leaf_hash) const {
+    return directory_ + "/" + leaf_hash.substr(0, 2) + "/" + leaf_hash;
+}
+
+void ChunkStore::evict(uint64_t target) {
+    if (total_size_ <= target) {
+        return;
+    }
+
+    std::vector<std::pair<int64_t, std::string>> by_age;
+    by_age.reserve(entries_.size());
+    for (const auto& [leaf_hash, entry] : entries_) {
+        by_age.emplace_back(entry.last_used, leaf_hash);
+    }
+    std::sort(by_age.begin(), by_age.end());
+
+    size_t evicted = 0;
+    for (const auto& [last_used, leaf_hash] : by_age) {
+        if (total_size_ <= target) {
+            break;
+        }
+        auto it = entries_.find(leaf_hash);
+        total_size_ -= it->second.size;
+        ::unlink(chunk_path(leaf_hash).c_str());
+        entries_.erase(it);
+        ++evicted;
+    }
+    LOG_TRANSFER_DEBUG() << "Evicted " << evicted << " chunk(s) from the chunk store";
+}
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include "api_server.h"
+
+namespace warpdeck {
+
+// Content-addressed store of file chunks that arrived and passed verification,
+// keyed by their tree hash leaf (see tree_hash.h). A receive looks up the
+// leaves of its manifest here and rebuilds the chunks it finds locally, so
+// content pushed to this device before doesn't cross the network again.
+//
+// Each chunk is a file named by its leaf hash under a directory named by the
+// hash's first two digits. Its mtime is when it was last used; the least
+// recently used chunks are evicted to keep the store within its size limit.
+// Chunks are copied with utils::copy_file_data, so on filesystems with reflinks
+// they share blocks with the received files instead of taking space again.
+class ChunkStore {
+public:
+    // Tails of small files aren't worth a file each
+    static constexpr uint64_t MIN_CHUNK_SIZE = 64 * 1024;
+
+    ChunkStore();
+
+    ChunkStore(const ChunkStore&) = delete;
+    ChunkStore& operator=(const ChunkStore&) = delete;
+
+    // Opens (or creates) the store in `directory`, evicting down to max_size;
+    // a max_size of 0 turns the store off and deletes what it held
+    bool open(const std::string& directory, uint64_t max_size);
+    bool is_open() const;
+
+    bool contains(const std::string& leaf_hash, uint64_t length);
+    // Writes the chunk to [offset, offset + length) of fd; false if it isn't stored or can't be read
+    bool copy_to(const std::string& leaf_hash, int fd, uint64_t offset, uint64_t length);
+    // Adds the leaves of a file that was just verified against file.chunk_hashes
+    void store_file(const std::string& path, const FileMetadata& file);
+    // Drops a chunk that turned out not to match its hash
+    void remove(const std::string& leaf_hash);
+
+private:
+    struct Entry {
+        uint64_t size;
+        int64_t last_used; // ns since the epoch, as the file's mtime
+    };
+
+    std::string chunk_path(const std::string& leaf_hash) const;
+    // Removes the least recently used chunks until at most `target` bytes remain; the caller holds mutex_
+    void evict(uint64_t target);
+
+    mutable std::mutex mutex_;
+    std::string directory_;
+    uint64_t max_size_;
+    uint64_t total_size_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::atomic<uint64_t> next_temp_id_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,323 @@
+#include "compression.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <ctime>
+#ifdef WARPDECK_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef WARPDECK_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace warpdeck {
+
+namespace {
+
+// Block methods on the wire
+constexpr uint8_t METHOD_STORED = 0;
+constexpr uint8_t METHOD_LZ4 = 1;
+constexpr uint8_t METHOD_ZSTD = 2;
+
+constexpr size_t ENTROPY_SAMPLE_STRIPES = 64;
+constexpr size_t ENTROPY_SAMPLE_STRIPE_SIZE = 64;
+
+uint64_t thread_cpu_nanoseconds() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+}
+
+void write_block_header(char* header, uint8_t method, uint32_t raw_length, uint32_t stored_length) {
+    header[0] = static_cast<char>(method);
+    for (int i = 0; i < 4; ++i) {
+        header[1 + i] = static_cast<char>(raw_length >> (24 - 8 * i));
+        header[5 + i] = static_cast<char>(stored_length >> (24 - 8 * i));
+    }
+}
+
+#ifdef WARPDECK_HAVE_ZSTD
+// Contexts are reused per thread; upload streams and server threads each get their own
+ZSTD_CCtx* zstd_compression_context() {
+    thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return context.get();
+}
+
+ZSTD_DCtx* zstd_decompression_context() {
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    return context.get();
+}
+#endif
+
+// Compresses into `out` (sized to the worst case); returns the compressed size, 0 on failure
+size_t compress_block(CompressionCodec codec, int zstd_level, const char* data, size_t length, std::string& out) {
+    switch (codec) {
+#ifdef WARPDECK_HAVE_LZ4
+    case CompressionCodec::LZ4: {
+        out.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(length))));
+        int size = LZ4_compress_default(data, &out[0], static_cast<int>(length), static_cast<int>(out.size()));
+        return size > 0 ? static_cast<size_t>(size) : 0;
+    }
+#endif
+#ifdef WARPDECK_HAVE_ZSTD
+    case CompressionCodec::ZSTD: {
+        out.resize(ZSTD_compressBound(length));
+        size_t size = ZSTD_compressCCtx(zstd_compression_context(), &out[0], out.size(), data, length, zstd_level);
+        return ZSTD_isError(size) ? 0 : size;
+    }
+#endif
+    default:
+        (void)zstd_level;
+        (void)data;
+        (void)length;
+        (void)out;
+        return 0;
+    }
+}
+
+bool decompress_block(uint8_t method, const std::string& stored, std::string& decoded) {
+    switch (method) {
+#ifdef WARPDECK_HAVE_LZ4
+    case METHOD_LZ4: {
+        int size = LZ4_decompress_safe(stored.data(), &decoded[0], static_cast<int>(stored.size()),
+                                       static_cast<int>(decoded.size()));
+        return size >= 0 && static_cast<size_t>(size) == decoded.size();
+    }
+#endif
+#ifdef WARPDECK_HAVE_ZSTD
+    case METHOD_ZSTD: {
+        size_t size = ZSTD_decompressDCtx(zstd_decompression_context(), &decoded[0], decoded.size(),
+                                          stored.data(), stored.size());
+        return !ZSTD_isError(size) && size == decoded.size();
+    }
+#endif
+    default:
+        (void)stored;
+        (void)decoded;
+        return false;
+    }
+}
+
+} // namespace
+
+std::string compression_codec_name(CompressionCodec codec) {
+    switch (codec) {
+    case CompressionCodec::LZ4:
+        return "lz4";
+    case CompressionCodec::ZSTD:
+        return "zstd";
+    default:
+        return "";
+    }
+}
+
+CompressionCodec parse_compression_codec(const std::string& name) {
+#ifdef WARPDECK_HAVE_ZSTD
+    if (name == "zstd") {
+        return CompressionCodec::ZSTD;
+    }
+#endif
+#ifdef WARPDECK_HAVE_LZ4
+    if (name == "lz4") {
+        return CompressionCodec::LZ4;
+    }
+#endif
+    (void)name;
+    return CompressionCodec::NONE;
+}
+
+std::vector<std::string> supported_compression_codecs() {
+    // zstd at a low level beats LZ4's ratio at speeds Wi-Fi can't keep up with anyway
+    std::vector<std::string> codecs;
+#ifdef WARPDECK_HAVE_ZSTD
+    codecs.push_back("zstd");
+#endif
+#ifdef WARPDECK_HAVE_LZ4
+    codecs.push_back("lz4");
+#endif
+    return codecs;
+}
+
+CompressionCodec choose_compression_codec(const std::vector<std::string>& offered) {
+    for (const auto& name : offered) {
+        CompressionCodec codec = parse_compression_codec(name);
+        if (codec != CompressionCodec::NONE) {
+            return codec;
+        }
+    }
+    return CompressionCodec::NONE;
+}
+
+bool is_precompressed_file(const std::string& name) {
+    static const char* extensions[] = {
+        ".7z", ".apk", ".avi", ".avif", ".br", ".bz2", ".cab", ".flac", ".gif", ".gz", ".heic", ".jar",
+        ".jpeg", ".jpg", ".lz4", ".lzma", ".m4a", ".m4v", ".mkv", ".mov", ".mp3", ".mp4", ".ogg", ".opus",
+        ".png", ".rar", ".tgz", ".txz", ".webm", ".webp", ".xz", ".zip", ".zst"
+    };
+
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string extension = name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    for (const char* known : extensions) {
+        if (extension == known) {
+            return true;
+        }
+    }
+    return false;
+}
+
+double sample_entropy(const char* data, size_t length) {
+    if (length == 0) {
+        return 0.0;
+    }
+
+    uint32_t counts[256] = {};
+    size_t sampled = 0;
+    if (length <= ENTROPY_SAMPLE_STRIPES * ENTROPY_SAMPLE_STRIPE_SIZE) {
+        for (size_t i = 0; i < length; ++i) {
+            counts[static_cast<uint8_t>(data[i])]++;
+        }
+        sampled = length;
+    } else {
+        size_t step = length / ENTROPY_SAMPLE_STRIPES;
+        for (size_t stripe = 0; stripe < ENTROPY_SAMPLE_STRIPES; ++stripe) {
+            const char* start = data + stripe * step;
+            for (size_t i = 0; i < ENTROPY_SAMPLE_STRIPE_SIZE; ++i) {
+                counts[static_cast<uint8_t>(start[i])]++;
+            }
+        }
+        sampled = ENTROPY_SAMPLE_STRIPES * ENTROPY_SAMPLE_STRIPE_SIZE;
+    }
+
+    double entropy = 0.0;
+    for (uint32_t count : counts) {
+        if (count > 0) {
+            double p = static_cast<double>(count) / static_cast<double>(sampled);
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+TransferCompressor::TransferCompressor(CompressionCodec codec)
+    : codec_(codec), raw_bytes_(0), wire_bytes_(0), compressed_blocks_(0), stored_blocks_(0),
+      cpu_nanoseconds_(0) {}
+
+CompressionCodec TransferCompressor::codec() const {
+    return codec_;
+}
+
+void TransferCompressor::encode(const char* data, size_t length, std::string& out) {
+    uint64_t cpu_start = thread_cpu_nanoseconds();
+
+    thread_local std::string compressed;
+    size_t compressed_size = 0;
+    if (codec_ != CompressionCodec::NONE && sample_entropy(data, length) <= MAX_COMPRESSIBLE_ENTROPY) {
+        compressed_size = compress_block(codec_, ZSTD_LEVEL, data, length, compressed);
+    }
+
+    char header[COMPRESSION_BLOCK_HEADER_SIZE];
+    if (compressed_size > 0 && compressed_size <= static_cast<size_t>(length * MAX_COMPRESSED_RATIO)) {
+        write_block_header(header, codec_ == CompressionCodec::LZ4 ? METHOD_LZ4 : METHOD_ZSTD,
+                           static_cast<uint32_t>(length), static_cast<uint32_t>(compressed_size));
+        out.append(header, sizeof(header));
+        out.append(compressed.data(), compressed_size);
+        compressed_blocks_++;
+    } else {
+        write_block_header(header, METHOD_STORED, static_cast<uint32_t>(length), static_cast<uint32_t>(length));
+        out.append(header, sizeof(header));
+        out.append(data, length);
+        compressed_size = length;
+        stored_blocks_++;
+    }
+
+    raw_bytes_ += length;
+    wire_bytes_ += sizeof(header) + compressed_size;
+    cpu_nanoseconds_ += thread_cpu_nanoseconds() - cpu_start;
+}
+
+CompressionStats TransferCompressor::stats() const {
+    CompressionStats stats;
+    stats.raw_bytes = raw_bytes_;
+    stats.wire_bytes = wire_bytes_;
+    stats.compressed_blocks = compressed_blocks_;
+    stats.stored_blocks = stored_blocks_;
+    stats.cpu_seconds = static_cast<double>(cpu_nanoseconds_.load()) / 1e9;
+    return stats;
+}
+
+BlockDecoder::BlockDecoder()
+    : header_fill_(0), in_block_(false), method_(METHOD_STORED), raw_length_(0), stored_length_(0),
+      stored_fill_(0) {}
+
+bool BlockDecoder::feed(const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink) {
+    while (length > 0) {
+        if (!in_block_) {
+            size_t take = std::min(length, COMPRESSION_BLOCK_HEADER_SIZE - header_fill_);
+            std::memcpy(header_ + header_fill_, data, take);
+            header_fill_ += take;
+            data += take;
+            length -= take;
+            if (header_fill_ < COMPRESSION_BLOCK_HEADER_SIZE) {
+                return true;
+            }
+            header_fill_ = 0;
+
+            method_ = static_cast<uint8_t>(header_[0]);
+            raw_length_ = 0;
+            stored_length_ = 0;
+            for (int i = 0; i < 4; ++i) {
+                raw_length_ = (raw_length_ << 8) | static_cast<uint8_t>(header_[1 + i]);
+                stored_length_ = (stored_length_ << 8) | static_cast<uint8_t>(header_[5 + i]);
+            }
+            if (raw_length_ > MAX_COMPRESSION_BLOCK_SIZE ||
+                stored_length_ > MAX_COMPRESSION_BLOCK_SIZE + MAX_COMPRESSION_BLOCK_SIZE / 8 ||
+                (method_ == METHOD_STORED && stored_length_ != raw_length_) ||
+                (stored_length_ == 0 && raw_length_ != 0)) {
+                return false;
+            }
+            in_block_ = stored_length_ > 0;
+            stored_fill_ = 0;
+            stored_.clear();
+            continue;
+        }
+
+        size_t take = std::min<size_t>(length, stored_length_ - stored_fill_);
+        if (method_ == METHOD_STORED) {
+            // Stored blocks pass straight through
+            if (!sink(data, take)) {
+                return false;
+            }
+        } else {
+            stored_.append(data, take);
+        }
+        data += take;
+        length -= take;
+        stored_fill_ += static_cast<uint32_t>(take);
+
+        if (stored_fill_ == stored_length_) {
+            in_block_ = false;
+            if (method_ != METHOD_STORED) {
+                decoded_.resize(raw_length_);
+                if (!decompress_block(method_, stored_, decoded_) || !sink(decoded_.data(), decoded_.size())) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool BlockDecoder::at_block_boundary() const {
+    return !in_block_ && header_fill_ == 0;
+}
+
+} // namespace warpdeck
\ No newline at end of file
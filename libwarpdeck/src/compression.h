@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace warpdeck {
+
+// A block-encoded request body is a sequence of blocks, each
+// [u8 method][u32 raw_length][u32 stored_length] (big-endian) followed by
+// stored_length bytes. Every block is compressed on its own, or stored as is
+// when compressing it doesn't pay, so the receiver decodes as it streams.
+constexpr size_t COMPRESSION_BLOCK_HEADER_SIZE = 9;
+constexpr size_t MAX_COMPRESSION_BLOCK_SIZE = 1024 * 1024;
+// Value of the "encoding" query parameter on uploads with a block-encoded body
+constexpr const char* BLOCK_ENCODING = "blocks";
+
+enum class CompressionCodec { NONE, LZ4, ZSTD };
+
+std::string compression_codec_name(CompressionCodec codec);
+CompressionCodec parse_compression_codec(const std::string& name);
+// Codecs this build was compiled with, most preferred first
+std::vector<std::string> supported_compression_codecs();
+// The first offered codec this build supports, or NONE
+CompressionCodec choose_compression_codec(const std::vector<std::string>& offered);
+
+// Archives, media and other formats that won't compress any further
+bool is_precompressed_file(const std::string& name);
+
+// Shannon entropy in bits per byte, estimated from a sample spread over the data
+double sample_entropy(const char* data, size_t length);
+
+struct CompressionStats {
+    uint64_t raw_bytes = 0;   // bytes handed to the encoder
+    uint64_t wire_bytes = 0;  // what they took on the wire, block headers included
+    uint64_t compressed_blocks = 0;
+    uint64_t stored_blocks = 0;
+    double cpu_seconds = 0.0; // thread CPU time spent sampling and compressing
+};
+
+// Encodes blocks for every upload stream of one transfer; safe to share
+class TransferCompressor {
+public:
+    // Blocks whose sample is more random than this are stored without trying
+    static constexpr double MAX_COMPRESSIBLE_ENTROPY = 7.5;
+    // A compressed block is only used if it is at most this fraction of the original
+    static constexpr double MAX_COMPRESSED_RATIO = 0.9;
+    static constexpr int ZSTD_LEVEL = 1;
+
+    explicit TransferCompressor(CompressionCodec codec);
+
+    CompressionCodec codec() const;
+    // Appends one block holding `length` bytes (at most MAX_COMPRESSION_BLOCK_SIZE) to out
+    void encode(const char* data, size_t length, std::string& out);
+    CompressionStats stats() const;
+
+private:
+    CompressionCodec codec_;
+    std::atomic<uint64_t> raw_bytes_;
+    std::atomic<uint64_t> wire_bytes_;
+    std::atomic<uint64_t> compressed_blocks_;
+    std::atomic<uint64_t> stored_blocks_;
+    std::atomic<uint64_t> cpu_nanoseconds_;
+};
+
+// Turns a block-encoded body back into the original bytes as it arrives
+class BlockDecoder {
+public:
+    BlockDecoder();
+
+    // Hands decoded bytes to sink; false on a malformed block or if sink stops
+    bool feed(const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink);
+    // False if the body ended inside a block
+    bool at_block_boundary() const;
+
+private:
+    char header_[COMPRESSION_BLOCK_HEADER_SIZE];
+    size_t header_fill_;
+    bool in_block_;
+    uint8_t method_;
+    uint32_t raw_length_;
+    uint32_t stored_length_;
+    uint32_t stored_fill_;
+    std::string stored_;
+    std::string decoded_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,406 @@
+#include "delta.h"
+#include "tree_hash.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+
+namespace warpdeck {
+
+namespace {
+
+// Ops on the wire
+constexpr uint8_t DELTA_OP_LITERAL = 0;
+constexpr uint8_t DELTA_OP_COPY = 1;
+
+constexpr uint32_t MIN_DELTA_BLOCK_SIZE = 16 * 1024;
+constexpr uint32_t MAX_DELTA_BLOCK_SIZE = 1024 * 1024;
+constexpr size_t SIGNATURE_HEADER_SIZE = 8;
+constexpr size_t SIGNATURE_ENTRY_SIZE = 4 + DELTA_STRONG_HASH_SIZE;
+constexpr size_t WEAK_FILTER_BITS = 65536;
+// Consumed input is trimmed from the front of the encoder's buffer in steps this large
+constexpr size_t BUFFER_TRIM_SIZE = 4 * IO_BUFFER_SIZE;
+
+void put_u32(char* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<char>(value >> (24 - 8 * i));
+    }
+}
+
+uint32_t get_u32(const char* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value = (value << 8) | static_cast<uint8_t>(in[i]);
+    }
+    return value;
+}
+
+void append_op(std::string& out, uint8_t op, uint32_t a, uint32_t b) {
+    char header[DELTA_OP_HEADER_SIZE];
+    header[0] = static_cast<char>(op);
+    put_u32(header + 1, a);
+    put_u32(header + 5, b);
+    out.append(header, sizeof(header));
+}
+
+size_t weak_filter_index(uint32_t weak) {
+    return (weak ^ (weak >> 16)) & (WEAK_FILTER_BITS - 1);
+}
+
+// First DELTA_STRONG_HASH_SIZE bytes of the block's SHA-256
+std::string strong_hash(const char* data, size_t length) {
+    thread_local Sha256 hasher;
+    hasher.update(data, length);
+    unsigned char digest[HASH_DIGEST_SIZE];
+    digest_from_hex(hasher.finish(), digest);
+    return std::string(reinterpret_cast<const char*>(digest), DELTA_STRONG_HASH_SIZE);
+}
+
+} // namespace
+
+uint32_t delta_block_size(uint64_t basis_size) {
+    uint64_t block_size = MIN_DELTA_BLOCK_SIZE;
+    while (block_size < MAX_DELTA_BLOCK_SIZE && block_size * block_size < basis_size) {
+        block_size *= 2;
+    }
+    return static_cast<uint32_t>(block_size);
+}
+
+bool compute_delta_signature(const std::string& path, uint64_t size, bool bulk_io, DeltaSignature& signature) {
+    signature.block_size = delta_block_size(size);
+    signature.weak.clear();
+    signature.strong.clear();
+
+    uint64_t block_count = size / signature.block_size;
+    if (block_count == 0) {
+        return true;
+    }
+
+    FileReader reader;
+    if (!reader.open(path, 0, block_count * signature.block_size, bulk_io)) {
+        return false;
+    }
+    signature.weak.reserve(block_count);
+    signature.strong.reserve(block_count * DELTA_STRONG_HASH_SIZE);
+
+    std::string block;
+    block.reserve(signature.block_size);
+    RollingChecksum checksum;
+    while (signature.weak.size() < block_count) {
+        const char* data = nullptr;
+        size_t length = 0;
+        if (!reader.next(data, length) || length == 0) {
+            return false;
+        }
+        while (length > 0) {
+            size_t take = std::min<size_t>(length, signature.block_size - block.size());
+            block.append(data, take);
+            data += take;
+            length -= take;
+            if (block.size() == signature.block_size) {
+                checksum.reset(signature.block_size);
+                checksum.update(block.data(), block.size());
+                signature.weak.push_back(checksum.value());
+                signature.strong += strong_hash(block.data(), block.size());
+                block.clear();
+            }
+        }
+    }
+    return true;
+}
+
+std::string delta_signature_to_bytes(const DeltaSignature& signature) {
+    std::string data(SIGNATURE_HEADER_SIZE + signature.weak.size() * SIGNATURE_ENTRY_SIZE, '\0');
+    put_u32(&data[0], signature.block_size);
+    put_u32(&data[4], static_cast<uint32_t>(signature.weak.size()));
+    char* entry = &data[SIGNATURE_HEADER_SIZE];
+    for (size_t i = 0; i < signature.weak.size(); ++i) {
+        put_u32(entry, signature.weak[i]);
+        std::memcpy(entry + 4, signature.strong.data() + i * DELTA_STRONG_HASH_SIZE, DELTA_STRONG_HASH_SIZE);
+        entry += SIGNATURE_ENTRY_SIZE;
+    }
+    return data;
+}
+
+bool parse_delta_signature(const std::string& data, DeltaSignature& signature) {
+    if (data.size() < SIGNATURE_HEADER_SIZE) {
+        return false;
+    }
+    uint32_t block_size = get_u32(data.data());
+    uint64_t count = get_u32(data.data() + 4);
+    if (block_size < MIN_DELTA_BLOCK_SIZE || block_size > MAX_DELTA_BLOCK_SIZE ||
+        data.size() != SIGNATURE_HEADER_SIZE + count * SIGNATURE_ENTRY_SIZE) {
+        return false;
+    }
+
+    signature.block_size = block_size;
+    signature.weak.resize(count);
+    signature.strong.resize(count * DELTA_STRONG_HASH_SIZE);
+    const char* entry = data.data() + SIGNATURE_HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        signature.weak[i] = get_u32(entry);
+        std::memcpy(&signature.strong[i * DELTA_STRONG_HASH_SIZE], entry + 4, DELTA_STRONG_HASH_SIZE);
+        entry += SIGNATURE_ENTRY_SIZE;
+    }
+    return true;
+}
+
+RollingChecksum::RollingChecksum() : window_(0), a_(0), b_(0) {}
+
+void RollingChecksum::reset(uint32_t window) {
+    window_ = window;
+    a_ = 0;
+    b_ = 0;
+}
+
+void RollingChecksum::update(const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        a_ += static_cast<uint8_t>(data[i]);
+        b_ += a_;
+    }
+}
+
+void RollingChecksum::roll(uint8_t out, uint8_t in) {
+    a_ += in - out;
+    b_ += a_ - window_ * out;
+}
+
+uint32_t RollingChecksum::value() const {
+    return (a_ & 0xffff) | (b_ << 16);
+}
+
+DeltaEncoder::DeltaEncoder(const DeltaSignature& signature)
+    : signature_(signature), weak_filter_(WEAK_FILTER_BITS, false), size_(0), read_(0), buffer_start_(0),
+      position_(0), literal_start_(0), window_valid_(false), finished_(false), copy_first_(0), copy_count_(0),
+      literal_bytes_(0) {
+    blocks_.reserve(signature_.weak.size());
+    for (size_t i = 0; i < signature_.weak.size(); ++i) {
+        blocks_.emplace_back(signature_.weak[i], static_cast<uint32_t>(i));
+        weak_filter_[weak_filter_index(signature_.weak[i])] = true;
+    }
+    std::sort(blocks_.begin(), blocks_.end());
+}
+
+bool DeltaEncoder::open(const std::string& path, uint64_t size, bool bulk_io) {
+    size_ = size;
+    read_ = 0;
+    buffer_.clear();
+    buffer_start_ = 0;
+    position_ = 0;
+    literal_start_ = 0;
+    window_valid_ = false;
+    finished_ = false;
+    copy_count_ = 0;
+    literal_bytes_ = 0;
+    return reader_.open(path, 0, size, bulk_io);
+}
+
+bool DeltaEncoder::next(const char*& data, size_t& size) {
+    out_.clear();
+    uint64_t block_size = signature_.block_size;
+    uint64_t piece_start = literal_start_;
+
+    while (!finished_ && out_.size() < OUTPUT_PIECE_SIZE &&
+           literal_start_ - piece_start < SOURCE_PIECE_SIZE) {
+        if (literal_start_ == size_) {
+            emit_copy();
+            finished_ = true;
+        } else if (blocks_.empty() || position_ + block_size > size_) {
+            // No whole window is left to match; the rest goes out as literals
+            uint64_t end = std::min(size_, literal_start_ + MAX_DELTA_LITERAL);
+            if (!fill(end)) {
+                return false;
+            }
+            emit_copy();
+            emit_literal(end);
+            position_ = std::max(position_, end);
+        } else {
+            if (!fill(position_ + block_size)) {
+                return false;
+            }
+            if (!window_valid_) {
+                checksum_.reset(signature_.block_size);
+                checksum_.update(&buffer_[position_ - buffer_start_], block_size);
+                window_valid_ = true;
+            }
+
+            int64_t block = find_block(checksum_.value(), position_);
+            if (block >= 0) {
+                if (literal_start_ < position_) {
+                    emit_copy();
+                    emit_literal(position_);
+                }
+                if (copy_count_ == 0 || copy_first_ + copy_count_ != static_cast<uint32_t>(block)) {
+                    emit_copy();
+                    copy_first_ = static_cast<uint32_t>(block);
+                }
+                ++copy_count_;
+                position_ += block_size;
+                literal_start_ = position_;
+                window_valid_ = false;
+            } else {
+                if (position_ - literal_start_ >= MAX_DELTA_LITERAL) {
+                    emit_copy();
+                    emit_literal(position_);
+                }
+                if (position_ + block_size < size_) {
+                    if (!fill(position_ + block_size + 1)) {
+                        return false;
+                    }
+                    checksum_.roll(byte_at(position_), byte_at(position_ + block_size));
+                } else {
+                    window_valid_ = false;
+                }
+                ++position_;
+            }
+        }
+        compact();
+    }
+
+    // Everything counted by encoded_bytes() has its op in this piece
+    emit_copy();
+    data = out_.data();
+    size = out_.size();
+    return true;
+}
+
+uint64_t DeltaEncoder::encoded_bytes() const {
+    return literal_start_;
+}
+
+uint64_t DeltaEncoder::literal_bytes() const {
+    return literal_bytes_;
+}
+
+bool DeltaEncoder::fill(uint64_t end) {
+    end = std::min(end, size_);
+    while (read_ < end) {
+        const char* data = nullptr;
+        size_t length = 0;
+        if (!reader_.next(data, length) || length == 0) {
+            return false;
+        }
+        buffer_.append(data, length);
+        read_ += length;
+    }
+    return true;
+}
+
+uint8_t DeltaEncoder::byte_at(uint64_t offset) const {
+    return static_cast<uint8_t>(buffer_[offset - buffer_start_]);
+}
+
+int64_t DeltaEncoder::find_block(uint32_t weak, uint64_t offset) const {
+    if (!weak_filter_[weak_filter_index(weak)]) {
+        return -1;
+    }
+    auto range = std::equal_range(blocks_.begin(), blocks_.end(), std::make_pair(weak, uint32_t(0)),
+                                  [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+                                      return a.first < b.first;
+                                  });
+    if (range.first == range.second) {
+        return -1;
+    }
+
+    // Among equal blocks, the one continuing the pending COPY keeps it a single op
+    std::string strong = strong_hash(&buffer_[offset - buffer_start_], signature_.block_size);
+    int64_t found = -1;
+    for (auto it = range.first; it != range.second; ++it) {
+        if (signature_.strong.compare(static_cast<size_t>(it->second) * DELTA_STRONG_HASH_SIZE,
+                                      DELTA_STRONG_HASH_SIZE, strong) == 0) {
+            if (copy_count_ > 0 && it->second == copy_first_ + copy_count_) {
+                return it->second;
+            }
+            if (found < 0) {
+                found = it->second;
+            }
+        }
+    }
+    return found;
+}
+
+void DeltaEncoder::emit_literal(uint64_t end) {
+    while (literal_start_ < end) {
+        uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(end - literal_start_, MAX_DELTA_LITERAL));
+        append_op(out_, DELTA_OP_LITERAL, length, 0);
+        out_.append(buffer_, literal_start_ - buffer_start_, length);
+        literal_start_ += length;
+        literal_bytes_ += length;
+    }
+}
+
+void DeltaEncoder::emit_copy() {
+    if (copy_count_ > 0) {
+        append_op(out_, DELTA_OP_COPY, copy_first_, copy_count_);
+        copy_count_ = 0;
+    }
+}
+
+void DeltaEncoder::compact() {
+    uint64_t consumed = literal_start_ - buffer_start_;
+    if (consumed >= BUFFER_TRIM_SIZE) {
+        buffer_.erase(0, consumed);
+        buffer_start_ = literal_start_;
+    }
+}
+
+DeltaDecoder::DeltaDecoder(int basis_fd, uint64_t basis_size, uint32_t block_size)
+    : basis_fd_(basis_fd), basis_size_(basis_size), block_size_(block_size), header_fill_(0), literal_left_(0) {}
+
+bool DeltaDecoder::feed(const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink) {
+    while (length > 0) {
+        if (literal_left_ > 0) {
+            size_t take = std::min<size_t>(length, literal_left_);
+            if (!sink(data, take)) {
+                return false;
+            }
+            data += take;
+            length -= take;
+            literal_left_ -= static_cast<uint32_t>(take);
+            continue;
+        }
+
+        size_t take = std::min(length, DELTA_OP_HEADER_SIZE - header_fill_);
+        std::memcpy(header_ + header_fill_, data, take);
+        header_fill_ += take;
+        data += take;
+        length -= take;
+        if (header_fill_ < DELTA_OP_HEADER_SIZE) {
+            return true;
+        }
+        header_fill_ = 0;
+
+        uint8_t op = static_cast<uint8_t>(header_[0]);
+        uint32_t a = get_u32(header_ + 1);
+        uint32_t b = get_u32(header_ + 5);
+        if (op == DELTA_OP_LITERAL) {
+            if (a == 0 || a > MAX_DELTA_LITERAL || b != 0) {
+                return false;
+            }
+            literal_left_ = a;
+        } else if (op == DELTA_OP_COPY) {
+            uint64_t offset = static_cast<uint64_t>(a) * block_size_;
+            uint64_t copy_length = static_cast<uint64_t>(b) * block_size_;
+            if (b == 0 || offset + copy_length > basis_size_) {
+                return false;
+            }
+            buffer_.resize(std::max<size_t>(block_size_, IO_BUFFER_SIZE));
+            while (copy_length > 0) {
+                size_t piece = static_cast<size_t>(std::min<uint64_t>(copy_length, buffer_.size()));
+                if (!utils::pread_all(basis_fd_, buffer_.data(), piece, offset) || !sink(buffer_.data(), piece)) {
+                    return false;
+                }
+                offset += piece;
+                copy_length -= piece;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaDecoder::at_op_boundary() const {
+    return header_fill_ == 0 && literal_left_ == 0;
+}
+
+} // namespace warpdeck
\ No newline at end of file
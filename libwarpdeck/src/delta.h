@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include "file_io.h"
+
+namespace warpdeck {
+
+// Rsync-style delta against an older copy of a file that the receiver holds
+// (the basis). The receiver cuts the basis into blocks of delta_block_size()
+// and signs each with a rolling checksum and a truncated SHA-256. The sender
+// slides a block-sized window over its file one byte at a time, looks the
+// rolling checksum up among the signatures and confirms hits with the strong
+// hash. What it streams is a sequence of ops, each [u8 op][u32 a][u32 b]
+// (big-endian): LITERAL is followed by `a` bytes of new data, COPY repeats
+// `b` basis blocks starting at block `a`. A short last block of the basis is
+// never signed, so every COPY is whole blocks.
+constexpr size_t DELTA_OP_HEADER_SIZE = 9;
+constexpr size_t DELTA_STRONG_HASH_SIZE = 16;
+constexpr uint32_t MAX_DELTA_LITERAL = 1024 * 1024;
+
+// Blocks grow with the square root of the basis size, as in rsync, so the
+// signature stays small for big files: 16 KiB up to 1 MiB, in powers of two
+uint32_t delta_block_size(uint64_t basis_size);
+
+struct DeltaSignature {
+    uint32_t block_size = 0;
+    std::vector<uint32_t> weak;  // rolling checksum per block
+    std::string strong;          // DELTA_STRONG_HASH_SIZE bytes per block
+};
+
+// Signs every whole block of the basis; false if it could not be read in full
+bool compute_delta_signature(const std::string& path, uint64_t size, bool bulk_io, DeltaSignature& signature);
+// [u32 block_size][u32 count] then count * ([u32 weak][strong hash])
+std::string delta_signature_to_bytes(const DeltaSignature& signature);
+bool parse_delta_signature(const std::string& data, DeltaSignature& signature);
+
+// The rsync checksum: a = sum of the bytes, b = sum of the running a's, each
+// mod 2^16. Sliding the window by a byte updates both in constant time.
+class RollingChecksum {
+public:
+    RollingChecksum();
+
+    void reset(uint32_t window);
+    void update(const char* data, size_t length);
+    // Drops `out` from the front of a full window and appends `in`
+    void roll(uint8_t out, uint8_t in);
+    uint32_t value() const;
+
+private:
+    uint32_t window_;
+    uint32_t a_;
+    uint32_t b_;
+};
+
+// Produces the delta of a source file against a signature, a piece at a time
+class DeltaEncoder {
+public:
+    // Pieces are cut once they hold this much, or after this much of the source
+    static constexpr size_t OUTPUT_PIECE_SIZE = 256 * 1024;
+    static constexpr uint64_t SOURCE_PIECE_SIZE = 8 * 1024 * 1024;
+
+    explicit DeltaEncoder(const DeltaSignature& signature);
+
+    bool open(const std::string& path, uint64_t size, bool bulk_io);
+    // The next piece of the delta; size 0 once it is complete. The data stays
+    // valid until the next call. False if the source could not be read.
+    bool next(const char*& data, size_t& size);
+
+    uint64_t encoded_bytes() const;  // source bytes covered so far
+    uint64_t literal_bytes() const;  // of those, how many went out as literals
+
+private:
+    bool fill(uint64_t end);
+    uint8_t byte_at(uint64_t offset) const;
+    int64_t find_block(uint32_t weak, uint64_t offset) const;
+    void emit_literal(uint64_t end);
+    void emit_copy();
+    void compact();
+
+    const DeltaSignature& signature_;
+    std::vector<std::pair<uint32_t, uint32_t>> blocks_; // (weak, block index), sorted
+    std::vector<bool> weak_filter_;
+
+    FileReader reader_;
+    uint64_t size_;
+    uint64_t read_;          // source bytes read into buffer_ so far
+    std::string buffer_;
+    uint64_t buffer_start_;  // source offset of buffer_[0]
+
+    uint64_t position_;      // start of the window
+    uint64_t literal_start_; // first source byte not yet covered by an op
+    bool window_valid_;
+    bool finished_;
+    RollingChecksum checksum_;
+    uint32_t copy_first_;    // pending COPY, merged while the matches run on
+    uint32_t copy_count_;
+    uint64_t literal_bytes_;
+    std::string out_;
+};
+
+// Rebuilds the new file from a delta as it streams in, reading COPY blocks
+// from the basis descriptor
+class DeltaDecoder {
+public:
+    DeltaDecoder(int basis_fd, uint64_t basis_size, uint32_t block_size);
+
+    // Hands rebuilt bytes to sink; false on a malformed op, a basis read error or if sink stops
+    bool feed(const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink);
+    // False if the body ended inside an op
+    bool at_op_boundary() const;
+
+private:
+    int basis_fd_;
+    uint64_t basis_size_;
+    uint32_t block_size_;
+    char header_[DELTA_OP_HEADER_SIZE];
+    size_t header_fill_;
+    uint32_t literal_left_;
+    std::vector<char> buffer_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
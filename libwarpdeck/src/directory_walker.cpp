@@ -0,0 +1,173 @@
+#include "directory_walker.h"
+#include "logger.h"
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef WARPDECK_PLATFORM_LINUX
+#include <sys/sysmacros.h>
+#endif
+
+namespace warpdeck {
+
+namespace {
+
+enum class EntryType { FILE, DIRECTORY, OTHER };
+
+// Stats `name` relative to `directory_fd`; the identity is only filled for regular files
+bool stat_entry(int directory_fd, const char* name, bool follow_symlinks, EntryType& type, FileIdentity& identity) {
+    int flags = follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+#if defined(WARPDECK_PLATFORM_LINUX) && defined(STATX_BASIC_STATS)
+    struct statx stx;
+    if (::statx(directory_fd, name, flags | AT_STATX_SYNC_AS_STAT,
+                STATX_TYPE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) != 0) {
+        return false;
+    }
+    type = S_ISREG(stx.stx_mode) ? EntryType::FILE : S_ISDIR(stx.stx_mode) ? EntryType::DIRECTORY : EntryType::OTHER;
+    // Same device number stat() reports, so identities match HashCache::identify
+    identity.device = static_cast<uint64_t>(makedev(stx.stx_dev_major, stx.stx_dev_minor));
+    identity.inode = stx.stx_ino;
+    identity.size = stx.stx_size;
+    identity.mtime_ns = static_cast<int64_t>(stx.stx_mtime.tv_sec) * 1000000000 + stx.stx_mtime.tv_nsec;
+#else
+    struct stat st;
+    if (::fstatat(directory_fd, name, &st, flags) != 0) {
+        return false;
+    }
+    type = S_ISREG(st.st_mode) ? EntryType::FILE : S_ISDIR(st.st_mode) ? EntryType::DIRECTORY : EntryType::OTHER;
+    identity.device = static_cast<uint64_t>(st.st_dev);
+    identity.inode = static_cast<uint64_t>(st.st_ino);
+    identity.size = static_cast<uint64_t>(st.st_size);
+#ifdef WARPDECK_PLATFORM_MACOS
+    identity.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    identity.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
+
+// Last component of a root, ignoring trailing slashes; empty for "/"
+std::string root_name(const std::string& root) {
+    size_t end = root.find_last_not_of('/');
+    if (end == std::string::npos) {
+        return "";
+    }
+    size_t start = root.find_last_of('/', end);
+    start = start == std::string::npos ? 0 : start + 1;
+    return root.substr(start, end + 1 - start);
+}
+
+} // namespace
+
+DirectoryWalker::DirectoryWalker(size_t thread_count) : pool_(std::make_unique<WorkerPool>(thread_count)) {}
+
+bool DirectoryWalker::walk(const std::vector<std::string>& roots, size_t max_entries, std::vector<WalkEntry>& entries) {
+    entries.clear();
+
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    size_t pending = 0;
+    bool overflow = false;
+
+    std::function<void(const std::string&, const std::string&)> read_directory;
+    read_directory = [&](const std::string& path, const std::string& relative) {
+        std::vector<WalkEntry> files;
+        std::vector<std::pair<std::string, std::string>> directories;
+
+        DIR* directory = ::opendir(path.c_str());
+        if (!directory) {
+            LOG_TRANSFER_WARN() << "Skipping unreadable directory " << path << ": " << std::strerror(errno);
+        } else {
+            int directory_fd = ::dirfd(directory);
+            while (struct dirent* entry = ::readdir(directory)) {
+                const char* name = entry->d_name;
+                if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                    continue;
+                }
+#ifdef DT_UNKNOWN
+                // Links, devices and sockets need no stat to be skipped
+                if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_REG && entry->d_type != DT_DIR) {
+                    continue;
+                }
+#endif
+
+                EntryType type;
+                FileIdentity identity;
+                if (!stat_entry(directory_fd, name, false, type, identity)) {
+                    continue;
+                }
+                std::string child_path = path + "/" + name;
+                std::string child_relative = relative.empty() ? std::string(name) : relative + "/" + name;
+                if (type == EntryType::FILE) {
+                    files.push_back({child_path, child_relative, identity});
+                } else if (type == EntryType::DIRECTORY) {
+                    directories.emplace_back(child_path, child_relative);
+                }
+            }
+            ::closedir(directory);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!overflow) {
+            entries.insert(entries.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+            overflow = entries.size() > max_entries;
+        }
+        if (!overflow) {
+            for (auto& child : directories) {
+                ++pending;
+                pool_->submit([&, child]() { read_directory(child.first, child.second); });
+            }
+        }
+        if (--pending == 0) {
+            done_cv.notify_all();
+        }
+    };
+
+    for (const auto& root : roots) {
+        EntryType type;
+        FileIdentity identity;
+        if (!stat_entry(AT_FDCWD, root.c_str(), true, type, identity)) {
+            LOG_TRANSFER_WARN() << "Skipping " << root << ": " << std::strerror(errno);
+            continue;
+        }
+
+        // "." or "dir/.." still get a real name
+        std::error_code error;
+        std::string path = std::filesystem::absolute(root, error).lexically_normal().string();
+        if (error) {
+            path = root;
+        }
+        if (path.size() > 1 && path.back() == '/') {
+            path.pop_back();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (type == EntryType::FILE) {
+            entries.push_back({path, root_name(path), identity});
+        } else if (type == EntryType::DIRECTORY) {
+            ++pending;
+            pool_->submit([&, path]() { read_directory(path, root_name(path)); });
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return pending == 0; });
+    }
+    if (overflow || entries.size() > max_entries) {
+        return false;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const WalkEntry& a, const WalkEntry& b) {
+        return a.relative_path < b.relative_path;
+    });
+    return true;
+}
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include "hash_cache.h"
+#include "worker_pool.h"
+
+namespace warpdeck {
+
+struct WalkEntry {
+    std::string path;          // where to read the file
+    std::string relative_path; // '/'-separated name it is sent under
+    FileIdentity identity;
+};
+
+// Expands files and directories into the regular files under them. Each
+// directory is read by a task of its own, so siblings are listed in parallel;
+// entries are stat'ed relative to their directory's descriptor (statx on
+// Linux). Names are relative to each root's parent, so a root ".../photos"
+// yields "photos/2024/a.jpg". Symlinks below a root are not followed.
+class DirectoryWalker {
+public:
+    explicit DirectoryWalker(size_t thread_count);
+
+    // Entries come back sorted by relative path, so the same tree always
+    // gives the same manifest. Missing roots and unreadable directories are
+    // skipped; false if more than max_entries files turn up.
+    bool walk(const std::vector<std::string>& roots, size_t max_entries, std::vector<WalkEntry>& entries);
+
+private:
+    std::unique_ptr<WorkerPool> pool_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "event_dispatcher.h"
+#include "logger.h"
+#include <exception>
+
+namespace warpdeck {
+
+namespace {
+
+int64_t interval_for_rate(double updates_per_second) {
+    if (updates_per_second <= 0.0) {
+        return 0;
+    }
+    return static_cast<int64_t>(1000000.0 / updates_per_second);
+}
+
+} // namespace
+
+EventDispatcher::EventDispatcher()
+    : progress_interval_us_(interval_for_rate(DEFAULT_PROGRESS_RATE)),
+      head_(nullptr), tail_(nullptr), sleeping_(false) {
+    Node* stub = new Node();
+    head_.store(stub);
+    tail_ = stub;
+    thread_ = std::thread(&EventDispatcher::dispatch_loop, this);
+}
+
+EventDispatcher::~EventDispatcher() {
+    Node* stop = new Node();
+    stop->kind = Kind::STOP;
+    push(stop);
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    // Only the consumed stub is left once the thread has seen the stop node
+    delete tail_;
+}
+
+void EventDispatcher::post(Event event) {
+    Node* node = new Node();
+    node->kind = Kind::EVENT;
+    node->event = std::move(event);
+    push(node);
+}
+
+void EventDispatcher::post_for_transfer(const std::string& transfer_id, Event event) {
+    Node* node = new Node();
+    node->kind = Kind::TRANSFER_EVENT;
+    node->transfer_id = transfer_id;
+    node->event = std::move(event);
+    push(node);
+}
+
+void EventDispatcher::post_progress(const std::string& transfer_id, Event event) {
+    Node* node = new Node();
+    node->kind = Kind::PROGRESS;
+    node->transfer_id = transfer_id;
+    node->event = std::move(event);
+    push(node);
+}
+
+void EventDispatcher::set_progress_rate(double updates_per_second) {
+    // Picked up by the dispatch thread the next time it computes a deadline
+    progress_interval_us_.store(interval_for_rate(updates_per_second));
+}
+
+void EventDispatcher::push(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* previous = head_.exchange(node);
+    previous->next.store(node, std::memory_order_release);
+
+    // Pairs with the sleeping_ store / queue_empty() check in dispatch_loop:
+    // either the thread sees this node or we see it is about to sleep
+    if (sleeping_.load()) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_cv_.notify_one();
+    }
+}
+
+EventDispatcher::Node* EventDispatcher::pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (!next) {
+        return nullptr;
+    }
+
+    // `next` becomes the new stub; its payload is still readable by the caller
+    tail_ = next;
+    delete tail;
+    return next;
+}
+
+bool EventDispatcher::queue_empty() const {
+    return head_.load() == tail_;
+}
+
+void EventDispatcher::dispatch_loop() {
+    bool stopping = false;
+
+    while (!stopping) {
+        while (Node* node = pop()) {
+            switch (node->kind) {
+                case Kind::EVENT:
+                    invoke(node->event);
+                    break;
+
+                case Kind::TRANSFER_EVENT:
+                    flush_progress(node->transfer_id);
+                    invoke(node->event);
+                    break;
+
+                case Kind::PROGRESS: {
+                    // A new transfer starts with a zero last_delivery, so its first update goes out at once
+                    progress_[node->transfer_id].event = std::move(node->event);
+                    break;
+                }
+
+                case Kind::STOP:
+                    stopping = true;
+                    break;
+            }
+
+            // Release whatever the event captured now rather than on the next pop
+            node->event = nullptr;
+            node->transfer_id.clear();
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        // Deliver the progress updates that are due and find the next deadline
+        auto now = std::chrono::steady_clock::now();
+        auto interval = std::chrono::microseconds(progress_interval_us_.load());
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        for (auto& entry : progress_) {
+            PendingProgress& pending = entry.second;
+            if (!pending.event) {
+                continue;
+            }
+            auto due = pending.last_delivery + interval;
+            if (due <= now) {
+                deliver_progress(pending);
+            } else if (due < deadline) {
+                deadline = due;
+            }
+        }
+
+        if (!queue_empty()) {
+            // A producer has claimed head_ but not linked its node yet
+            if (!tail_->next.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        sleeping_.store(true);
+        auto has_work = [this]() { return !queue_empty(); };
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            wake_cv_.wait(lock, has_work);
+        } else {
+            wake_cv_.wait_until(lock, deadline, has_work);
+        }
+        sleeping_.store(false);
+    }
+
+    // Final state of every transfer still reaches the application
+    for (auto& entry : progress_) {
+        deliver_progress(entry.second);
+    }
+    progress_.clear();
+}
+
+void EventDispatcher::deliver_progress(PendingProgress& pending) {
+    Event event = std::move(pending.event);
+    pending.event = nullptr;
+    pending.last_delivery = std::chrono::steady_clock::now();
+    invoke(event);
+}
+
+void EventDispatcher::flush_progress(const std::string& transfer_id) {
+    auto it = progress_.find(transfer_id);
+    if (it == progress_.end()) {
+        return;
+    }
+
+    deliver_progress(it->second);
+    // The transfer-level event is its last; nothing to coalesce against any more
+    progress_.erase(it);
+}
+
+void EventDispatcher::invoke(const Event& event) {
+    if (!event) {
+        return;
+    }
+
+    try {
+        event();
+    } catch (const std::exception& e) {
+        LOG_CORE_WARN() << "Event callback threw: " << e.what();
+    } catch (...) {
+        LOG_CORE_WARN() << "Event callback threw";
+    }
+}
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace warpdeck {
+
+// Delivers library callbacks on a dedicated thread so that HTTP server and
+// transfer threads never block on application code. Producers push onto a
+// lock-free multi-producer queue; the dispatch thread drains it in order.
+//
+// Progress events are coalesced per transfer: only the latest update is kept
+// and it is delivered at most `progress_rate` times per second. All other
+// events are delivered exactly once, in the order they were posted, and an
+// event tied to a transfer first flushes that transfer's pending progress.
+class EventDispatcher {
+public:
+    using Event = std::function<void()>;
+
+    static constexpr double DEFAULT_PROGRESS_RATE = 20.0;
+
+    EventDispatcher();
+    // Delivers everything already posted, then joins the dispatch thread
+    ~EventDispatcher();
+
+    EventDispatcher(const EventDispatcher&) = delete;
+    EventDispatcher& operator=(const EventDispatcher&) = delete;
+
+    void post(Event event);
+    void post_for_transfer(const std::string& transfer_id, Event event);
+    // Replaces the transfer's undelivered progress event, if any
+    void post_progress(const std::string& transfer_id, Event event);
+
+    // Updates per second per transfer; zero or less delivers every update
+    void set_progress_rate(double updates_per_second);
+
+private:
+    enum class Kind { EVENT, TRANSFER_EVENT, PROGRESS, STOP };
+
+    struct Node {
+        std::atomic<Node*> next;
+        Kind kind;
+        std::string transfer_id;
+        Event event;
+
+        Node() : next(nullptr), kind(Kind::EVENT) {}
+    };
+
+    struct PendingProgress {
+        Event event;  // empty once delivered
+        std::chrono::steady_clock::time_point last_delivery;
+    };
+
+    void push(Node* node);
+    Node* pop();
+    bool queue_empty() const;
+
+    void dispatch_loop();
+    void deliver_progress(PendingProgress& pending);
+    void flush_progress(const std::string& transfer_id);
+    void invoke(const Event& event);
+
+    std::atomic<int64_t> progress_interval_us_;
+
+    // Vyukov MPSC queue: producers swap themselves into head_, the dispatch
+    // thread alone walks from tail_. tail_ always points at a consumed node.
+    std::atomic<Node*> head_;
+    Node* tail_;
+
+    // Dispatch-thread state
+    std::unordered_map<std::string, PendingProgress> progress_;
+
+    // Only used to park the dispatch thread while the queue is empty
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<bool> sleeping_;
+
+    std::thread thread_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
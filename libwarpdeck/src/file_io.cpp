@@ -0,0 +1,697 @@
+#include "file_io.h"
+#include "utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef WARPDECK_HAVE_IO_URING
+#include <liburing.h>
+#include <sys/uio.h>
+#endif
+
+namespace warpdeck {
+
+namespace {
+
+// Reads exactly `length` bytes unless the file ends first; returns the count or -1
+ssize_t pread_full(int fd, char* data, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t result = ::pread(fd, data + done, length - done, static_cast<off_t>(offset + done));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        done += static_cast<size_t>(result);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+} // namespace
+
+#ifdef WARPDECK_HAVE_IO_URING
+
+// One ring plus IO_QUEUE_DEPTH buffers per thread, registered with the kernel
+// once so fixed reads and writes skip the per-request page pinning. A thread
+// uses it for one reader or writer at a time; a nested user falls back to POSIX.
+class IoUringContext {
+public:
+    struct Slot {
+        uint64_t offset = 0;
+        size_t length = 0;
+        int result = 0;
+        bool busy = false;  // owned by the kernel until its completion is reaped
+    };
+
+    IoUringContext() : memory_(new char[IO_QUEUE_DEPTH * IO_BUFFER_SIZE]), initialized_(false),
+                       fixed_buffers_(false), queued_count_(0), in_use(false), broken(false) {}
+
+    ~IoUringContext() {
+        if (initialized_) {
+            io_uring_queue_exit(&ring_);
+        }
+    }
+
+    bool initialize() {
+        int result = io_uring_queue_init(IO_QUEUE_DEPTH * 2, &ring_, 0);
+        if (result < 0) {
+            LOG_CORE_WARN() << "io_uring unavailable (" << std::strerror(-result) << "), using POSIX file I/O";
+            return false;
+        }
+        initialized_ = true;
+
+        struct iovec iovecs[IO_QUEUE_DEPTH];
+        for (unsigned i = 0; i < IO_QUEUE_DEPTH; ++i) {
+            iovecs[i].iov_base = buffer(i);
+            iovecs[i].iov_len = IO_BUFFER_SIZE;
+        }
+        // Registration counts against RLIMIT_MEMLOCK on older kernels; plain reads and writes still work
+        fixed_buffers_ = io_uring_register_buffers(&ring_, iovecs, IO_QUEUE_DEPTH) == 0;
+        return true;
+    }
+
+    char* buffer(unsigned index) {
+        return memory_.get() + static_cast<size_t>(index) * IO_BUFFER_SIZE;
+    }
+
+    // False once the ring has failed; the slot stays free
+    bool prepare_write(int fd, unsigned index) {
+        struct io_uring_sqe* sqe = next_sqe();
+        if (!sqe) {
+            return false;
+        }
+        Slot& slot = slots[index];
+        if (fixed_buffers_) {
+            io_uring_prep_write_fixed(sqe, fd, buffer(index), static_cast<unsigned>(slot.length),
+                                      slot.offset, static_cast<int>(index));
+        } else {
+            io_uring_prep_write(sqe, fd, buffer(index), static_cast<unsigned>(slot.length), slot.offset);
+        }
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(index)));
+        slot.busy = true;
+        queued_[queued_count_++] = index;
+        return true;
+    }
+
+    // False once the ring has failed; the slot stays free
+    bool prepare_read(int fd, unsigned index) {
+        struct io_uring_sqe* sqe = next_sqe();
+        if (!sqe) {
+            return false;
+        }
+        Slot& slot = slots[index];
+        if (fixed_buffers_) {
+            io_uring_prep_read_fixed(sqe, fd, buffer(index), static_cast<unsigned>(slot.length),
+                                     slot.offset, static_cast<int>(index));
+        } else {
+            io_uring_prep_read(sqe, fd, buffer(index), static_cast<unsigned>(slot.length), slot.offset);
+        }
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(index)));
+        slot.busy = true;
+        queued_[queued_count_++] = index;
+        return true;
+    }
+
+    // Hands every prepared request to the kernel in a single system call
+    bool submit() {
+        int result;
+        do {
+            result = io_uring_submit(&ring_);
+        } while (result == -EINTR);
+        if (result < 0) {
+            // Prepared requests are stuck in the queue and will never complete,
+            // so their slots aren't waited for; the ring can't be reused safely
+            for (unsigned i = 0; i < queued_count_; ++i) {
+                slots[queued_[i]].busy = false;
+            }
+            queued_count_ = 0;
+            broken = true;
+            return false;
+        }
+        queued_count_ = 0;
+        return true;
+    }
+
+    // Blocks for one completion, records it in its slot and returns the slot index
+    int reap() {
+        struct io_uring_cqe* cqe = nullptr;
+        int result;
+        do {
+            result = io_uring_wait_cqe(&ring_, &cqe);
+        } while (result == -EINTR);
+        if (result < 0) {
+            broken = true;
+            return -1;
+        }
+
+        unsigned index = static_cast<unsigned>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+        slots[index].result = cqe->res;
+        slots[index].busy = false;
+        io_uring_cqe_seen(&ring_, cqe);
+        return static_cast<int>(index);
+    }
+
+    bool any_busy() const {
+        return std::any_of(std::begin(slots), std::end(slots), [](const Slot& slot) { return slot.busy; });
+    }
+
+    Slot slots[IO_QUEUE_DEPTH];
+
+private:
+    struct io_uring_sqe* next_sqe() {
+        // The ring has room for twice the slots, so this only loops if the kernel lags
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        while (!sqe) {
+            if (!submit()) {
+                return nullptr;
+            }
+            sqe = io_uring_get_sqe(&ring_);
+        }
+        return sqe;
+    }
+
+    struct io_uring ring_;
+    std::unique_ptr<char[]> memory_;
+    bool initialized_;
+    bool fixed_buffers_;
+    unsigned queued_[IO_QUEUE_DEPTH]; // slots prepared since the last submit
+    unsigned queued_count_;
+
+public:
+    bool in_use;
+    bool broken;
+};
+
+namespace {
+
+std::atomic<bool> io_uring_disabled{false};
+thread_local std::unique_ptr<IoUringContext> thread_ring;
+
+IoUringContext* acquire_ring() {
+    if (io_uring_disabled) {
+        return nullptr;
+    }
+    if (!thread_ring) {
+        auto context = std::make_unique<IoUringContext>();
+        if (!context->initialize()) {
+            // Same kernel for every thread; don't retry
+            io_uring_disabled = true;
+            return nullptr;
+        }
+        thread_ring = std::move(context);
+    }
+    if (thread_ring->in_use) {
+        return nullptr;
+    }
+    thread_ring->in_use = true;
+    return thread_ring.get();
+}
+
+void release_ring(IoUringContext* ring) {
+    if (!ring) {
+        return;
+    }
+    ring->in_use = false;
+    if (ring->broken) {
+        // The next user on this thread starts with a fresh ring
+        thread_ring.reset();
+    }
+}
+
+} // namespace
+
+bool io_uring_available() {
+    release_ring(acquire_ring());
+    return !io_uring_disabled;
+}
+
+#else
+
+bool io_uring_available() {
+    return false;
+}
+
+namespace {
+
+IoUringContext* acquire_ring() {
+    return nullptr;
+}
+
+void release_ring(IoUringContext*) {}
+
+} // namespace
+
+#endif
+
+CacheAdvisor::CacheAdvisor()
+    : fd_(-1), direction_(Direction::READ), end_offset_(0), dropped_(0), advised_(0) {}
+
+void CacheAdvisor::begin(int fd, Direction direction, uint64_t offset, uint64_t length) {
+    fd_ = fd;
+    direction_ = direction;
+    end_offset_ = offset + length;
+    dropped_ = offset;
+    advised_ = offset;
+
+#ifdef WARPDECK_PLATFORM_LINUX
+    if (direction == Direction::READ) {
+        posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_SEQUENTIAL);
+    }
+#elif defined(WARPDECK_PLATFORM_MACOS)
+    // No fadvise or sync_file_range here; keep the data out of the unified buffer cache instead
+    fcntl(fd, F_NOCACHE, 1);
+#endif
+
+    advance(offset);
+}
+
+void CacheAdvisor::advance(uint64_t position) {
+    if (fd_ < 0) {
+        return;
+    }
+
+    if (direction_ == Direction::READ) {
+        while (advised_ < end_offset_ && advised_ < position + CACHE_WINDOW_SIZE) {
+            uint64_t length = std::min(CACHE_WINDOW_SIZE, end_offset_ - advised_);
+#ifdef WARPDECK_PLATFORM_LINUX
+            posix_fadvise(fd_, static_cast<off_t>(advised_), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#elif defined(WARPDECK_PLATFORM_MACOS)
+            struct radvisory advice;
+            advice.ra_offset = static_cast<off_t>(advised_);
+            advice.ra_count = static_cast<int>(length);
+            fcntl(fd_, F_RDADVISE, &advice);
+#endif
+            advised_ += length;
+        }
+        if (position >= dropped_ + CACHE_WINDOW_SIZE) {
+            drop(dropped_, position);
+        }
+        return;
+    }
+
+    if (position < advised_ + CACHE_WINDOW_SIZE) {
+        return;
+    }
+#ifdef WARPDECK_PLATFORM_LINUX
+    // Start writeback of the new window; the previous one has had a window's
+    // worth of time to reach the disk, so waiting for it rarely blocks
+    sync_file_range(fd_, static_cast<off_t>(advised_), static_cast<off_t>(position - advised_),
+                    SYNC_FILE_RANGE_WRITE);
+    if (advised_ > dropped_) {
+        sync_file_range(fd_, static_cast<off_t>(dropped_), static_cast<off_t>(advised_ - dropped_),
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        drop(dropped_, advised_);
+    }
+#endif
+    advised_ = position;
+}
+
+void CacheAdvisor::end(uint64_t position) {
+    if (fd_ < 0) {
+        return;
+    }
+
+#ifdef WARPDECK_PLATFORM_LINUX
+    if (direction_ == Direction::WRITE && position > advised_) {
+        sync_file_range(fd_, static_cast<off_t>(advised_), static_cast<off_t>(position - advised_),
+                        SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    // Dirty pages that are still being written back stay cached; the rest go
+    if (position > dropped_) {
+        drop(dropped_, position);
+    }
+    fd_ = -1;
+}
+
+bool CacheAdvisor::active() const {
+    return fd_ >= 0;
+}
+
+void CacheAdvisor::drop(uint64_t from, uint64_t to) {
+#ifdef WARPDECK_PLATFORM_LINUX
+    posix_fadvise(fd_, static_cast<off_t>(from), static_cast<off_t>(to - from), POSIX_FADV_DONTNEED);
+#else
+    (void)from;
+#endif
+    dropped_ = to;
+}
+
+FileWriter::FileWriter(int fd, uint64_t offset, bool bulk_io)
+    : fd_(fd), offset_(offset), ok_(true), bulk_io_(bulk_io), ring_(acquire_ring()),
+      current_(0), fill_(0), in_flight_(0) {
+    if (!ring_) {
+        buffer_.reserve(IO_BUFFER_SIZE);
+    }
+    if (bulk_io_ && fd_ >= 0) {
+        advisor_.begin(fd_, CacheAdvisor::Direction::WRITE, offset_, 0);
+    }
+}
+
+FileWriter::~FileWriter() {
+    // The kernel may still be reading from the buffers
+    while (in_flight_ > 0 && wait_for_completion()) {
+    }
+    advisor_.end(written_up_to());
+    release_ring(ring_);
+}
+
+void FileWriter::reset(int fd, uint64_t offset, bool bulk_io) {
+    fd_ = fd;
+    offset_ = offset;
+    ok_ = true;
+    bulk_io_ = bulk_io;
+    fill_ = 0;
+    buffer_.clear();
+
+    if (bulk_io_ && fd_ >= 0) {
+        advisor_.begin(fd_, CacheAdvisor::Direction::WRITE, offset_, 0);
+    }
+}
+
+bool FileWriter::write(const char* data, size_t length) {
+    if (!ok_) {
+        return false;
+    }
+
+#ifdef WARPDECK_HAVE_IO_URING
+    if (ring_) {
+        while (length > 0) {
+            while (ring_->slots[current_].busy) {
+                if (!wait_for_completion()) {
+                    return false;
+                }
+            }
+            if (!ok_) {
+                return false;
+            }
+
+            size_t take = std::min(length, IO_BUFFER_SIZE - fill_);
+            std::memcpy(ring_->buffer(current_) + fill_, data, take);
+            fill_ += take;
+            data += take;
+            length -= take;
+
+            if (fill_ == IO_BUFFER_SIZE) {
+                if (!submit_current()) {
+                    return false;
+                }
+                if (!ring_) {
+                    return write(data, length);
+                }
+                advisor_.advance(written_up_to());
+            }
+        }
+        return ok_;
+    }
+#endif
+
+    if (buffer_.size() + length > IO_BUFFER_SIZE && !buffer_.empty()) {
+        ok_ = ok_ && utils::pwrite_all(fd_, buffer_.data(), buffer_.size(), offset_);
+        offset_ += buffer_.size();
+        buffer_.clear();
+    }
+    if (length >= IO_BUFFER_SIZE) {
+        ok_ = ok_ && utils::pwrite_all(fd_, data, length, offset_);
+        offset_ += length;
+    } else {
+        buffer_.insert(buffer_.end(), data, data + length);
+    }
+    advisor_.advance(offset_);
+    return ok_;
+}
+
+bool FileWriter::flush() {
+#ifdef WARPDECK_HAVE_IO_URING
+    if (ring_) {
+        submit_current();
+    }
+    if (ring_) {
+        while (in_flight_ > 0 && wait_for_completion()) {
+        }
+        advisor_.end(offset_);
+        return ok_;
+    }
+#endif
+
+    if (!buffer_.empty()) {
+        ok_ = ok_ && utils::pwrite_all(fd_, buffer_.data(), buffer_.size(), offset_);
+        offset_ += buffer_.size();
+        buffer_.clear();
+    }
+    advisor_.end(offset_);
+    return ok_;
+}
+
+uint64_t FileWriter::written_up_to() const {
+    uint64_t position = offset_;
+#ifdef WARPDECK_HAVE_IO_URING
+    // Writes may complete out of order; only the prefix before the oldest pending one is on its way to disk
+    if (ring_) {
+        for (const auto& slot : ring_->slots) {
+            if (slot.busy) {
+                position = std::min(position, slot.offset);
+            }
+        }
+    }
+#endif
+    return position;
+}
+
+bool FileWriter::submit_current() {
+#ifdef WARPDECK_HAVE_IO_URING
+    if (fill_ == 0) {
+        return ok_;
+    }
+
+    IoUringContext::Slot& slot = ring_->slots[current_];
+    slot.offset = offset_;
+    slot.length = fill_;
+    if (!ring_->prepare_write(fd_, current_) || !ring_->submit()) {
+        return fall_back_to_posix();
+    }
+
+    ++in_flight_;
+    offset_ += fill_;
+    fill_ = 0;
+    current_ = (current_ + 1) % IO_QUEUE_DEPTH;
+#endif
+    return ok_;
+}
+
+bool FileWriter::wait_for_completion() {
+#ifdef WARPDECK_HAVE_IO_URING
+    int index = ring_->reap();
+    if (index < 0) {
+        // The ring is discarded on release, along with whatever is still queued
+        ok_ = false;
+        in_flight_ = 0;
+        return false;
+    }
+
+    --in_flight_;
+    IoUringContext::Slot& slot = ring_->slots[index];
+    if (slot.result < 0) {
+        LOG_CORE_ERROR() << "Write at " << slot.offset << " failed: " << std::strerror(-slot.result);
+        ok_ = false;
+    } else if (static_cast<size_t>(slot.result) < slot.length) {
+        // Short write: finish the rest synchronously
+        size_t written = static_cast<size_t>(slot.result);
+        ok_ = ok_ && utils::pwrite_all(fd_, ring_->buffer(static_cast<unsigned>(index)) + written,
+                                       slot.length - written, slot.offset + written);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FileWriter::fall_back_to_posix() {
+#ifdef WARPDECK_HAVE_IO_URING
+    LOG_CORE_WARN() << "io_uring submission failed, writing the rest with pwrite";
+    // Writes the kernel already took still complete into the file
+    while (in_flight_ > 0 && wait_for_completion()) {
+    }
+    if (fill_ > 0) {
+        ok_ = ok_ && utils::pwrite_all(fd_, ring_->buffer(current_), fill_, offset_);
+        offset_ += fill_;
+        fill_ = 0;
+    }
+    release_ring(ring_);
+    ring_ = nullptr;
+    buffer_.reserve(IO_BUFFER_SIZE);
+#endif
+    return ok_;
+}
+
+FileReader::FileReader()
+    : fd_(-1), next_offset_(0), end_offset_(0), consumed_(0), ring_(nullptr), head_(0), in_flight_(0),
+      head_held_(false) {}
+
+FileReader::~FileReader() {
+    close();
+}
+
+bool FileReader::open(const std::string& file_path, uint64_t offset, uint64_t length, bool bulk_io) {
+    close();
+
+    fd_ = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    next_offset_ = offset;
+    end_offset_ = offset + length;
+    consumed_ = offset;
+    head_ = 0;
+    in_flight_ = 0;
+    head_held_ = false;
+
+    if (bulk_io) {
+        advisor_.begin(fd_, CacheAdvisor::Direction::READ, offset, length);
+    }
+
+    ring_ = acquire_ring();
+    if (!ring_) {
+        buffer_.resize(IO_BUFFER_SIZE);
+        return true;
+    }
+    submit_reads();
+    return true;
+}
+
+void FileReader::close() {
+#ifdef WARPDECK_HAVE_IO_URING
+    while (ring_ && ring_->any_busy() && ring_->reap() >= 0) {
+    }
+#endif
+    release_ring(ring_);
+    ring_ = nullptr;
+
+    if (fd_ >= 0) {
+        advisor_.end(consumed_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool FileReader::next(const char*& data, size_t& size) {
+    if (fd_ < 0) {
+        return false;
+    }
+    advisor_.advance(consumed_);
+
+#ifdef WARPDECK_HAVE_IO_URING
+    if (ring_ && head_held_) {
+        head_ = (head_ + 1) % IO_QUEUE_DEPTH;
+        --in_flight_;
+        head_held_ = false;
+        submit_reads();
+    }
+    if (ring_) {
+        if (in_flight_ == 0) {
+            return false;
+        }
+
+        IoUringContext::Slot& slot = ring_->slots[head_];
+        while (slot.busy) {
+            if (!wait_for_completion()) {
+                return false;
+            }
+        }
+
+        if (slot.result < 0) {
+            LOG_CORE_ERROR() << "Read at " << slot.offset << " failed: " << std::strerror(-slot.result);
+            return false;
+        }
+        if (static_cast<size_t>(slot.result) < slot.length) {
+            // Short read: fetch the rest synchronously; EOF means the file shrank
+            size_t done = static_cast<size_t>(slot.result);
+            ssize_t rest = pread_full(fd_, ring_->buffer(head_) + done, slot.length - done, slot.offset + done);
+            if (rest < 0 || static_cast<size_t>(rest) != slot.length - done) {
+                return false;
+            }
+        }
+
+        data = ring_->buffer(head_);
+        size = slot.length;
+        head_held_ = true;
+        consumed_ = slot.offset + slot.length;
+        return true;
+    }
+#endif
+
+    if (next_offset_ >= end_offset_) {
+        return false;
+    }
+
+    size_t to_read = static_cast<size_t>(std::min<uint64_t>(IO_BUFFER_SIZE, end_offset_ - next_offset_));
+    ssize_t result = pread_full(fd_, buffer_.data(), to_read, next_offset_);
+    if (result < 0 || static_cast<size_t>(result) != to_read) {
+        return false;
+    }
+
+    next_offset_ += to_read;
+    consumed_ = next_offset_;
+    data = buffer_.data();
+    size = to_read;
+    return true;
+}
+
+void FileReader::submit_reads() {
+#ifdef WARPDECK_HAVE_IO_URING
+    bool prepared = false;
+    while (in_flight_ < IO_QUEUE_DEPTH && next_offset_ < end_offset_) {
+        unsigned index = (head_ + in_flight_) % IO_QUEUE_DEPTH;
+        IoUringContext::Slot& slot = ring_->slots[index];
+        slot.offset = next_offset_;
+        slot.length = static_cast<size_t>(std::min<uint64_t>(IO_BUFFER_SIZE, end_offset_ - next_offset_));
+        if (!ring_->prepare_read(fd_, index)) {
+            fall_back_to_posix();
+            return;
+        }
+
+        next_offset_ += slot.length;
+        ++in_flight_;
+        prepared = true;
+    }
+    if (prepared && !ring_->submit()) {
+        fall_back_to_posix();
+    }
+#endif
+}
+
+void FileReader::fall_back_to_posix() {
+#ifdef WARPDECK_HAVE_IO_URING
+    LOG_CORE_WARN() << "io_uring submission failed, reading the rest with pread";
+    // The read-ahead buffers go with the ring; blocks not yet returned are read again
+    while (ring_->any_busy() && ring_->reap() >= 0) {
+    }
+    release_ring(ring_);
+    ring_ = nullptr;
+    next_offset_ = consumed_;
+    in_flight_ = 0;
+    head_held_ = false;
+    buffer_.resize(IO_BUFFER_SIZE);
+#endif
+}
+
+bool FileReader::wait_for_completion() {
+#ifdef WARPDECK_HAVE_IO_URING
+    return ring_->reap() >= 0;
+#else
+    return false;
+#endif
+}
+
+} // namespace warpdeck
\ No newline at end of file
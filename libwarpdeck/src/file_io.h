@@ -0,0 +1,126 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace warpdeck {
+
+// Size of each I/O buffer and the number of them a reader or writer keeps in flight
+constexpr size_t IO_BUFFER_SIZE = 256 * 1024;
+constexpr unsigned IO_QUEUE_DEPTH = 4;
+
+// Bulk mode advises the kernel in steps of this size
+constexpr uint64_t CACHE_WINDOW_SIZE = 8 * 1024 * 1024;
+
+class IoUringContext;
+
+// True when file I/O goes through io_uring; false when the library was built
+// without it or the running kernel refused to set up a ring
+bool io_uring_available();
+
+// Keeps a single sequential pass over a large file from evicting the rest of
+// the page cache. Reads get SEQUENTIAL plus WILLNEED read-ahead one window in
+// front of the cursor; writes get write-behind (writeback is started for each
+// window and waited for a window later). Both drop pages behind the cursor.
+class CacheAdvisor {
+public:
+    enum class Direction { READ, WRITE };
+
+    CacheAdvisor();
+
+    void begin(int fd, Direction direction, uint64_t offset, uint64_t length);
+    // `position` is the file offset everything before which has been consumed or written
+    void advance(uint64_t position);
+    void end(uint64_t position);
+    bool active() const;
+
+private:
+    void drop(uint64_t from, uint64_t to);
+
+    int fd_;
+    Direction direction_;
+    uint64_t end_offset_;
+    uint64_t dropped_;   // pages before this were released
+    uint64_t advised_;   // read-ahead requested / writeback started up to here
+};
+
+// Coalesces small socket reads into large positional writes. With io_uring the
+// filled buffers are written asynchronously while the next one is being filled;
+// otherwise each full buffer is written with pwrite.
+class FileWriter {
+public:
+    FileWriter(int fd, uint64_t offset, bool bulk_io);
+    ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    // Points the writer at another file; pending data must have been flushed
+    void reset(int fd, uint64_t offset, bool bulk_io);
+    bool write(const char* data, size_t length);
+    // Ends the range: waits for every byte handed to write() to reach the file
+    bool flush();
+
+private:
+    bool submit_current();
+    bool wait_for_completion();  // false only if the ring itself failed
+    // Continues with pwrite once the ring has failed, starting with the buffer being filled
+    bool fall_back_to_posix();
+    uint64_t written_up_to() const;
+
+    int fd_;
+    uint64_t offset_;
+    bool ok_;
+    bool bulk_io_;
+    std::vector<char> buffer_;
+    CacheAdvisor advisor_;
+
+    // io_uring state; unused on the POSIX path
+    IoUringContext* ring_;
+    unsigned current_;
+    size_t fill_;
+    unsigned in_flight_;
+};
+
+// Reads [offset, offset + length) of a file front to back in IO_BUFFER_SIZE
+// blocks. With io_uring the following blocks are read ahead asynchronously.
+class FileReader {
+public:
+    FileReader();
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    // bulk_io drops the pages behind the cursor so the pass doesn't evict the page cache
+    bool open(const std::string& file_path, uint64_t offset, uint64_t length, bool bulk_io);
+    void close();
+
+    // Returns the next block; it stays valid until the next call. Fails on read
+    // errors and when the file is shorter than the requested range.
+    bool next(const char*& data, size_t& size);
+
+private:
+    // Queues read-ahead; falls back to POSIX reads if the ring fails
+    void submit_reads();
+    bool wait_for_completion();
+    // Continues with pread after the last returned block once the ring has failed
+    void fall_back_to_posix();
+
+    int fd_;
+    uint64_t next_offset_;   // first byte not yet requested
+    uint64_t end_offset_;
+    uint64_t consumed_;      // end of the block returned by the last next() call
+    std::vector<char> buffer_;
+    CacheAdvisor advisor_;
+
+    IoUringContext* ring_;
+    unsigned head_;          // oldest outstanding block
+    unsigned in_flight_;
+    bool head_held_;         // head block was returned by the last next() call
+};
+
+} // namespace warpdeck
\ No newline at end of file
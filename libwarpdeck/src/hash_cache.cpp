@@ -0,0 +1,441 @@
+#include "hash_cache.h"
+#include "utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace warpdeck {
+
+namespace {
+
+constexpr uint32_t INDEX_MAGIC = 0x57444843; // "WDHC"
+constexpr uint32_t INDEX_VERSION = 1;
+constexpr uint32_t SLOT_USED = 1; // anything else, notably zero fill, is empty
+
+uint32_t now_seconds() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+uint64_t mix(uint64_t value) {
+    // splitmix64 finalizer
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+void fnv1a(uint32_t& hash, const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+}
+
+} // namespace
+
+struct HashCache::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity; // slots, a power of two
+    uint32_t count;
+    uint64_t data_size; // bytes of hash_cache.dat in use
+    uint64_t dead_bytes; // digests no slot refers to any more
+    uint8_t reserved[32];
+};
+
+struct HashCache::Slot {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t chunk_size;
+    uint64_t data_offset;
+    uint32_t chunk_count;
+    uint32_t checksum;
+    uint32_t last_used; // seconds since the epoch
+    uint32_t state;
+};
+
+bool FileIdentity::operator==(const FileIdentity& other) const {
+    return device == other.device && inode == other.inode && size == other.size && mtime_ns == other.mtime_ns;
+}
+
+bool FileIdentity::operator!=(const FileIdentity& other) const {
+    return !(*this == other);
+}
+
+HashCache::HashCache() : lock_fd_(-1), data_fd_(-1), map_(nullptr), map_size_(0) {
+    static_assert(sizeof(Header) == 64, "hash cache header layout");
+    static_assert(sizeof(Slot) == 64, "hash cache slot layout");
+}
+
+HashCache::~HashCache() {
+    release();
+}
+
+bool HashCache::open(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    release();
+    directory_ = directory;
+
+    lock_fd_ = ::open((directory_ + "/hash_cache.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd_ < 0) {
+        return false;
+    }
+    if (flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+        LOG_TRANSFER_WARN() << "Hash cache in " << directory_ << " is in use by another process";
+        release();
+        return false;
+    }
+
+    data_fd_ = ::open(data_path().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (data_fd_ < 0 || (!map_index() && !rebuild(INITIAL_CAPACITY, 0, 0))) {
+        release();
+        return false;
+    }
+
+    // Forget files nobody sent in a while and reclaim superseded digests
+    uint32_t now = now_seconds();
+    uint32_t max_age = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(MAX_AGE).count());
+    uint32_t oldest = now > max_age ? now - max_age : 0;
+    size_t expired = 0;
+    for (uint32_t i = 0; i < header()->capacity; ++i) {
+        if (slots()[i].state == SLOT_USED && slots()[i].last_used < oldest) {
+            ++expired;
+        }
+    }
+    if (expired > 0 || header()->dead_bytes > header()->data_size / 2) {
+        if (!rebuild(header()->capacity, header()->count, oldest) && !map_) {
+            release();
+            return false;
+        }
+    }
+
+    LOG_TRANSFER_DEBUG() << "Hash cache holds " << header()->count << " files";
+    return true;
+}
+
+void HashCache::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    release();
+}
+
+bool HashCache::lookup(const FileIdentity& identity, TreeHash& hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!map_) {
+        return false;
+    }
+
+    Slot* slot = find_slot(slots(), header()->capacity, identity);
+    if (!slot || slot->state != SLOT_USED || slot->size != identity.size || slot->mtime_ns != identity.mtime_ns) {
+        return false;
+    }
+    // Entries made under another chunking policy are useless to the receiver
+    if (slot->chunk_size != hash_chunk_size(slot->size) ||
+        slot->chunk_count != hash_chunk_count(slot->size, slot->chunk_size)) {
+        return false;
+    }
+
+    uint64_t length = static_cast<uint64_t>(slot->chunk_count) * HASH_DIGEST_SIZE;
+    if (slot->data_offset > header()->data_size || length > header()->data_size - slot->data_offset) {
+        return false;
+    }
+    std::string digests(length, '\0');
+    if (!utils::pread_all(data_fd_, &digests[0], digests.size(), slot->data_offset) ||
+        checksum(*slot, digests) != slot->checksum) {
+        return false;
+    }
+
+    hash.chunk_size = slot->chunk_size;
+    hash.chunk_hashes.clear();
+    hash.chunk_hashes.reserve(slot->chunk_count);
+    for (uint32_t i = 0; i < slot->chunk_count; ++i) {
+        hash.chunk_hashes.push_back(
+            digest_to_hex(reinterpret_cast<const unsigned char*>(digests.data()) + i * HASH_DIGEST_SIZE));
+    }
+    hash.root = tree_hash_root(hash.chunk_hashes);
+    slot->last_used = now_seconds();
+    return true;
+}
+
+void HashCache::store(const FileIdentity& identity, const TreeHash& hash) {
+    // A write landing in the same timestamp tick as the hash would not move
+    // the mtime, so only remember files that have been left alone for a bit
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (identity.mtime_ns > now_ns - std::chrono::duration_cast<std::chrono::nanoseconds>(MTIME_SETTLE_TIME).count()) {
+        return;
+    }
+    if (hash.chunk_size != hash_chunk_size(identity.size) ||
+        hash.chunk_hashes.size() != hash_chunk_count(identity.size, hash.chunk_size)) {
+        return;
+    }
+
+    std::string digests(hash.chunk_hashes.size() * HASH_DIGEST_SIZE, '\0');
+    for (size_t i = 0; i < hash.chunk_hashes.size(); ++i) {
+        if (!digest_from_hex(hash.chunk_hashes[i], reinterpret_cast<unsigned char*>(&digests[i * HASH_DIGEST_SIZE]))) {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!map_) {
+        return;
+    }
+
+    Slot* slot = find_slot(slots(), header()->capacity, identity);
+    bool replacing = slot && slot->state == SLOT_USED;
+
+    // Keep the table at most three quarters full, growing it until MAX_CAPACITY
+    if (!replacing && (static_cast<uint64_t>(header()->count) + 1) * 4 > static_cast<uint64_t>(header()->capacity) * 3) {
+        uint32_t capacity = header()->capacity;
+        bool rebuilt = capacity < MAX_CAPACITY ? rebuild(capacity * 2, header()->count, 0)
+                                               : rebuild(capacity, capacity / 2, 0);
+        if (!rebuilt || !map_) {
+            return;
+        }
+        slot = find_slot(slots(), header()->capacity, identity);
+    }
+    if (header()->data_size + digests.size() > MAX_DATA_SIZE) {
+        if (!rebuild(header()->capacity, header()->count / 2, 0) || !map_ ||
+            header()->data_size + digests.size() > MAX_DATA_SIZE) {
+            return;
+        }
+        slot = find_slot(slots(), header()->capacity, identity);
+        replacing = slot && slot->state == SLOT_USED;
+    }
+    if (!slot) {
+        return;
+    }
+
+    // Digests first: a slot is only ever published over data that is already there
+    if (!utils::pwrite_all(data_fd_, digests.data(), digests.size(), header()->data_size)) {
+        return;
+    }
+    if (replacing) {
+        header()->dead_bytes += static_cast<uint64_t>(slot->chunk_count) * HASH_DIGEST_SIZE;
+    } else {
+        header()->count++;
+    }
+
+    slot->device = identity.device;
+    slot->inode = identity.inode;
+    slot->size = identity.size;
+    slot->mtime_ns = identity.mtime_ns;
+    slot->chunk_size = hash.chunk_size;
+    slot->data_offset = header()->data_size;
+    slot->chunk_count = static_cast<uint32_t>(hash.chunk_hashes.size());
+    slot->last_used = now_seconds();
+    slot->checksum = checksum(*slot, digests);
+    slot->state = SLOT_USED;
+    header()->data_size += digests.size();
+}
+
+bool HashCache::identify(const std::string& path, FileIdentity& identity) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    identity.device = static_cast<uint64_t>(st.st_dev);
+    identity.inode = static_cast<uint64_t>(st.st_ino);
+    identity.size = static_cast<uint64_t>(st.st_size);
+#ifdef WARPDECK_PLATFORM_MACOS
+    identity.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    identity.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+HashCache::Header* HashCache::header() const {
+    return static_cast<Header*>(map_);
+}
+
+HashCache::Slot* HashCache::slots() const {
+    return reinterpret_cast<Slot*>(static_cast<char*>(map_) + sizeof(Header));
+}
+
+HashCache::Slot* HashCache::find_slot(Slot* table, uint32_t capacity, const FileIdentity& identity) {
+    uint32_t mask = capacity - 1;
+    uint32_t index = static_cast<uint32_t>(mix(identity.device * 0x9e3779b97f4a7c15ULL ^ identity.inode)) & mask;
+    for (uint32_t probe = 0; probe < capacity; ++probe) {
+        Slot& slot = table[(index + probe) & mask];
+        if (slot.state != SLOT_USED || (slot.device == identity.device && slot.inode == identity.inode)) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t HashCache::checksum(const Slot& slot, const std::string& digests) {
+    uint32_t hash = 2166136261u;
+    fnv1a(hash, &slot.device, sizeof(slot.device));
+    fnv1a(hash, &slot.inode, sizeof(slot.inode));
+    fnv1a(hash, &slot.size, sizeof(slot.size));
+    fnv1a(hash, &slot.mtime_ns, sizeof(slot.mtime_ns));
+    fnv1a(hash, &slot.chunk_size, sizeof(slot.chunk_size));
+    fnv1a(hash, &slot.chunk_count, sizeof(slot.chunk_count));
+    fnv1a(hash, digests.data(), digests.size());
+    return hash;
+}
+
+bool HashCache::map_index() {
+    int fd = ::open(index_path().c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat index_stat;
+    struct stat data_stat;
+    if (fstat(fd, &index_stat) != 0 || fstat(data_fd_, &data_stat) != 0 ||
+        static_cast<uint64_t>(index_stat.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(index_stat.st_size);
+    void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const Header* mapped = static_cast<const Header*>(map);
+    uint32_t capacity = mapped->capacity;
+    bool valid = mapped->magic == INDEX_MAGIC && mapped->version == INDEX_VERSION &&
+                 capacity > 0 && (capacity & (capacity - 1)) == 0 && capacity <= MAX_CAPACITY &&
+                 mapped->count <= capacity &&
+                 size == sizeof(Header) + static_cast<size_t>(capacity) * sizeof(Slot) &&
+                 mapped->data_size <= static_cast<uint64_t>(data_stat.st_size);
+    if (!valid) {
+        LOG_TRANSFER_WARN() << "Discarding unreadable hash cache " << index_path();
+        munmap(map, size);
+        return false;
+    }
+
+    map_ = map;
+    map_size_ = size;
+    return true;
+}
+
+void HashCache::release() {
+    if (map_) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+    if (data_fd_ >= 0) {
+        ::close(data_fd_);
+        data_fd_ = -1;
+    }
+    if (lock_fd_ >= 0) {
+        ::close(lock_fd_);
+        lock_fd_ = -1;
+    }
+}
+
+bool HashCache::rebuild(uint32_t capacity, size_t keep, uint32_t oldest) {
+    std::vector<Slot> live;
+    if (map_) {
+        for (uint32_t i = 0; i < header()->capacity; ++i) {
+            const Slot& slot = slots()[i];
+            if (slot.state == SLOT_USED && slot.last_used >= oldest) {
+                live.push_back(slot);
+            }
+        }
+    }
+    std::sort(live.begin(), live.end(), [](const Slot& a, const Slot& b) { return a.last_used > b.last_used; });
+    if (live.size() > keep) {
+        live.resize(keep);
+    }
+
+    std::string data_temp = data_path() + ".tmp";
+    std::string index_temp = index_path() + ".tmp";
+    int data_fd = ::open(data_temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (data_fd < 0) {
+        return false;
+    }
+
+    std::vector<char> index(sizeof(Header) + static_cast<size_t>(capacity) * sizeof(Slot), 0);
+    Header* new_header = reinterpret_cast<Header*>(index.data());
+    Slot* new_slots = reinterpret_cast<Slot*>(index.data() + sizeof(Header));
+    new_header->magic = INDEX_MAGIC;
+    new_header->version = INDEX_VERSION;
+    new_header->capacity = capacity;
+
+    // Copy the surviving digests over back to back; damaged entries are dropped
+    std::string digests;
+    bool ok = true;
+    for (const Slot& slot : live) {
+        if (slot.chunk_count > MAX_HASH_CHUNKS) {
+            continue;
+        }
+        digests.resize(static_cast<size_t>(slot.chunk_count) * HASH_DIGEST_SIZE);
+        if (!utils::pread_all(data_fd_, &digests[0], digests.size(), slot.data_offset) ||
+            checksum(slot, digests) != slot.checksum) {
+            continue;
+        }
+        if (!utils::pwrite_all(data_fd, digests.data(), digests.size(), new_header->data_size)) {
+            ok = false;
+            break;
+        }
+
+        FileIdentity identity;
+        identity.device = slot.device;
+        identity.inode = slot.inode;
+        Slot* target = find_slot(new_slots, capacity, identity);
+        *target = slot;
+        target->data_offset = new_header->data_size;
+        new_header->data_size += digests.size();
+        new_header->count++;
+    }
+
+    if (ok) {
+        int index_fd = ::open(index_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ok = index_fd >= 0 && utils::write_all(index_fd, index.data(), index.size());
+        if (index_fd >= 0) {
+            ::close(index_fd);
+        }
+    }
+    // Data before index; a crash in between leaves slots whose checksums fail
+    if (!ok || std::rename(data_temp.c_str(), data_path().c_str()) != 0 ||
+        std::rename(index_temp.c_str(), index_path().c_str()) != 0) {
+        LOG_TRANSFER_WARN() << "Cannot rewrite hash cache in " << directory_;
+        ::close(data_fd);
+        std::remove(data_temp.c_str());
+        std::remove(index_temp.c_str());
+        return false;
+    }
+
+    if (map_) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+    if (data_fd_ >= 0) {
+        ::close(data_fd_);
+    }
+    data_fd_ = data_fd;
+    return map_index();
+}
+
+std::string HashCache::index_path() const {
+    return directory_ + "/hash_cache.idx";
+}
+
+std::string HashCache::data_path() const {
+    return directory_ + "/hash_cache.dat";
+}
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include "tree_hash.h"
+
+namespace warpdeck {
+
+// Identifies one version of a file's contents without reading it
+struct FileIdentity {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+
+    bool operator==(const FileIdentity& other) const;
+    bool operator!=(const FileIdentity& other) const;
+};
+
+// Persistent cache of tree hashes, so files that did not change since they
+// were last sent are not read again.
+//
+// hash_cache.idx is a memory-mapped open-addressing table of fixed-size slots
+// keyed on (device, inode). A slot also records size and mtime; when those no
+// longer match the file it is a miss, and the next store overwrites it. The
+// leaf digests live in hash_cache.dat, appended raw. Each slot carries a
+// checksum over its key and digests, so a torn write reads back as a miss.
+//
+// Entries unused for MAX_AGE are dropped, and the data file compacted, when
+// the cache is opened. A full table or data file keeps its most recently used
+// half. The cache belongs to one process at a time (hash_cache.lock).
+class HashCache {
+public:
+    static constexpr uint32_t INITIAL_CAPACITY = 4096;
+    static constexpr uint32_t MAX_CAPACITY = 65536;
+    static constexpr uint64_t MAX_DATA_SIZE = 256ULL * 1024 * 1024;
+    static constexpr std::chrono::hours MAX_AGE{90 * 24};
+    // mtimes this recent may not yet reflect a write in progress
+    static constexpr std::chrono::seconds MTIME_SETTLE_TIME{2};
+
+    HashCache();
+    ~HashCache();
+
+    HashCache(const HashCache&) = delete;
+    HashCache& operator=(const HashCache&) = delete;
+
+    // Opens (or creates) the cache files in `directory`
+    bool open(const std::string& directory);
+    void close();
+
+    // Both are no-ops on a cache that is not open
+    bool lookup(const FileIdentity& identity, TreeHash& hash);
+    void store(const FileIdentity& identity, const TreeHash& hash);
+
+    static bool identify(const std::string& path, FileIdentity& identity);
+
+private:
+    struct Header;
+    struct Slot;
+
+    Header* header() const;
+    Slot* slots() const;
+    // The slot holding `identity`'s file, or the empty slot it would go in;
+    // nullptr only if the table is somehow full
+    static Slot* find_slot(Slot* table, uint32_t capacity, const FileIdentity& identity);
+    static uint32_t checksum(const Slot& slot, const std::string& digests);
+
+    bool map_index();
+    void release();
+    // Rewrites both files with at most `keep` of the most recently used
+    // entries that were used at or after `oldest`
+    bool rebuild(uint32_t capacity, size_t keep, uint32_t oldest);
+
+    std::string index_path() const;
+    std::string data_path() const;
+
+    std::mutex mutex_;
+    std::string directory_;
+    int lock_fd_;
+    int data_fd_;
+    void* map_;
+    size_t map_size_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "multi_stream_uploader.h"
+#include "logger.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+
+namespace warpdeck {
+
+namespace {
+
+struct Region {
+    uint64_t offset;
+    uint64_t length;
+    int attempts;
+};
+
+struct Stream {
+    std::thread thread;
+    std::atomic<uint64_t> bytes_sent{0};
+    uint64_t sampled_bytes = 0;
+};
+
+} // namespace
+
+MultiStreamUploader::MultiStreamUploader(APIClient& api_client, const std::string& host, int port,
+                                         const std::string& expected_fingerprint, bool bulk_io,
+                                         TransferCompressor* compressor)
+    : api_client_(api_client), host_(host), port_(port), expected_fingerprint_(expected_fingerprint),
+      bulk_io_(bulk_io), compressor_(compressor) {}
+
+APIResponse MultiStreamUploader::upload(const std::string& transfer_id, int file_index,
+                                        const std::string& file_path, uint64_t file_size, uint64_t alignment,
+                                        ProgressCallback progress_callback, StatsCallback stats_callback) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Region> pending;
+    int in_flight = 0;
+    bool failed = false;
+    std::string error_message;
+    std::atomic<bool> aborted{false};
+    std::atomic<uint64_t> total_sent{0};
+
+    uint64_t region_size = REGION_SIZE;
+    if (alignment > 0) {
+        region_size = (REGION_SIZE + alignment - 1) / alignment * alignment;
+    }
+    for (uint64_t offset = 0; offset < file_size; offset += region_size) {
+        pending.push_back({offset, std::min(region_size, file_size - offset), 0});
+    }
+
+    auto stream_worker = [&](Stream& stream) {
+        while (true) {
+            Region region;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // Stay around while regions are in flight elsewhere, they may be requeued
+                cv.wait(lock, [&]() { return !pending.empty() || in_flight == 0 || failed || aborted; });
+                if (pending.empty() || failed || aborted) {
+                    return;
+                }
+                region = pending.front();
+                pending.pop_front();
+                ++in_flight;
+            }
+
+            uint64_t region_sent = 0;
+            APIResponse response = api_client_.upload_file_range(
+                host_, port_, expected_fingerprint_, transfer_id, file_index, file_path,
+                region.offset, region.length, bulk_io_, compressor_,
+                [&](uint64_t bytes_sent) {
+                    uint64_t delta = bytes_sent - region_sent;
+                    region_sent = bytes_sent;
+                    stream.bytes_sent += delta;
+                    if (progress_callback && !progress_callback(total_sent += delta)) {
+                        aborted = true;
+                        return false;
+                    }
+                    return true;
+                });
+
+            std::lock_guard<std::mutex> lock(mutex);
+            --in_flight;
+            if (!response.success) {
+                // The receiver discards partial chunks, so the whole region goes again
+                total_sent -= region_sent;
+                stream.bytes_sent -= region_sent;
+
+                if (!aborted) {
+                    if (++region.attempts >= MAX_REGION_ATTEMPTS) {
+                        failed = true;
+                        error_message = response.error_message;
+                    } else {
+                        LOG_TRANSFER_WARN() << "Region at " << region.offset << " of " << file_path
+                                            << " failed (" << response.error_message << "), retrying";
+                        pending.push_back(region);
+                    }
+                }
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::unique_ptr<Stream>> streams;
+    auto add_stream = [&]() {
+        streams.push_back(std::make_unique<Stream>());
+        Stream& stream = *streams.back();
+        stream.thread = std::thread(stream_worker, std::ref(stream));
+    };
+
+    add_stream();
+
+    // Probe for the best stream count: keep adding streams while each addition
+    // raises the aggregate throughput by at least MIN_THROUGHPUT_GAIN
+    double best_throughput = 0.0;
+    bool growing = true;
+    auto last_sample = std::chrono::steady_clock::now();
+
+    while (true) {
+        bool has_pending;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bool done = cv.wait_for(lock, SAMPLE_INTERVAL, [&]() {
+                return (pending.empty() && in_flight == 0) || failed || aborted;
+            });
+            if (done) {
+                break;
+            }
+            has_pending = !pending.empty();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last_sample).count();
+        last_sample = now;
+
+        std::vector<StreamStats> stats;
+        double aggregate = 0.0;
+        for (size_t i = 0; i < streams.size(); ++i) {
+            uint64_t bytes = streams[i]->bytes_sent;
+            double rate = seconds > 0 && bytes > streams[i]->sampled_bytes ?
+                (bytes - streams[i]->sampled_bytes) / seconds : 0.0;
+            streams[i]->sampled_bytes = bytes;
+            stats.push_back({static_cast<int>(i), bytes, rate});
+            aggregate += rate;
+        }
+
+        if (stats_callback) {
+            stats_callback(stats);
+        }
+
+        if (growing && has_pending && static_cast<int>(streams.size()) < MAX_STREAMS) {
+            if (aggregate > best_throughput * (1.0 + MIN_THROUGHPUT_GAIN)) {
+                best_throughput = aggregate;
+                add_stream();
+            } else {
+                growing = false;
+                LOG_TRANSFER_DEBUG() << "Settled on " << streams.size() << " stream(s) for " << file_path
+                                     << " at " << static_cast<uint64_t>(aggregate) << " B/s";
+            }
+        }
+    }
+
+    for (auto& stream : streams) {
+        stream->thread.join();
+    }
+
+    APIResponse response;
+    response.status_code = failed || aborted ? 0 : 200;
+    response.success = !failed && !aborted;
+    if (aborted) {
+        response.error_message = "Upload aborted";
+    } else if (failed) {
+        response.error_message = error_message;
+    }
+    return response;
+}
+
+} // namespace warpdeck
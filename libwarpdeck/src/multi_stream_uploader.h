@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include "api_client.h"
+
+namespace warpdeck {
+
+struct StreamStats {
+    int stream_index;
+    uint64_t bytes_sent;
+    double bytes_per_second; // measured over the last sample interval
+};
+
+// Uploads one large file over several parallel connections. The file is cut
+// into fixed-size regions that the streams pull from a shared queue and send
+// to the offset-addressed chunk endpoint. Streams are added one at a time for
+// as long as the aggregate throughput keeps rising.
+class MultiStreamUploader {
+public:
+    // Called with the total bytes sent across all streams; return false to abort
+    using ProgressCallback = std::function<bool(uint64_t bytes_sent)>;
+    using StatsCallback = std::function<void(const std::vector<StreamStats>& streams)>;
+
+    static constexpr uint64_t REGION_SIZE = 16 * 1024 * 1024;
+    static constexpr int MAX_STREAMS = 6;
+    static constexpr int MAX_REGION_ATTEMPTS = 3;
+    static constexpr double MIN_THROUGHPUT_GAIN = 0.10;
+    static constexpr std::chrono::milliseconds SAMPLE_INTERVAL{1000};
+
+    // compressor may be null to send the file raw
+    MultiStreamUploader(APIClient& api_client, const std::string& host, int port,
+                        const std::string& expected_fingerprint, bool bulk_io,
+                        TransferCompressor* compressor);
+
+    // Regions are rounded up to a multiple of `alignment` (when non-zero), so
+    // each one carries whole hash chunks the receiver can check as they arrive
+    APIResponse upload(const std::string& transfer_id, int file_index,
+                       const std::string& file_path, uint64_t file_size, uint64_t alignment,
+                       ProgressCallback progress_callback, StatsCallback stats_callback);
+
+private:
+    APIClient& api_client_;
+    std::string host_;
+    int port_;
+    std::string expected_fingerprint_;
+    bool bulk_io_;
+    TransferCompressor* compressor_;
+};
+
+} // namespace warpdeck
@@ -0,0 +1,41 @@
+#include "token_bucket.h"
+#include <algorithm>
+
+namespace warpdeck {
+
+TokenBucket::TokenBucket() : rate_(0), burst_(0) {}
+
+void TokenBucket::set_rate(uint64_t bytes_per_second) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rate_ = bytes_per_second;
+    burst_ = std::chrono::nanoseconds(0);
+    if (rate_ > 0) {
+        // Small bursts keep the pacing smooth; the floor keeps a low rate from
+        // splitting every read into waits
+        burst_ = std::max<std::chrono::nanoseconds>(
+            BURST, std::chrono::nanoseconds(MIN_BURST_BYTES * 1000000000 / rate_));
+    }
+    full_at_ = std::chrono::steady_clock::now();
+}
+
+uint64_t TokenBucket::rate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rate_;
+}
+
+std::chrono::nanoseconds TokenBucket::take(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (rate_ == 0 || bytes == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    // Time the bytes take at the rate, added to when the bucket would be full
+    auto now = std::chrono::steady_clock::now();
+    double cost = static_cast<double>(bytes) * 1e9 / static_cast<double>(rate_);
+    full_at_ = std::max(full_at_, now) + std::chrono::nanoseconds(static_cast<int64_t>(cost));
+
+    auto debt = full_at_ - now - burst_;
+    return std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(debt), std::chrono::nanoseconds(0));
+}
+
+} // namespace warpdeck
\ No newline at end of file
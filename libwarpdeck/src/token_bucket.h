@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+
+namespace warpdeck {
+
+// Byte-rate limit for transfer traffic. The bucket holds BURST worth of the
+// rate (at least MIN_BURST_BYTES) and refills continuously; a caller takes
+// the bytes it moved and may overdraw, then waits out the debt. The bucket is
+// kept as the time it will be full again rather than a token count, so taking
+// from it is a couple of arithmetic operations under the lock, and callers
+// taking small pieces are spaced evenly instead of in bursts.
+class TokenBucket {
+public:
+    static constexpr std::chrono::milliseconds BURST{20};
+    static constexpr uint64_t MIN_BURST_BYTES = 64 * 1024;
+
+    TokenBucket();
+
+    TokenBucket(const TokenBucket&) = delete;
+    TokenBucket& operator=(const TokenBucket&) = delete;
+
+    // 0 lifts the limit; a new rate starts with a full bucket
+    void set_rate(uint64_t bytes_per_second);
+    uint64_t rate() const;
+
+    // Takes `bytes` and returns how long the caller should wait before moving
+    // more; zero while the bucket still covers them
+    std::chrono::nanoseconds take(uint64_t bytes);
+
+private:
+    mutable std::mutex mutex_;
+    uint64_t rate_;
+    std::chrono::nanoseconds burst_;
+    std::chrono::steady_clock::time_point full_at_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
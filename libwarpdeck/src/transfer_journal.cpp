@@ -0,0 +1,260 @@
+#include "transfer_journal.h"
+#include "utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace warpdeck {
+
+RangeSet::RangeSet() : covered_(0) {}
+
+void RangeSet::add(uint64_t offset, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+    uint64_t start = offset;
+    uint64_t end = offset + length;
+
+    // Absorb every range that overlaps or touches [start, end)
+    auto it = ranges_.upper_bound(start);
+    if (it != ranges_.begin()) {
+        auto previous = std::prev(it);
+        if (previous->second >= start) {
+            it = previous;
+        }
+    }
+    while (it != ranges_.end() && it->first <= end) {
+        start = std::min(start, it->first);
+        end = std::max(end, it->second);
+        covered_ -= it->second - it->first;
+        it = ranges_.erase(it);
+    }
+
+    ranges_[start] = end;
+    covered_ += end - start;
+}
+
+void RangeSet::remove(uint64_t offset, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+    uint64_t start = offset;
+    uint64_t end = offset + length;
+
+    // Trim every range that overlaps [start, end), keeping what sticks out
+    auto it = ranges_.upper_bound(start);
+    if (it != ranges_.begin()) {
+        auto previous = std::prev(it);
+        if (previous->second > start) {
+            it = previous;
+        }
+    }
+    while (it != ranges_.end() && it->first < end) {
+        uint64_t range_start = it->first;
+        uint64_t range_end = it->second;
+        covered_ -= range_end - range_start;
+        it = ranges_.erase(it);
+        if (range_start < start) {
+            ranges_[range_start] = start;
+            covered_ += start - range_start;
+        }
+        if (range_end > end) {
+            ranges_[end] = range_end;
+            covered_ += range_end - end;
+            break;
+        }
+    }
+}
+
+void RangeSet::clear() {
+    ranges_.clear();
+    covered_ = 0;
+}
+
+uint64_t RangeSet::covered() const {
+    return covered_;
+}
+
+uint64_t RangeSet::contiguous_prefix() const {
+    if (ranges_.empty() || ranges_.begin()->first != 0) {
+        return 0;
+    }
+    return ranges_.begin()->second;
+}
+
+std::vector<RangeSet::Range> RangeSet::missing(uint64_t size) const {
+    std::vector<Range> gaps;
+    uint64_t position = 0;
+    for (const auto& [start, end] : ranges_) {
+        if (start >= size) {
+            break;
+        }
+        if (start > position) {
+            gaps.emplace_back(position, start - position);
+        }
+        position = std::max(position, end);
+    }
+    if (position < size) {
+        gaps.emplace_back(position, size - position);
+    }
+    return gaps;
+}
+
+TransferJournal::TransferJournal() : fd_(-1) {}
+
+TransferJournal::~TransferJournal() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool TransferJournal::create(const std::string& path, const std::string& header) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string line = header + "\n";
+    if (!utils::write_all(fd, line.data(), line.size())) {
+        ::close(fd);
+        std::remove(path.c_str());
+        return false;
+    }
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = fd;
+    path_ = path;
+    return true;
+}
+
+bool TransferJournal::reopen(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Cut off a torn record so new ones stay aligned
+    std::string header;
+    std::vector<Record> records;
+    std::vector<Page> pages;
+    size_t length = 0;
+    if (!parse(path, header, records, pages, length) || ftruncate(fd, static_cast<off_t>(length)) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = fd;
+    path_ = path;
+    return true;
+}
+
+bool TransferJournal::append_range(uint32_t file_index, uint64_t offset, uint64_t length) {
+    char record[JOURNAL_RECORD_SIZE];
+    for (int i = 0; i < 4; ++i) {
+        record[i] = static_cast<char>(file_index >> (24 - 8 * i));
+    }
+    for (int i = 0; i < 8; ++i) {
+        record[4 + i] = static_cast<char>(offset >> (56 - 8 * i));
+        record[12 + i] = static_cast<char>(length >> (56 - 8 * i));
+    }
+    return append(std::string(record, sizeof(record)));
+}
+
+bool TransferJournal::append_page(uint64_t first_file, const std::string& json) {
+    char record[JOURNAL_RECORD_SIZE];
+    uint64_t length = json.size();
+    for (int i = 0; i < 4; ++i) {
+        record[i] = static_cast<char>(JOURNAL_PAGE_RECORD >> (24 - 8 * i));
+    }
+    for (int i = 0; i < 8; ++i) {
+        record[4 + i] = static_cast<char>(first_file >> (56 - 8 * i));
+        record[12 + i] = static_cast<char>(length >> (56 - 8 * i));
+    }
+    return append(std::string(record, sizeof(record)) + json);
+}
+
+bool TransferJournal::append(const std::string& data) {
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // One write per record: O_APPEND keeps concurrent appends from interleaving
+    ssize_t written = ::write(fd_, data.data(), data.size());
+    if (written != static_cast<ssize_t>(data.size())) {
+        LOG_TRANSFER_WARN() << "Cannot append to journal " << path_;
+        return false;
+    }
+    return true;
+}
+
+void TransferJournal::remove() {
+    // Uploads still holding the journal may append to the unlinked file until
+    // they let go; the descriptor is closed with the last reference
+    if (!path_.empty()) {
+        std::remove(path_.c_str());
+    }
+}
+
+const std::string& TransferJournal::path() const {
+    return path_;
+}
+
+bool TransferJournal::load(const std::string& path, std::string& header, std::vector<Record>& records,
+                           std::vector<Page>& pages) {
+    size_t length = 0;
+    return parse(path, header, records, pages, length);
+}
+
+bool TransferJournal::parse(const std::string& path, std::string& header, std::vector<Record>& records,
+                            std::vector<Page>& pages, size_t& length) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t newline = contents.find('\n');
+    if (newline == std::string::npos) {
+        return false;
+    }
+    header = contents.substr(0, newline);
+
+    records.clear();
+    pages.clear();
+    size_t position = newline + 1;
+    while (position + JOURNAL_RECORD_SIZE <= contents.size()) {
+        const char* data = contents.data() + position;
+        Record record = {0, 0, 0};
+        for (int i = 0; i < 4; ++i) {
+            record.file_index = (record.file_index << 8) | static_cast<uint8_t>(data[i]);
+        }
+        for (int i = 0; i < 8; ++i) {
+            record.offset = (record.offset << 8) | static_cast<uint8_t>(data[4 + i]);
+            record.length = (record.length << 8) | static_cast<uint8_t>(data[12 + i]);
+        }
+
+        if (record.file_index == JOURNAL_PAGE_RECORD) {
+            if (record.length > contents.size() - position - JOURNAL_RECORD_SIZE) {
+                break; // Torn page
+            }
+            pages.push_back({record.offset, contents.substr(position + JOURNAL_RECORD_SIZE, record.length)});
+            position += JOURNAL_RECORD_SIZE + record.length;
+        } else {
+            records.push_back(record);
+            position += JOURNAL_RECORD_SIZE;
+        }
+    }
+    length = position;
+    return true;
+}
+
+} // namespace warpdeck
\ No newline at end of file
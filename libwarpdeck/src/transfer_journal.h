@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace warpdeck {
+
+// A journal is one JSON header line describing the transfer followed by
+// fixed-size records [u32 file_index][u64 offset][u64 length] (big-endian),
+// one per byte range that was written to its temp file. A record whose
+// file_index is JOURNAL_PAGE_RECORD instead adds a manifest page: offset is
+// the index of its first file, and `length` bytes of page JSON follow.
+constexpr size_t JOURNAL_RECORD_SIZE = 20;
+constexpr uint32_t JOURNAL_PAGE_RECORD = 0xffffffff;
+
+// Byte ranges of one file, kept sorted and merged
+class RangeSet {
+public:
+    using Range = std::pair<uint64_t, uint64_t>; // (offset, length)
+
+    RangeSet();
+
+    void add(uint64_t offset, uint64_t length);
+    void remove(uint64_t offset, uint64_t length);
+    void clear();
+
+    uint64_t covered() const;
+    // End of the range that starts at offset 0, or 0 if there is none
+    uint64_t contiguous_prefix() const;
+    // The parts of [0, size) that are not covered
+    std::vector<Range> missing(uint64_t size) const;
+
+private:
+    std::map<uint64_t, uint64_t> ranges_; // start -> end
+    uint64_t covered_;
+};
+
+// Append-only on-disk record of the ranges a receive has written, so an
+// interrupted transfer can continue where it stopped. Records are appended
+// with O_APPEND in a single write each, so concurrent uploads of the same
+// transfer need no lock around append_range.
+class TransferJournal {
+public:
+    struct Record {
+        uint32_t file_index;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    struct Page {
+        uint64_t first_file;
+        std::string json; // see utils::manifest_page_to_json
+    };
+
+    TransferJournal();
+    ~TransferJournal();
+
+    TransferJournal(const TransferJournal&) = delete;
+    TransferJournal& operator=(const TransferJournal&) = delete;
+
+    // Starts a new journal at `path`, replacing any old one
+    bool create(const std::string& path, const std::string& header);
+    // Reopens an existing journal for appending
+    bool reopen(const std::string& path);
+    bool append_range(uint32_t file_index, uint64_t offset, uint64_t length);
+    bool append_page(uint64_t first_file, const std::string& json);
+    // Deletes the journal file
+    void remove();
+
+    const std::string& path() const;
+
+    // Reads a journal back; a torn record at the end is ignored
+    static bool load(const std::string& path, std::string& header, std::vector<Record>& records,
+                     std::vector<Page>& pages);
+
+private:
+    // Like load; `length` is where the last whole record ends
+    static bool parse(const std::string& path, std::string& header, std::vector<Record>& records,
+                      std::vector<Page>& pages, size_t& length);
+    bool append(const std::string& data);
+
+    int fd_;
+    std::string path_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
@@ -1,21 +1,171 @@
 #include "transfer_manager.h"
+#include "api_client.h"
 #include "utils.h"
-#include <fstream>
+#include "file_io.h"
+#include "delta.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <future>
 #include <iostream>
+#include <set>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace warpdeck {
 
-TransferManager::TransferManager() {
+namespace {
+
+// Received bytes are published to the progress callback in steps of this size
+constexpr uint64_t PROGRESS_REPORT_INTERVAL = 1024 * 1024;
+
+// Sleeps for `duration` in short steps; false if the transfer was cancelled meanwhile
+bool sleep_unless_cancelled(const std::atomic<bool>& cancelled, std::chrono::seconds duration) {
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    while (!cancelled && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return !cancelled;
+}
+
+// Names a mirror sync keeps once it completes; empty unless it deletes extras
+std::vector<std::string> mirrored_names(const TransferInfo& info) {
+    std::vector<std::string> names;
+    if (info.delete_extras) {
+        names.reserve(info.files.size());
+        for (const auto& file : info.files) {
+            names.push_back(file.name);
+        }
+    }
+    return names;
+}
+
+// The manifest index of the file whose content files[i] repeats, where files
+// starts at first_file; -1 unless that is an earlier one of files with the
+// same size and hash
+int64_t duplicate_source(const std::vector<FileMetadata>& files, uint64_t first_file, size_t i) {
+    int64_t source = files[i].duplicate_of;
+    if (source < 0 || static_cast<uint64_t>(source) < first_file ||
+        static_cast<uint64_t>(source) >= first_file + i) {
+        return -1;
+    }
+    const FileMetadata& original = files[static_cast<size_t>(source - first_file)];
+    bool same = !files[i].hash.empty() && original.hash == files[i].hash && original.size == files[i].size;
+    return same ? source : -1;
+}
+
+// End of the manifest page starting at `begin`: at most MANIFEST_PAGE_FILES files
+// and MANIFEST_PAGE_CHUNKS leaf hashes, but never empty
+size_t manifest_page_end(const std::vector<FileMetadata>& files, size_t begin) {
+    size_t end = begin;
+    uint64_t chunks = 0;
+    while (end < files.size() && end - begin < MANIFEST_PAGE_FILES) {
+        uint64_t size = files[end].size;
+        uint64_t file_chunks = hash_chunk_count(size, hash_chunk_size(size));
+        if (end > begin && chunks + file_chunks > MANIFEST_PAGE_CHUNKS) {
+            break;
+        }
+        chunks += file_chunks;
+        ++end;
+    }
+    return end;
+}
+
+} // namespace
+
+TransferManager::TransferManager()
+    : upload_pool_(std::make_unique<WorkerPool>(UPLOAD_WORKER_COUNT)),
+      hasher_(std::make_unique<TreeHasher>(std::max(1u, std::thread::hardware_concurrency()))),
+      walker_(std::make_unique<DirectoryWalker>(DIRECTORY_WALK_THREADS)),
+      chunk_store_pool_(std::make_unique<WorkerPool>(1)),
+      api_client_(nullptr) {
     download_folder_ = utils::get_default_download_dir();
 }
 
-TransferManager::~TransferManager() {}
+TransferManager::~TransferManager() {
+    {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        for (auto& [transfer_id, state] : transfers_) {
+            if (state->outgoing) {
+                state->outgoing->cancelled = true;
+            }
+        }
+    }
+    
+    // A sender takes the lock to report that it finished, so it is joined without it
+    std::map<std::string, std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(sender_threads_mutex_);
+        threads.swap(sender_threads_);
+    }
+    for (auto& [transfer_id, thread] : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
 
 void TransferManager::set_download_folder(const std::string& folder) {
     download_folder_ = folder;
 }
 
+void TransferManager::set_device_id(const std::string& device_id) {
+    device_id_ = device_id;
+}
+
+bool TransferManager::open_hash_cache(const std::string& directory) {
+    return hash_cache_.open(directory);
+}
+
+bool TransferManager::set_chunk_store(const std::string& directory, uint64_t max_size) {
+    return chunk_store_.open(directory, max_size);
+}
+
+void TransferManager::set_hardlink_duplicates(bool allow) {
+    hardlink_duplicates_ = allow;
+}
+
+void TransferManager::set_bandwidth_limit(uint64_t bytes_per_second) {
+    bandwidth_limit_.set_rate(bytes_per_second);
+    ++limits_version_;
+    LOG_TRANSFER_INFO() << "Bandwidth limit set to " << bytes_per_second << " B/s (0 is none)";
+}
+
+void TransferManager::set_peer_bandwidth_limit(const std::string& peer_device_id, uint64_t bytes_per_second) {
+    {
+        std::lock_guard<std::mutex> lock(peer_limits_mutex_);
+        if (bytes_per_second == 0) {
+            peer_limits_.erase(peer_device_id);
+        } else {
+            std::shared_ptr<TokenBucket>& limit = peer_limits_[peer_device_id];
+            if (!limit) {
+                limit = std::make_shared<TokenBucket>();
+            }
+            limit->set_rate(bytes_per_second);
+        }
+    }
+    ++limits_version_;
+    LOG_TRANSFER_INFO() << "Bandwidth limit for peer " << peer_device_id << " set to " << bytes_per_second
+                        << " B/s (0 is none)";
+}
+
+bool TransferManager::set_transfer_bandwidth_limit(const std::string& transfer_id, uint64_t bytes_per_second) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return false;
+    }
+    state->bandwidth_limit.set_rate(bytes_per_second);
+    ++limits_version_;
+    LOG_TRANSFER_INFO() << "Bandwidth limit for transfer " << transfer_id << " set to " << bytes_per_second
+                        << " B/s (0 is none)";
+    return true;
+}
+
 void TransferManager::set_progress_callback(ProgressCallback callback) {
     progress_callback_ = callback;
 }
@@ -28,11 +178,37 @@ void TransferManager::set_incoming_request_callback(IncomingRequestCallback call
     incoming_request_callback_ = callback;
 }
 
+void TransferManager::set_api_client(APIClient* api_client) {
+    api_client_ = api_client;
+}
+
+void TransferManager::set_stream_stats_callback(StreamStatsCallback callback) {
+    stream_stats_callback_ = callback;
+}
+
 std::string TransferManager::initiate_transfer(const std::string& peer_device_id, const std::string& peer_name,
-                                              const std::vector<std::string>& file_paths) {
+                                              const std::string& peer_host, int peer_port,
+                                              const std::string& peer_fingerprint,
+                                              const std::vector<std::string>& file_paths,
+                                              BulkIOMode bulk_io_mode, bool allow_compression,
+                                              SyncMode sync_mode) {
+    if (!api_client_) {
+        return "";
+    }
+    
     std::string transfer_id = generate_transfer_id();
     
-    TransferInfo transfer;
+    auto outgoing = std::make_shared<OutgoingTransfer>();
+    outgoing->peer_host = peer_host;
+    outgoing->peer_port = peer_port;
+    outgoing->peer_fingerprint = peer_fingerprint;
+    outgoing->compression = allow_compression;
+    
+    auto state = std::make_shared<TransferState>();
+    state->outgoing = outgoing;
+    state->limit_peer_id = peer_device_id;
+    
+    TransferInfo& transfer = state->info;
     transfer.transfer_id = transfer_id;
     transfer.peer_device_id = peer_device_id;
     transfer.peer_name = peer_name;
@@ -40,286 +216,2549 @@ std::string TransferManager::initiate_transfer(const std::string& peer_device_id
     transfer.status = TransferStatus::PENDING_APPROVAL;
     transfer.total_bytes = 0;
     transfer.transferred_bytes = 0;
+    transfer.completed_files = 0;
+    transfer.bulk_io = false;
+    transfer.sync = sync_mode != SyncMode::COPY;
+    transfer.delete_extras = sync_mode == SyncMode::MIRROR;
     
-    // Build file metadata
-    for (const auto& file_path : file_paths) {
-        if (!utils::file_exists(file_path)) {
-            continue;
-        }
-        
+    // Build file metadata; directories contribute every file under them, named
+    // by their path relative to the directory's parent
+    std::vector<WalkEntry> entries;
+    if (!walker_->walk(file_paths, MAX_MANIFEST_FILES, entries)) {
+        LOG_TRANSFER_ERROR() << "Cannot send more than " << MAX_MANIFEST_FILES << " files in one transfer";
+        return "";
+    }
+    for (auto& entry : entries) {
         FileMetadata file_meta;
-        file_meta.name = utils::get_filename(file_path);
-        file_meta.size = utils::get_file_size(file_path);
-        file_meta.hash = utils::calculate_file_hash(file_path);
+        file_meta.name = entry.relative_path;
+        file_meta.size = entry.identity.size;
+        if (transfer.sync) {
+            file_meta.mtime_ns = entry.identity.mtime_ns;
+        }
         
         transfer.files.push_back(file_meta);
         transfer.total_bytes += file_meta.size;
+        outgoing->source_paths.push_back(std::move(entry.path));
+        outgoing->identities.push_back(entry.identity);
     }
     
     if (transfer.files.empty()) {
         return ""; // No valid files
     }
     
+    transfer.file_count = transfer.files.size();
+    transfer.bulk_io = bulk_io_mode == BulkIOMode::ENABLED ||
+                       (bulk_io_mode == BulkIOMode::AUTO && transfer.total_bytes >= BULK_IO_THRESHOLD);
+    outgoing->bulk_io = transfer.bulk_io;
+    state->file_progress.assign(transfer.files.size(), 0);
+    
     {
         std::lock_guard<std::mutex> lock(transfers_mutex_);
-        active_transfers_[transfer_id] = transfer;
+        transfers_[transfer_id] = state;
+    }
+    
+    // Threads of sends that ended since the last one are joined here, so
+    // they don't pile up for as long as the manager lives
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> lock(sender_threads_mutex_);
+        for (const auto& finished_id : finished_senders_) {
+            auto it = sender_threads_.find(finished_id);
+            if (it != sender_threads_.end()) {
+                finished.push_back(std::move(it->second));
+                sender_threads_.erase(it);
+            }
+        }
+        finished_senders_.clear();
+        
+        sender_threads_[transfer_id] = std::thread([this, transfer_id, state]() {
+            run_outgoing_transfer(transfer_id, state);
+            std::lock_guard<std::mutex> lock(sender_threads_mutex_);
+            finished_senders_.push_back(transfer_id);
+        });
+    }
+    for (auto& thread : finished) {
+        thread.join();
     }
     
     return transfer_id;
 }
 
+bool TransferManager::hash_outgoing_files(TransferState& state, size_t begin, size_t end) {
+    const OutgoingTransfer& outgoing = *state.outgoing;
+    
+    // Files unchanged since an earlier send keep their cached hashes; the rest
+    // are hashed chunk by chunk in parallel. The receiver checks chunks against these.
+    std::vector<TreeHash> hashes(end - begin);
+    std::vector<size_t> unhashed;
+    std::vector<std::string> unhashed_paths;
+    std::vector<uint64_t> unhashed_sizes;
+    for (size_t i = begin; i < end; ++i) {
+        if (!hash_cache_.lookup(outgoing.identities[i], hashes[i - begin])) {
+            unhashed.push_back(i);
+            unhashed_paths.push_back(outgoing.source_paths[i]);
+            unhashed_sizes.push_back(outgoing.identities[i].size);
+        }
+    }
+    
+    if (!unhashed.empty()) {
+        std::vector<TreeHash> computed;
+        if (!hasher_->hash_files(unhashed_paths, unhashed_sizes, outgoing.bulk_io, computed)) {
+            return false;
+        }
+        for (size_t j = 0; j < unhashed.size(); ++j) {
+            size_t i = unhashed[j];
+            hashes[i - begin] = std::move(computed[j]);
+            
+            // Don't cache a hash of a file that changed while it was being read
+            FileIdentity after;
+            if (HashCache::identify(unhashed_paths[j], after) && after == outgoing.identities[i]) {
+                hash_cache_.store(outgoing.identities[i], hashes[i - begin]);
+            }
+        }
+        LOG_TRANSFER_DEBUG() << "Hashed " << unhashed.size() << " of " << end - begin << " files";
+    }
+    
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (size_t i = begin; i < end; ++i) {
+        FileMetadata& file = state.info.files[i];
+        file.hash = hashes[i - begin].root;
+        file.chunk_size = hashes[i - begin].chunk_size;
+        file.chunk_hashes = std::move(hashes[i - begin].chunk_hashes);
+        
+        // Content already seen in this transfer crosses the wire once; the
+        // receiver copies the earlier file for the others
+        if (file.size > 0 && !file.hash.empty()) {
+            auto [first, inserted] = state.outgoing->content_files.emplace(file.hash, i);
+            if (!inserted && state.info.files[first->second].size == file.size) {
+                file.duplicate_of = static_cast<int64_t>(first->second);
+            }
+        }
+    }
+    return true;
+}
+
+bool TransferManager::send_manifest(const OutgoingTransfer& outgoing, const std::string& remote_transfer_id,
+                                    const std::vector<FileMetadata>& files, size_t begin,
+                                    std::string& error_message) {
+    while (begin < files.size() && !outgoing.cancelled) {
+        size_t end = manifest_page_end(files, begin);
+        APIResponse response = api_client_->send_manifest_page(outgoing.peer_host, outgoing.peer_port,
+                                                               outgoing.peer_fingerprint, remote_transfer_id,
+                                                               files, begin, end);
+        if (!response.success) {
+            error_message = "Failed to send file list: " + response.error_message;
+            return false;
+        }
+        begin = end;
+    }
+    return !outgoing.cancelled;
+}
+
 std::string TransferManager::handle_incoming_request(const std::string& peer_device_id, const std::string& peer_name,
                                                     const TransferRequest& request) {
     std::string transfer_id = generate_transfer_id();
     
-    TransferInfo transfer;
+    auto state = std::make_shared<TransferState>();
+    TransferInfo& transfer = state->info;
     transfer.transfer_id = transfer_id;
     transfer.peer_device_id = peer_device_id;
     transfer.peer_name = peer_name;
+    state->limit_peer_id = request.sender_device_id.empty() ? peer_device_id : request.sender_device_id;
     transfer.direction = TransferDirection::RECEIVING;
     transfer.status = TransferStatus::PENDING_APPROVAL;
     transfer.files = request.files;
+    transfer.file_count = std::max<uint64_t>(request.file_count, request.files.size());
     transfer.total_bytes = 0;
     transfer.transferred_bytes = 0;
+    transfer.completed_files = 0;
+    transfer.sync = request.sync;
+    transfer.delete_extras = request.delete_extras;
     transfer.destination_folder = download_folder_;
     
-    // Calculate total bytes
+    // Calculate total bytes; the rest of a paged manifest is only announced
     for (const auto& file : transfer.files) {
         transfer.total_bytes += file.size;
     }
+    if (transfer.file_count > transfer.files.size()) {
+        transfer.total_bytes = std::max(transfer.total_bytes, request.total_bytes);
+    }
+    
+    // The sender asks for bulk mode when it chose it explicitly
+    transfer.bulk_io = request.bulk_io || transfer.total_bytes >= BULK_IO_THRESHOLD;
+    state->file_progress.assign(transfer.files.size(), 0);
     
+    // A sender that restarted asks for the same files again; if an idle receive
+    // of exactly those files (hashes included) is still around, the request
+    // continues it instead of starting over. A paged manifest is matched on its
+    // first page and file count; the receive may already hold later pages.
+    bool resumed = false;
+    std::vector<std::shared_ptr<TransferState>> candidates;
     {
         std::lock_guard<std::mutex> lock(transfers_mutex_);
-        active_transfers_[transfer_id] = transfer;
+        for (const auto& [id, candidate] : transfers_) {
+            candidates.push_back(candidate);
+        }
+    }
+    for (const auto& candidate : candidates) {
+        std::lock_guard<std::mutex> lock(candidate->mutex);
+        const TransferInfo& existing = candidate->info;
+        bool idle = !candidate->rate.started ||
+                    std::chrono::steady_clock::now() - candidate->rate.progressed_at >= STALL_TIMEOUT;
+        bool same_files = existing.file_count == transfer.file_count &&
+            existing.sync == transfer.sync && existing.delete_extras == transfer.delete_extras &&
+            existing.files.size() >= request.files.size() &&
+            std::equal(request.files.begin(), request.files.end(), existing.files.begin(),
+                       [](const FileMetadata& a, const FileMetadata& b) {
+                           return !a.hash.empty() && a.name == b.name && a.size == b.size && a.hash == b.hash;
+                       });
+        if (candidate->finished || candidate->responding || candidate->extending || !idle || !same_files ||
+            existing.direction != TransferDirection::RECEIVING || existing.status != TransferStatus::APPROVED) {
+            continue;
+        }
+        
+        // Ask the user again; accepting keeps the data already received
+        candidate->info.status = TransferStatus::PENDING_APPROVAL;
+        candidate->info.peer_device_id = peer_device_id;
+        candidate->info.peer_name = peer_name;
+        candidate->limit_peer_id = state->limit_peer_id;
+        transfer_id = existing.transfer_id;
+        resumed = true;
+        break;
+    }
+    
+    if (resumed) {
+        LOG_TRANSFER_INFO() << "Request for " << transfer.file_count << " file(s) resumes transfer " << transfer_id;
+    } else {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        transfers_[transfer_id] = state;
     }
     
     // Notify UI about incoming request
     if (incoming_request_callback_) {
-        incoming_request_callback_(transfer_id, peer_name, transfer.files);
+        incoming_request_callback_(transfer_id, peer_name, request);
     }
     
     return transfer_id;
 }
 
 void TransferManager::respond_to_transfer(const std::string& transfer_id, bool accept) {
-    std::lock_guard<std::mutex> lock(transfers_mutex_);
-    auto it = active_transfers_.find(transfer_id);
-    if (it == active_transfers_.end()) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
         return;
     }
     
-    TransferInfo& transfer = it->second;
-    
-    if (accept) {
-        transfer.status = TransferStatus::APPROVED;
-        
-        // Create temporary files for receiving
-        if (transfer.direction == TransferDirection::RECEIVING) {
-            for (size_t i = 0; i < transfer.files.size(); ++i) {
-                create_temporary_file(transfer_id, static_cast<int>(i));
-            }
+    TransferInfo info;
+    std::vector<std::string> temp_paths;
+    bool resumed = false;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->finished || state->responding || state->info.status != TransferStatus::PENDING_APPROVAL) {
+            return;
         }
-    } else {
-        transfer.status = TransferStatus::CANCELLED;
-        cleanup_transfer(transfer_id);
         
+        if (!accept) {
+            state->info.status = TransferStatus::CANCELLED;
+            temp_paths = retire_transfer(*state); // Only a resumed receive has files already
+        } else if (!state->temp_paths.empty()) {
+            // Resumed receive: its files and journal are already in place
+            state->info.status = TransferStatus::APPROVED;
+            start_rate_meter(*state);
+            resumed = true;
+        } else {
+            state->responding = true;
+            info = state->info;
+        }
+    }
+    
+    if (!accept) {
+        state->response_cv.notify_all();
+        cleanup_transfer(transfer_id, temp_paths);
         if (completion_callback_) {
             completion_callback_(transfer_id, false, "Transfer declined");
         }
+        return;
     }
-}
-
-bool TransferManager::handle_file_upload(const std::string& transfer_id, int file_index, const std::vector<uint8_t>& data) {
-    std::lock_guard<std::mutex> lock(transfers_mutex_);
-    auto it = active_transfers_.find(transfer_id);
-    if (it == active_transfers_.end()) {
-        return false;
+    if (resumed) {
+        state->response_cv.notify_all();
+        return;
     }
     
-    TransferInfo& transfer = it->second;
+    // Create the (preallocated) temporary files and the journal without holding any lock.
+    // A sync needs none for files the destination already holds.
+    bool receiving = info.direction == TransferDirection::RECEIVING;
+    bool created = true;
+    std::shared_ptr<TransferJournal> journal;
+    std::vector<bool> unchanged(info.files.size(), false);
+    std::vector<std::vector<RangeSet::Range>> stored;
+    if (receiving && info.sync) {
+        unchanged = find_unchanged_files(info.destination_folder, info.files, info.bulk_io);
+    }
+    if (receiving) {
+        for (size_t i = 0; i < info.files.size(); ++i) {
+            if (unchanged[i]) {
+                temp_paths.push_back(temporary_file_path(transfer_id, static_cast<int>(i)));
+                continue;
+            }
+            std::string temp_path = create_temporary_file(transfer_id, static_cast<int>(i), info.files[i].size);
+            if (temp_path.empty()) {
+                created = false;
+                break;
+            }
+            temp_paths.push_back(temp_path);
+        }
+        if (created) {
+            fill_from_chunk_store(info.files, temp_paths, info.destination_folder, info.bulk_io, unchanged, stored);
+            place_page_duplicates(info.files, 0, temp_paths, info.destination_folder, info.bulk_io, unchanged, stored);
+        }
+        
+        // Without a journal the receive still works, it just can't outlive this process
+        if (created) {
+            journal = std::make_shared<TransferJournal>();
+            if (!journal->create(temporary_directory() + "/" + transfer_id + ".journal",
+                                 utils::transfer_journal_header_to_json(info))) {
+                LOG_TRANSFER_WARN() << "Cannot create journal for " << transfer_id << "; it won't survive a restart";
+                journal.reset();
+            }
+            // Files already in place are journaled as received and, having no temp file, as finalized
+            for (size_t i = 0; journal && i < unchanged.size(); ++i) {
+                if (unchanged[i]) {
+                    journal->append_range(static_cast<uint32_t>(i), 0, info.files[i].size);
+                }
+                for (const auto& [offset, length] : stored[i]) {
+                    journal->append_range(static_cast<uint32_t>(i), offset, length);
+                }
+            }
+        }
+    }
     
-    if (transfer.direction != TransferDirection::RECEIVING || 
-        transfer.status != TransferStatus::APPROVED ||
-        file_index >= static_cast<int>(transfer.files.size())) {
-        return false;
+    bool cancelled = false;
+    bool completed = false;
+    std::vector<std::string> names;
+    std::vector<std::pair<size_t, size_t>> duplicates;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->responding = false;
+        
+        if (state->finished) {
+            cancelled = true; // Cancelled or expired while the files were being created
+        } else if (created) {
+            state->received_ranges.assign(temp_paths.size(), RangeSet());
+            state->file_completed.assign(temp_paths.size(), false);
+            for (const auto& file : state->info.files) {
+                state->verified_chunks.emplace_back(file.chunk_hashes.size(), false);
+            }
+            state->temp_paths = std::move(temp_paths);
+            state->journal = journal;
+            state->info.status = TransferStatus::APPROVED;
+            start_rate_meter(*state);
+            
+            mark_stored_chunks(*state, 0, stored);
+            if (mark_unchanged_files(*state, 0, unchanged)) {
+                state->info.status = TransferStatus::COMPLETED;
+                names = mirrored_names(state->info);
+                temp_paths = retire_transfer(*state);
+                completed = true;
+            } else {
+                duplicates = claim_duplicates(*state, 0, unchanged);
+            }
+        } else {
+            state->info.status = TransferStatus::FAILED;
+            std::vector<std::string> retired = retire_transfer(*state);
+            temp_paths.insert(temp_paths.end(), retired.begin(), retired.end());
+        }
     }
+    state->response_cv.notify_all();
     
-    // Write data to temporary file
-    auto temp_it = temp_file_paths_.find(transfer_id);
-    if (temp_it == temp_file_paths_.end() || 
-        file_index >= static_cast<int>(temp_it->second.size())) {
+    if (completed) {
+        LOG_TRANSFER_INFO() << "Transfer " << transfer_id << " is already up to date";
+        complete_receive(transfer_id, temp_paths, info.destination_folder, names);
+        return;
+    }
+    if (cancelled || !created) {
+        if (journal) {
+            temp_paths.push_back(journal->path());
+        }
+        cleanup_transfer(transfer_id, temp_paths);
+    }
+    if (!cancelled && !created && completion_callback_) {
+        completion_callback_(transfer_id, false, "Cannot create destination files");
+    }
+    if (!duplicates.empty()) {
+        place_duplicates(transfer_id, *state, duplicates);
+    }
+}
+
+bool TransferManager::handle_manifest_page(const std::string& transfer_id, uint64_t first_file,
+                                           const std::vector<FileMetadata>& files) {
+    auto state = find_transfer(transfer_id);
+    if (!state || files.empty()) {
         return false;
     }
     
-    const std::string& temp_path = temp_it->second[file_index];
-    
-    try {
-        std::ofstream file(temp_path, std::ios::binary | std::ios::app);
-        if (!file) {
+    std::shared_ptr<TransferJournal> journal;
+    std::string destination_folder;
+    bool sync = false;
+    bool bulk_io = false;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        const TransferInfo& transfer = state->info;
+        if (state->finished || state->responding || state->extending ||
+            transfer.direction != TransferDirection::RECEIVING || transfer.status != TransferStatus::APPROVED ||
+            state->temp_paths.size() != transfer.files.size()) {
             return false;
         }
         
-        file.write(reinterpret_cast<const char*>(data.data()), data.size());
-        file.close();
-        
-        // Update progress
-        transfer.transferred_bytes += data.size();
-        update_transfer_progress(transfer_id);
-        
-        // Check if file is complete
-        uint64_t current_size = utils::get_file_size(temp_path);
-        if (current_size >= transfer.files[file_index].size) {
-            // File complete, move to final destination
-            if (finalize_received_file(transfer_id, file_index)) {
-                // Check if all files are complete
-                bool all_complete = true;
-                for (size_t i = 0; i < transfer.files.size(); ++i) {
-                    std::string final_path = transfer.destination_folder + "/" + transfer.files[i].name;
-                    if (!utils::file_exists(final_path)) {
-                        all_complete = false;
-                        break;
-                    }
-                }
-                
-                if (all_complete) {
-                    transfer.status = TransferStatus::COMPLETED;
-                    cleanup_transfer(transfer_id);
-                    
-                    if (completion_callback_) {
-                        completion_callback_(transfer_id, true, "");
-                    }
-                }
-            }
+        // A page resent because its response was lost
+        if (first_file + files.size() <= transfer.files.size()) {
+            return true;
         }
         
+        uint64_t bytes = 0;
+        for (const auto& file : transfer.files) {
+            bytes += file.size;
+        }
+        for (const auto& file : files) {
+            bytes += file.size;
+        }
+        if (first_file != transfer.files.size() || transfer.files.size() + files.size() > transfer.file_count ||
+            bytes > transfer.total_bytes) {
+            LOG_TRANSFER_ERROR() << "Manifest page at file " << first_file << " doesn't fit transfer " << transfer_id;
+            return false;
+        }
+        state->extending = true;
+        journal = state->journal;
+        destination_folder = transfer.destination_folder;
+        sync = transfer.sync;
+        bulk_io = transfer.bulk_io;
+    }
+    
+    std::vector<bool> unchanged(files.size(), false);
+    if (sync) {
+        unchanged = find_unchanged_files(destination_folder, files, bulk_io);
+    }
+    
+    std::vector<std::string> temp_paths;
+    std::vector<std::string> created_paths;
+    bool created = true;
+    for (size_t i = 0; i < files.size(); ++i) {
+        int file_index = static_cast<int>(first_file + i);
+        if (unchanged[i]) {
+            temp_paths.push_back(temporary_file_path(transfer_id, file_index));
+            continue;
+        }
+        std::string temp_path = create_temporary_file(transfer_id, file_index, files[i].size);
+        if (temp_path.empty()) {
+            created = false;
+            break;
+        }
+        temp_paths.push_back(temp_path);
+        created_paths.push_back(temp_path);
+    }
+    std::vector<std::vector<RangeSet::Range>> stored;
+    if (created) {
+        fill_from_chunk_store(files, temp_paths, destination_folder, bulk_io, unchanged, stored);
+        place_page_duplicates(files, first_file, temp_paths, destination_folder, bulk_io, unchanged, stored);
+    }
+    if (created && journal) {
+        if (!journal->append_page(first_file, utils::manifest_page_to_json(files, 0, files.size()))) {
+            LOG_TRANSFER_WARN() << "Cannot journal manifest page of " << transfer_id;
+        }
+        for (size_t i = 0; i < unchanged.size(); ++i) {
+            if (unchanged[i]) {
+                journal->append_range(static_cast<uint32_t>(first_file + i), 0, files[i].size);
+            }
+            for (const auto& [offset, length] : stored[i]) {
+                journal->append_range(static_cast<uint32_t>(first_file + i), offset, length);
+            }
+        }
+    }
+    
+    bool completed = false;
+    bool published = false;
+    std::vector<std::string> names;
+    std::vector<std::pair<size_t, size_t>> duplicates;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->extending = false;
+        if (!state->finished && created) {
+            for (size_t i = 0; i < files.size(); ++i) {
+                state->info.files.push_back(files[i]);
+                state->verified_chunks.emplace_back(files[i].chunk_hashes.size(), false);
+            }
+            state->temp_paths.insert(state->temp_paths.end(), temp_paths.begin(), temp_paths.end());
+            state->received_ranges.resize(state->temp_paths.size());
+            state->file_completed.resize(state->temp_paths.size(), false);
+            state->file_progress.resize(state->temp_paths.size(), 0);
+            mark_stored_chunks(*state, first_file, stored);
+            if (mark_unchanged_files(*state, first_file, unchanged)) {
+                // The last page held only files the destination already had
+                state->info.status = TransferStatus::COMPLETED;
+                names = mirrored_names(state->info);
+                temp_paths = retire_transfer(*state);
+                completed = true;
+            } else {
+                duplicates = claim_duplicates(*state, first_file, unchanged);
+                published = true;
+            }
+        }
+    }
+    if (completed) {
+        complete_receive(transfer_id, temp_paths, destination_folder, names);
         return true;
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error writing file: " << e.what() << std::endl;
-        return false;
     }
+    if (published) {
+        if (!duplicates.empty()) {
+            place_duplicates(transfer_id, *state, duplicates);
+        }
+        return true;
+    }
+    
+    // Cancelled meanwhile, or out of space; the sender retries a failed page
+    for (const auto& temp_path : created_paths) {
+        std::error_code error;
+        std::filesystem::remove(temp_path, error);
+    }
+    return false;
 }
 
-void TransferManager::cancel_transfer(const std::string& transfer_id) {
-    std::lock_guard<std::mutex> lock(transfers_mutex_);
-    auto it = active_transfers_.find(transfer_id);
-    if (it != active_transfers_.end()) {
-        it->second.status = TransferStatus::CANCELLED;
-        cleanup_transfer(transfer_id);
+bool TransferManager::wait_for_response(const std::string& transfer_id, std::chrono::seconds timeout) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return false;
+    }
+    
+    std::vector<std::string> temp_paths;
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        auto answered = [&]() {
+            return state->finished || state->info.status != TransferStatus::PENDING_APPROVAL;
+        };
         
-        if (completion_callback_) {
-            completion_callback_(transfer_id, false, "Transfer cancelled");
+        // An accepted request may still be creating its files when the timeout hits
+        if (!state->response_cv.wait_for(lock, timeout, [&]() { return answered() || state->responding; })) {
+            state->info.status = TransferStatus::CANCELLED;
+            temp_paths = retire_transfer(*state);
+        } else {
+            state->response_cv.wait(lock, answered);
+            // A sync the destination was already up to date with completes on acceptance
+            return (!state->finished && state->info.status == TransferStatus::APPROVED) ||
+                   state->info.status == TransferStatus::COMPLETED;
         }
     }
+    
+    cleanup_transfer(transfer_id, temp_paths);
+    if (completion_callback_) {
+        completion_callback_(transfer_id, false, "Transfer request expired");
+    }
+    return false;
 }
 
-std::map<std::string, TransferInfo> TransferManager::get_active_transfers() const {
-    std::lock_guard<std::mutex> lock(transfers_mutex_);
-    return active_transfers_;
+bool TransferManager::handle_file_upload(const std::string& transfer_id, int file_index,
+                                         uint64_t content_length, const BodyReader& read_body) {
+    // Whole-file uploads continue where the previous upload of this file stopped
+    return receive_file_range(transfer_id, file_index, true, 0, content_length,
+                              paced_body_reader(transfer_id, read_body));
 }
 
-TransferInfo TransferManager::get_transfer_info(const std::string& transfer_id) const {
-    std::lock_guard<std::mutex> lock(transfers_mutex_);
-    auto it = active_transfers_.find(transfer_id);
-    if (it != active_transfers_.end()) {
-        return it->second;
-    }
-    return TransferInfo{}; // Return empty info if not found
+bool TransferManager::handle_chunk_upload(const std::string& transfer_id, int file_index,
+                                          uint64_t offset, uint64_t length, const BodyReader& read_body) {
+    return receive_file_range(transfer_id, file_index, false, offset, length,
+                              paced_body_reader(transfer_id, read_body));
 }
 
-std::string TransferManager::generate_transfer_id() {
-    return utils::generate_uuid();
+bool TransferManager::get_delta_signature(const std::string& transfer_id, int file_index, std::string& signature) {
+    std::string basis_path;
+    uint64_t file_size = 0;
+    bool bulk_io = false;
+    if (!find_delta_basis(transfer_id, file_index, basis_path, file_size, bulk_io)) {
+        return false;
+    }
+    
+    FileIdentity basis;
+    DeltaSignature computed;
+    if (!HashCache::identify(basis_path, basis) ||
+        !compute_delta_signature(basis_path, basis.size, bulk_io, computed) || computed.weak.empty()) {
+        return false;
+    }
+    signature = delta_signature_to_bytes(computed);
+    return true;
 }
 
-bool TransferManager::create_temporary_file(const std::string& transfer_id, int file_index) {
-    std::string temp_dir = download_folder_ + "/.warpdeck_temp";
-    if (!utils::create_directory(temp_dir)) {
+bool TransferManager::handle_delta_upload(const std::string& transfer_id, int file_index, const BodyReader& read_body) {
+    std::string basis_path;
+    uint64_t file_size = 0;
+    bool bulk_io = false;
+    if (!find_delta_basis(transfer_id, file_index, basis_path, file_size, bulk_io)) {
         return false;
     }
     
-    std::string temp_filename = transfer_id + "_" + std::to_string(file_index) + ".tmp";
-    std::string temp_path = temp_dir + "/" + temp_filename;
-    
-    // Create empty temporary file
-    std::ofstream file(temp_path, std::ios::binary);
-    if (!file) {
+    // The file is rebuilt into its temp file like any whole-file upload, so its
+    // leaves are verified on the way in and finalizing renames it over the basis
+    int basis_fd = ::open(basis_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (basis_fd < 0) {
         return false;
     }
-    file.close();
-    
-    // Store temporary file path
-    temp_file_paths_[transfer_id].resize(std::max(static_cast<size_t>(file_index + 1), 
-                                                  temp_file_paths_[transfer_id].size()));
-    temp_file_paths_[transfer_id][file_index] = temp_path;
+    struct stat basis_stat;
+    if (::fstat(basis_fd, &basis_stat) != 0) {
+        ::close(basis_fd);
+        return false;
+    }
+    uint64_t basis_size = static_cast<uint64_t>(basis_stat.st_size);
+    DeltaDecoder decoder(basis_fd, basis_size, delta_block_size(basis_size));
     
-    return true;
+    // Paced on the delta as it arrives, not on the file it rebuilds
+    BodyReader paced_body = paced_body_reader(transfer_id, read_body);
+    bool success = receive_file_range(transfer_id, file_index, false, 0, file_size,
+        [&](std::function<bool(const char*, size_t)> receiver) {
+            return paced_body([&](const char* data, size_t length) {
+                return decoder.feed(data, length, receiver);
+            }) && decoder.at_op_boundary();
+        });
+    ::close(basis_fd);
+    return success;
 }
 
-bool TransferManager::finalize_received_file(const std::string& transfer_id, int file_index) {
-    auto temp_it = temp_file_paths_.find(transfer_id);
-    if (temp_it == temp_file_paths_.end() || 
-        file_index >= static_cast<int>(temp_it->second.size())) {
+bool TransferManager::find_delta_basis(const std::string& transfer_id, int file_index, std::string& basis_path,
+                                       uint64_t& file_size, bool& bulk_io) const {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
         return false;
     }
     
-    const std::string& temp_path = temp_it->second[file_index];
-    
-    auto transfer_it = active_transfers_.find(transfer_id);
-    if (transfer_it == active_transfers_.end() ||
-        file_index >= static_cast<int>(transfer_it->second.files.size())) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    const TransferInfo& transfer = state->info;
+    if (state->finished || !transfer.sync ||
+        transfer.direction != TransferDirection::RECEIVING ||
+        transfer.status != TransferStatus::APPROVED ||
+        file_index < 0 || file_index >= static_cast<int>(state->temp_paths.size()) ||
+        state->file_completed[file_index] || state->received_ranges[file_index].covered() > 0 ||
+        transfer.files[file_index].size < DELTA_MIN_SIZE) {
         return false;
     }
     
-    const FileMetadata& file_meta = transfer_it->second.files[file_index];
-    std::string final_path = transfer_it->second.destination_folder + "/" + file_meta.name;
+    basis_path = transfer.destination_folder + "/" + transfer.files[file_index].name;
+    file_size = transfer.files[file_index].size;
+    bulk_io = transfer.bulk_io;
+    return true;
+}
+
+void TransferManager::cancel_transfer(const std::string& transfer_id) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return;
+    }
     
-    try {
-        // Ensure destination directory exists
-        std::string dest_dir = utils::get_parent_directory(final_path);
-        if (!utils::create_directory(dest_dir)) {
-            return false;
+    std::vector<std::string> temp_paths;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->finished) {
+            return;
         }
-        
-        // Move temporary file to final destination
-        std::filesystem::rename(temp_path, final_path);
-        
-        return true;
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error finalizing file: " << e.what() << std::endl;
-        return false;
+        state->info.status = TransferStatus::CANCELLED;
+        temp_paths = retire_transfer(*state);
+    }
+    state->response_cv.notify_all();
+    
+    cleanup_transfer(transfer_id, temp_paths);
+    if (completion_callback_) {
+        completion_callback_(transfer_id, false, "Transfer cancelled");
     }
 }
 
-void TransferManager::cleanup_transfer(const std::string& transfer_id) {
-    // Remove temporary files
-    auto temp_it = temp_file_paths_.find(transfer_id);
-    if (temp_it != temp_file_paths_.end()) {
-        for (const auto& temp_path : temp_it->second) {
-            try {
-                if (utils::file_exists(temp_path)) {
-                    std::filesystem::remove(temp_path);
-                }
-            } catch (const std::exception&) {
-                // Ignore cleanup errors
-            }
+std::map<std::string, TransferInfo> TransferManager::get_active_transfers() const {
+    std::vector<std::shared_ptr<TransferState>> states;
+    {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        for (const auto& [transfer_id, state] : transfers_) {
+            states.push_back(state);
         }
-        temp_file_paths_.erase(temp_it);
     }
     
-    // Remove from active transfers
-    active_transfers_.erase(transfer_id);
+    std::map<std::string, TransferInfo> transfers;
+    for (const auto& state : states) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->finished) {
+            transfers[state->info.transfer_id] = state->info;
+        }
+    }
+    return transfers;
 }
 
-void TransferManager::update_transfer_progress(const std::string& transfer_id) {
-    auto it = active_transfers_.find(transfer_id);
-    if (it != active_transfers_.end() && progress_callback_) {
-        const TransferInfo& transfer = it->second;
-        float progress = transfer.total_bytes > 0 ? 
-            (static_cast<float>(transfer.transferred_bytes) / transfer.total_bytes) * 100.0f : 0.0f;
-        
-        progress_callback_(transfer_id, progress, transfer.transferred_bytes);
+TransferInfo TransferManager::get_transfer_info(const std::string& transfer_id) const {
+    auto state = find_transfer(transfer_id);
+    if (state) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->finished) {
+            return state->info;
+        }
+    }
+    return TransferInfo{}; // Return empty info if not found
+}
+
+bool TransferManager::get_transfer_stats(const std::string& transfer_id, TransferStats& stats) const {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return false;
     }
+    
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->finished) {
+        return false;
+    }
+    stats = snapshot_stats(*state, true);
+    return true;
+}
+
+bool TransferManager::receive_file_range(const std::string& transfer_id, int file_index, bool append,
+                                         uint64_t offset, uint64_t length, const BodyReader& read_body) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return false;
+    }
+    
+    std::string temp_path;
+    bool bulk_io = false;
+    uint64_t file_size = 0;
+    uint64_t chunk_size = 0;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        TransferInfo& transfer = state->info;
+        
+        if (state->finished ||
+            transfer.direction != TransferDirection::RECEIVING ||
+            transfer.status != TransferStatus::APPROVED ||
+            file_index < 0 || file_index >= static_cast<int>(transfer.files.size()) ||
+            file_index >= static_cast<int>(state->temp_paths.size())) {
+            return false;
+        }
+        
+        temp_path = state->temp_paths[file_index];
+        bulk_io = transfer.bulk_io;
+        
+        if (append) {
+            offset = state->received_ranges[file_index].contiguous_prefix();
+        }
+        
+        file_size = transfer.files[file_index].size;
+        chunk_size = transfer.files[file_index].chunk_hashes.empty() ? 0 : transfer.files[file_index].chunk_size;
+        if (offset > file_size || length > file_size - offset) {
+            LOG_TRANSFER_ERROR() << "Chunk [" << offset << ", " << offset + length << ") of file "
+                                 << file_index << " in " << transfer_id << " is out of range";
+            return false;
+        }
+    }
+    
+    // Stream the body to disk without holding any lock; memory use is bounded
+    // by the write buffers regardless of the chunk size
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    // Leaves are hashed on the way to disk, so checking them costs no extra read
+    FileWriter writer(fd, offset, bulk_io);
+    ChunkStreamHasher chunk_hasher(chunk_size, file_size, offset);
+    uint64_t received = 0;
+    uint64_t reported = 0;
+    bool write_ok = true;
+    
+    bool read_ok = read_body([&](const char* data, size_t data_length) {
+        if (received + data_length > length) {
+            return false;
+        }
+        
+        write_ok = writer.write(data, data_length);
+        chunk_hasher.update(data, data_length);
+        received += data_length;
+        
+        if (received - reported >= PROGRESS_REPORT_INTERVAL) {
+            if (!add_received_bytes(transfer_id, *state, file_index, received - reported)) {
+                return false; // Transfer was cancelled
+            }
+            reported = received;
+        }
+        return write_ok;
+    });
+    
+    write_ok = writer.flush() && write_ok;
+    ::close(fd);
+    
+    if (!read_ok || !write_ok || received != length ||
+        !match_chunk_hashes(transfer_id, *state, file_index, chunk_hasher.chunks())) {
+        LOG_TRANSFER_ERROR() << "Chunk at " << offset << " of file " << file_index << " in "
+                             << transfer_id << " failed after " << received << " of " << length << " bytes";
+        
+        // The sender will resend the whole chunk, so don't count the partial one
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->info.transferred_bytes -= std::min(state->info.transferred_bytes, reported);
+        if (!state->finished) {
+            uint64_t& file_progress = state->file_progress[file_index];
+            file_progress -= std::min(file_progress, reported);
+        }
+        return false;
+    }
+    
+    if (received > reported && !add_received_bytes(transfer_id, *state, file_index, received - reported)) {
+        return false;
+    }
+    
+    return complete_file_range(transfer_id, *state, file_index, offset, length, chunk_hasher.chunks());
+}
+
+bool TransferManager::handle_bundle_upload(const std::string& transfer_id, const BodyReader& read_body) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return false;
+    }
+    
+    std::vector<std::string> temp_paths;
+    std::vector<uint64_t> file_sizes;
+    std::vector<uint64_t> chunk_sizes;
+    std::vector<bool> already_received;
+    bool bulk_io = false;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->finished ||
+            state->info.direction != TransferDirection::RECEIVING ||
+            state->info.status != TransferStatus::APPROVED) {
+            return false;
+        }
+        
+        temp_paths = state->temp_paths;
+        bulk_io = state->info.bulk_io;
+        already_received = state->file_completed;
+        for (const auto& file : state->info.files) {
+            file_sizes.push_back(file.size);
+            chunk_sizes.push_back(file.chunk_hashes.empty() ? 0 : file.chunk_size);
+        }
+    }
+    
+    // Unpack frames as they stream in: a header names the file and its length,
+    // the payload that follows is written to that file's temp file
+    char header[BUNDLE_FRAME_HEADER_SIZE];
+    size_t header_fill = 0;
+    bool in_payload = false;
+    bool skipping = false;
+    int fd = -1;
+    uint32_t file_index = 0;
+    uint64_t remaining = 0;
+    uint64_t completed_bytes = 0;
+    uint64_t reported = 0;
+    bool ok = true;
+    FileWriter writer(-1, 0, bulk_io);
+    ChunkStreamHasher chunk_hasher(0, 0, 0);
+    
+    auto finish_file = [&]() {
+        in_payload = false;
+        if (skipping) {
+            return true;
+        }
+        
+        bool flushed = writer.flush();
+        ::close(fd);
+        fd = -1;
+        if (!flushed) {
+            return false;
+        }
+        
+        if (!match_chunk_hashes(transfer_id, *state, static_cast<int>(file_index), chunk_hasher.chunks()) ||
+            !complete_file_range(transfer_id, *state, static_cast<int>(file_index), 0, file_sizes[file_index],
+                                 chunk_hasher.chunks())) {
+            return false;
+        }
+        completed_bytes += file_sizes[file_index];
+        if (completed_bytes - reported >= PROGRESS_REPORT_INTERVAL) {
+            if (!add_received_bytes(transfer_id, *state, -1, completed_bytes - reported)) {
+                return false;
+            }
+            reported = completed_bytes;
+        }
+        return true;
+    };
+    
+    bool read_ok = read_body([&](const char* data, size_t length) {
+        if (!throttle(*state, length)) {
+            return false;
+        }
+        while (length > 0) {
+            if (!in_payload) {
+                size_t take = std::min(length, BUNDLE_FRAME_HEADER_SIZE - header_fill);
+                std::memcpy(header + header_fill, data, take);
+                header_fill += take;
+                data += take;
+                length -= take;
+                if (header_fill < BUNDLE_FRAME_HEADER_SIZE) {
+                    return true;
+                }
+                header_fill = 0;
+                
+                file_index = 0;
+                uint64_t size = 0;
+                for (int i = 0; i < 4; ++i) {
+                    file_index = (file_index << 8) | static_cast<uint8_t>(header[i]);
+                }
+                for (int i = 0; i < 8; ++i) {
+                    size = (size << 8) | static_cast<uint8_t>(header[4 + i]);
+                }
+                
+                // Bundles carry whole files only
+                if (file_index >= file_sizes.size() || size != file_sizes[file_index]) {
+                    ok = false;
+                    return false;
+                }
+                
+                // A resent bundle may repeat files that were already finalized
+                skipping = already_received[file_index];
+                if (!skipping) {
+                    fd = ::open(temp_paths[file_index].c_str(), O_WRONLY | O_CLOEXEC);
+                    if (fd < 0) {
+                        ok = false;
+                        return false;
+                    }
+                    writer.reset(fd, 0, bulk_io);
+                    chunk_hasher.reset(chunk_sizes[file_index], size, 0);
+                }
+                
+                in_payload = true;
+                remaining = size;
+                if (remaining == 0 && !finish_file()) {
+                    ok = false;
+                    return false;
+                }
+                continue;
+            }
+            
+            size_t take = static_cast<size_t>(std::min<uint64_t>(length, remaining));
+            if (!skipping) {
+                if (!writer.write(data, take)) {
+                    ok = false;
+                    return false;
+                }
+                chunk_hasher.update(data, take);
+            }
+            data += take;
+            length -= take;
+            remaining -= take;
+            
+            if (remaining == 0 && !finish_file()) {
+                ok = false;
+                return false;
+            }
+        }
+        return true;
+    });
+    
+    if (fd >= 0) {
+        writer.flush();
+        ::close(fd);
+    }
+    
+    if (completed_bytes > reported) {
+        add_received_bytes(transfer_id, *state, -1, completed_bytes - reported);
+    }
+    
+    if (!read_ok || !ok || in_payload || header_fill != 0) {
+        LOG_TRANSFER_ERROR() << "Bundle for " << transfer_id << " ended inside a frame";
+        return false;
+    }
+    return true;
+}
+
+bool TransferManager::match_chunk_hashes(const std::string& transfer_id, TransferState& state, int file_index,
+                                         const std::vector<ChunkHash>& chunks) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.finished) {
+        return false;
+    }
+    
+    const std::vector<std::string>& expected = state.info.files[file_index].chunk_hashes;
+    for (const auto& chunk : chunks) {
+        if (chunk.index < expected.size() && chunk.hash != expected[chunk.index]) {
+            LOG_TRANSFER_ERROR() << "Chunk " << chunk.index << " of file " << file_index << " in " << transfer_id
+                                 << " does not match its hash";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TransferManager::complete_file_range(const std::string& transfer_id, TransferState& state,
+                                          int file_index, uint64_t offset, uint64_t length,
+                                          const std::vector<ChunkHash>& chunks) {
+    std::string temp_path;
+    std::string final_path;
+    std::shared_ptr<TransferJournal> journal;
+    FileMetadata file;
+    std::vector<bool> verified;
+    bool bulk_io = false;
+    bool file_complete = false;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return false;
+        }
+        
+        uint64_t file_size = state.info.files[file_index].size;
+        RangeSet& received = state.received_ranges[file_index];
+        received.add(offset, length);
+        journal = state.journal;
+        
+        std::vector<bool>& file_verified = state.verified_chunks[file_index];
+        for (const auto& chunk : chunks) {
+            if (chunk.index < file_verified.size()) {
+                file_verified[chunk.index] = true;
+            }
+        }
+        
+        // Only the chunk that completes the file finalizes it; claiming the
+        // file here keeps a resent chunk from finalizing it a second time
+        if (!state.file_completed[file_index] && received.covered() >= file_size) {
+            state.file_completed[file_index] = true;
+            file_complete = true;
+            temp_path = state.temp_paths[file_index];
+            final_path = state.info.destination_folder + "/" + state.info.files[file_index].name;
+            file = state.info.files[file_index];
+            verified = file_verified;
+            bulk_io = state.info.bulk_io;
+        }
+    }
+        
+    // Record the range before the file can be renamed away: after a restart a
+    // fully covered file whose temp file is gone counts as finalized
+    if (journal && length > 0) {
+        journal->append_range(static_cast<uint32_t>(file_index), offset, length);
+    }
+    if (!file_complete) {
+        return true;
+    }
+    
+    std::vector<uint64_t> corrupt_chunks;
+    bool finalized = finalize_received_file(temp_path, final_path, file, verified, bulk_io, corrupt_chunks);
+    
+    std::vector<std::pair<size_t, size_t>> duplicates;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return false;
+        }
+        
+        if (!finalized) {
+            // Let a resend of the file try again. Corrupt leaves go back to
+            // missing, so the sender's next status check sends just those; the
+            // journal still lists them, but after a restart they are read back
+            // and fail verification again
+            state.file_completed[file_index] = false;
+            RangeSet& received = state.received_ranges[file_index];
+            uint64_t covered = received.covered();
+            for (uint64_t index : corrupt_chunks) {
+                received.remove(index * file.chunk_size, file.chunk_size);
+                chunk_store_.remove(file.chunk_hashes[index]); // In case that is where it came from
+            }
+            uint64_t dropped = covered - received.covered();
+            state.info.transferred_bytes -= std::min(state.info.transferred_bytes, dropped);
+            state.file_progress[file_index] -= std::min(state.file_progress[file_index], dropped);
+            return false;
+        }
+        state.file_progress[file_index] = state.info.files[file_index].size;
+        state.info.completed_files++;
+        
+        // Its duplicates are copied from it now that it landed
+        auto waiting = state.duplicates.find(static_cast<size_t>(file_index));
+        if (waiting != state.duplicates.end()) {
+            for (size_t duplicate : waiting->second) {
+                if (!state.file_completed[duplicate]) {
+                    state.file_completed[duplicate] = true;
+                    duplicates.emplace_back(duplicate, static_cast<size_t>(file_index));
+                }
+            }
+            state.duplicates.erase(waiting);
+        }
+    }
+    
+    // Completes the transfer if this was the last file
+    place_duplicates(transfer_id, state, duplicates);
+    return true;
+}
+
+void TransferManager::complete_receive(const std::string& transfer_id, const std::vector<std::string>& temp_paths,
+                                       const std::string& destination_folder,
+                                       const std::vector<std::string>& mirrored_names) {
+    {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        recently_completed_.push_back(transfer_id);
+        if (recently_completed_.size() > RECENTLY_COMPLETED_LIMIT) {
+            recently_completed_.pop_front();
+        }
+    }
+    
+    if (!mirrored_names.empty()) {
+        delete_extra_files(destination_folder, mirrored_names);
+    }
+    cleanup_transfer(transfer_id, temp_paths);
+    if (completion_callback_) {
+        completion_callback_(transfer_id, true, "");
+    }
+}
+
+void TransferManager::delete_extra_files(const std::string& destination_folder,
+                                         const std::vector<std::string>& names) {
+    // Only directories the sender sent are mirrored; a file sent on its own
+    // says nothing about what else belongs next to it
+    std::unordered_set<std::string> keep(names.begin(), names.end());
+    std::set<std::string> roots;
+    for (const auto& name : names) {
+        size_t slash = name.find('/');
+        if (slash != std::string::npos) {
+            roots.insert(destination_folder + "/" + name.substr(0, slash));
+        }
+    }
+    
+    std::vector<WalkEntry> entries;
+    if (!walker_->walk(std::vector<std::string>(roots.begin(), roots.end()), MAX_MANIFEST_FILES, entries)) {
+        LOG_TRANSFER_WARN() << "Too many files under the mirrored directories; nothing deleted";
+        return;
+    }
+    
+    size_t deleted = 0;
+    for (const auto& entry : entries) {
+        std::error_code error;
+        if (keep.count(entry.relative_path) == 0 && std::filesystem::remove(entry.path, error)) {
+            deleted++;
+        }
+    }
+    LOG_TRANSFER_INFO() << "Mirror sync deleted " << deleted << " file(s) the sender doesn't have";
+}
+
+std::vector<bool> TransferManager::find_unchanged_files(const std::string& destination_folder,
+                                                        const std::vector<FileMetadata>& files, bool bulk_io) {
+    // One stat per file plus a cache lookup; only files whose size matches
+    // but whose hash isn't cached are read
+    std::vector<bool> unchanged(files.size(), false);
+    std::vector<size_t> unhashed;
+    std::vector<std::string> unhashed_paths;
+    std::vector<uint64_t> unhashed_sizes;
+    std::vector<FileIdentity> identities;
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::string path = destination_folder + "/" + files[i].name;
+        FileIdentity identity;
+        if (files[i].hash.empty() || !HashCache::identify(path, identity) || identity.size != files[i].size) {
+            continue;
+        }
+        
+        TreeHash cached;
+        if (hash_cache_.lookup(identity, cached)) {
+            unchanged[i] = cached.root == files[i].hash;
+            continue;
+        }
+        unhashed.push_back(i);
+        unhashed_paths.push_back(path);
+        unhashed_sizes.push_back(identity.size);
+        identities.push_back(identity);
+    }
+    
+    std::vector<TreeHash> computed;
+    if (!unhashed.empty() && hasher_->hash_files(unhashed_paths, unhashed_sizes, bulk_io, computed)) {
+        for (size_t j = 0; j < unhashed.size(); ++j) {
+            unchanged[unhashed[j]] = computed[j].root == files[unhashed[j]].hash;
+            
+            FileIdentity after;
+            if (HashCache::identify(unhashed_paths[j], after) && after == identities[j]) {
+                hash_cache_.store(identities[j], computed[j]);
+            }
+        }
+    }
+    
+    size_t matched = std::count(unchanged.begin(), unchanged.end(), true);
+    LOG_TRANSFER_DEBUG() << matched << " of " << files.size() << " file(s) already up to date";
+    return unchanged;
+}
+
+void TransferManager::fill_from_chunk_store(const std::vector<FileMetadata>& files,
+                                            const std::vector<std::string>& temp_paths,
+                                            const std::string& destination_folder, bool bulk_io,
+                                            std::vector<bool>& in_place,
+                                            std::vector<std::vector<RangeSet::Range>>& stored) {
+    stored.assign(files.size(), {});
+    if (!chunk_store_.is_open()) {
+        return;
+    }
+    
+    uint64_t filled_bytes = 0;
+    size_t filled_files = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const FileMetadata& file = files[i];
+        if (in_place[i] || file.chunk_size == 0) {
+            continue;
+        }
+        
+        int fd = -1;
+        uint64_t covered = 0;
+        for (size_t index = 0; index < file.chunk_hashes.size(); ++index) {
+            uint64_t offset = index * file.chunk_size;
+            uint64_t length = std::min(file.chunk_size, file.size - offset);
+            if (!chunk_store_.contains(file.chunk_hashes[index], length)) {
+                continue;
+            }
+            if (fd < 0) {
+                fd = ::open(temp_paths[i].c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    break;
+                }
+            }
+            if (!chunk_store_.copy_to(file.chunk_hashes[index], fd, offset, length)) {
+                continue;
+            }
+            if (!stored[i].empty() && stored[i].back().first + stored[i].back().second == offset) {
+                stored[i].back().second += length;
+            } else {
+                stored[i].emplace_back(offset, length);
+            }
+            covered += length;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        filled_bytes += covered;
+        if (covered == 0 || covered < file.size) {
+            continue;
+        }
+        
+        // Rebuilt entirely: verify it and move it into place now, like a file the
+        // destination already had. Store chunks are read back rather than trusted.
+        std::vector<uint64_t> corrupt_chunks;
+        if (finalize_received_file(temp_paths[i], destination_folder + "/" + file.name, file,
+                                   std::vector<bool>(), bulk_io, corrupt_chunks)) {
+            in_place[i] = true;
+            ++filled_files;
+        } else {
+            for (uint64_t index : corrupt_chunks) {
+                chunk_store_.remove(file.chunk_hashes[index]);
+            }
+            filled_bytes -= covered;
+        }
+        stored[i].clear();
+    }
+    
+    if (filled_bytes > 0) {
+        LOG_TRANSFER_INFO() << "Rebuilt " << filled_bytes << " bytes from the chunk store, " << filled_files
+                            << " file(s) entirely";
+    }
+}
+
+void TransferManager::mark_stored_chunks(TransferState& state, size_t first_file,
+                                         const std::vector<std::vector<RangeSet::Range>>& stored) {
+    for (size_t i = 0; i < stored.size(); ++i) {
+        size_t index = first_file + i;
+        for (const auto& [offset, length] : stored[i]) {
+            state.received_ranges[index].add(offset, length);
+            state.file_progress[index] += length;
+            state.info.transferred_bytes += length;
+        }
+    }
+}
+
+bool TransferManager::mark_unchanged_files(TransferState& state, size_t first_file,
+                                           const std::vector<bool>& unchanged) {
+    for (size_t i = 0; i < unchanged.size(); ++i) {
+        if (!unchanged[i]) {
+            continue;
+        }
+        size_t index = first_file + i;
+        uint64_t size = state.info.files[index].size;
+        state.received_ranges[index].add(0, size);
+        state.file_completed[index] = true;
+        state.file_progress[index] = size;
+        state.info.transferred_bytes += size;
+        state.info.completed_files++;
+    }
+    return state.info.completed_files == state.info.file_count;
+}
+
+void TransferManager::place_page_duplicates(const std::vector<FileMetadata>& files, uint64_t first_file,
+                                            const std::vector<std::string>& temp_paths,
+                                            const std::string& destination_folder, bool bulk_io,
+                                            std::vector<bool>& in_place,
+                                            std::vector<std::vector<RangeSet::Range>>& stored) {
+    size_t placed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        int64_t source = duplicate_source(files, first_file, i);
+        if (in_place[i] || source < 0 || !in_place[static_cast<size_t>(source) - first_file]) {
+            continue;
+        }
+        
+        // The source was verified as it landed, so the copy isn't read back
+        const FileMetadata& file = files[i];
+        std::vector<uint64_t> corrupt_chunks;
+        if (copy_duplicate(destination_folder + "/" + files[static_cast<size_t>(source) - first_file].name,
+                           temp_paths[i], file.size) &&
+            finalize_received_file(temp_paths[i], destination_folder + "/" + file.name, file,
+                                   std::vector<bool>(file.chunk_hashes.size(), true), bulk_io, corrupt_chunks)) {
+            in_place[i] = true;
+            stored[i].clear();
+            ++placed;
+        }
+    }
+    
+    if (placed > 0) {
+        LOG_TRANSFER_DEBUG() << "Copied " << placed << " duplicate file(s) from files already in place";
+    }
+}
+
+std::vector<std::pair<size_t, size_t>> TransferManager::claim_duplicates(TransferState& state, size_t first_file,
+                                                                         const std::vector<bool>& in_place) {
+    std::vector<std::pair<size_t, size_t>> claimed;
+    for (size_t i = 0; i < in_place.size(); ++i) {
+        size_t index = first_file + i;
+        int64_t source = duplicate_source(state.info.files, 0, index);
+        if (in_place[i] || source < 0) {
+            continue;
+        }
+        
+        // A source still to land copies its duplicates once it does (complete_file_range)
+        size_t source_index = static_cast<size_t>(source);
+        if (!state.file_completed[source_index]) {
+            state.duplicates[source_index].push_back(index);
+        } else if (!state.file_completed[index]) {
+            state.file_completed[index] = true;
+            claimed.emplace_back(index, source_index);
+        }
+    }
+    return claimed;
+}
+
+void TransferManager::place_duplicates(const std::string& transfer_id, TransferState& state,
+                                       const std::vector<std::pair<size_t, size_t>>& duplicates) {
+    struct Placement {
+        size_t index;
+        std::string source_path;
+        std::string temp_path;
+        std::string final_path;
+        FileMetadata file;
+    };
+    std::vector<Placement> placements;
+    std::shared_ptr<TransferJournal> journal;
+    bool bulk_io = false;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return;
+        }
+        const std::string& destination_folder = state.info.destination_folder;
+        for (const auto& [index, source] : duplicates) {
+            placements.push_back({index, destination_folder + "/" + state.info.files[source].name,
+                                  state.temp_paths[index], destination_folder + "/" + state.info.files[index].name,
+                                  state.info.files[index]});
+        }
+        journal = state.journal;
+        bulk_io = state.info.bulk_io;
+    }
+    
+    // Journaled once the copy is whole and before the rename, like received files.
+    // A failed copy leaves a fresh temp file behind: the sender learns from the
+    // status that the source is here and the duplicate isn't, and sends it.
+    std::vector<bool> placed(placements.size(), false);
+    for (size_t i = 0; i < placements.size(); ++i) {
+        const Placement& placement = placements[i];
+        if (copy_duplicate(placement.source_path, placement.temp_path, placement.file.size)) {
+            if (journal) {
+                journal->append_range(static_cast<uint32_t>(placement.index), 0, placement.file.size);
+            }
+            std::vector<uint64_t> corrupt_chunks;
+            placed[i] = finalize_received_file(placement.temp_path, placement.final_path, placement.file,
+                                               std::vector<bool>(placement.file.chunk_hashes.size(), true),
+                                               bulk_io, corrupt_chunks);
+        }
+        if (!placed[i]) {
+            LOG_TRANSFER_WARN() << "Cannot copy " << placement.source_path << " to its duplicate "
+                                << placement.file.name << "; it will be sent";
+            std::error_code error;
+            std::filesystem::remove(placement.temp_path, error); // May be a hardlink to the source
+            create_temporary_file(transfer_id, static_cast<int>(placement.index), placement.file.size);
+        }
+    }
+    
+    std::vector<std::string> temp_paths;
+    std::string destination_folder;
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return;
+        }
+        
+        for (size_t i = 0; i < placements.size(); ++i) {
+            size_t index = placements[i].index;
+            uint64_t size = placements[i].file.size;
+            if (!placed[i]) {
+                // Its temp file starts over, whatever the chunk store had filled in
+                state.file_completed[index] = false;
+                state.received_ranges[index].clear();
+                state.info.transferred_bytes -= std::min(state.info.transferred_bytes, state.file_progress[index]);
+                state.file_progress[index] = 0;
+                continue;
+            }
+            state.received_ranges[index].add(0, size);
+            state.info.transferred_bytes += size - std::min(size, state.file_progress[index]);
+            state.file_progress[index] = size;
+            state.info.completed_files++;
+        }
+        
+        // The transfer is complete when the last file lands
+        if (state.info.completed_files < state.info.file_count) {
+            return;
+        }
+        state.info.status = TransferStatus::COMPLETED;
+        destination_folder = state.info.destination_folder;
+        names = mirrored_names(state.info);
+        temp_paths = retire_transfer(state);
+    }
+    
+    complete_receive(transfer_id, temp_paths, destination_folder, names);
+}
+
+void TransferManager::restore_interrupted_transfers() {
+    std::vector<std::string> journal_paths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(temporary_directory(), error)) {
+        if (entry.path().extension() == ".journal") {
+            journal_paths.push_back(entry.path().string());
+        }
+    }
+    
+    for (const auto& journal_path : journal_paths) {
+        auto state = restore_transfer(journal_path);
+        if (!state) {
+            continue;
+        }
+        
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        transfers_.emplace(state->info.transfer_id, state);
+    }
+}
+
+std::shared_ptr<TransferManager::TransferState> TransferManager::restore_transfer(const std::string& journal_path) {
+    std::string header;
+    std::vector<TransferJournal::Record> records;
+    std::vector<TransferJournal::Page> pages;
+    TransferInfo info;
+    bool readable = TransferJournal::load(journal_path, header, records, pages) &&
+                    utils::parse_transfer_journal_header(header, info);
+    
+    // Manifest pages that arrived after the header extend its file list
+    for (size_t p = 0; readable && p < pages.size(); ++p) {
+        std::vector<FileMetadata> files;
+        if (pages[p].first_file != info.files.size() || !utils::parse_manifest_page(pages[p].json, files) ||
+            info.files.size() + files.size() > std::max<uint64_t>(info.file_count, info.files.size())) {
+            break;
+        }
+        info.files.insert(info.files.end(), files.begin(), files.end());
+    }
+    info.file_count = std::max<uint64_t>(info.file_count, info.files.size());
+    
+    // Stale or unreadable journals go, along with whatever they left behind
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time(journal_path, error);
+    bool stale = error || std::filesystem::file_time_type::clock::now() - modified > JOURNAL_MAX_AGE;
+    if (!readable || stale || find_transfer(info.transfer_id)) {
+        if (!readable || stale) {
+            LOG_TRANSFER_INFO() << "Discarding " << (readable ? "stale" : "unreadable") << " journal " << journal_path;
+            for (size_t i = 0; readable && i < info.files.size(); ++i) {
+                std::remove(temporary_file_path(info.transfer_id, static_cast<int>(i)).c_str());
+            }
+            std::remove(journal_path.c_str());
+        }
+        return nullptr;
+    }
+    
+    auto state = std::make_shared<TransferState>();
+    state->received_ranges.assign(info.files.size(), RangeSet());
+    for (const auto& record : records) {
+        if (record.file_index < info.files.size() &&
+            record.offset <= info.files[record.file_index].size &&
+            record.length <= info.files[record.file_index].size - record.offset) {
+            state->received_ranges[record.file_index].add(record.offset, record.length);
+        }
+    }
+    
+    info.direction = TransferDirection::RECEIVING;
+    info.status = TransferStatus::APPROVED; // The user accepted it before the restart
+    uint64_t announced_bytes = info.total_bytes;
+    info.total_bytes = 0;
+    info.transferred_bytes = 0;
+    info.completed_files = 0;
+    state->file_completed.assign(info.files.size(), false);
+    state->file_progress.assign(info.files.size(), 0);
+    for (const auto& file : info.files) {
+        state->verified_chunks.emplace_back(file.chunk_hashes.size(), false);
+    }
+    
+    // A fully covered file without a temp file was finalized; a fully covered
+    // one that still has it is verified and finalized now, and any leaves that
+    // fail are received again. A temp file that went missing early is
+    // recreated and its ranges forgotten.
+    for (size_t i = 0; i < info.files.size(); ++i) {
+        uint64_t size = info.files[i].size;
+        std::string temp_path = temporary_file_path(info.transfer_id, static_cast<int>(i));
+        RangeSet& received = state->received_ranges[i];
+        bool present = utils::file_exists(temp_path) && utils::get_file_size(temp_path) == size;
+        std::vector<uint64_t> corrupt_chunks;
+        
+        if (received.covered() >= size &&
+            (!present || finalize_received_file(temp_path, info.destination_folder + "/" + info.files[i].name,
+                                                info.files[i], state->verified_chunks[i], info.bulk_io,
+                                                corrupt_chunks))) {
+            state->file_completed[i] = true;
+            info.completed_files++;
+        } else if (!present) {
+            received.clear();
+            if (create_temporary_file(info.transfer_id, static_cast<int>(i), size).empty()) {
+                LOG_TRANSFER_ERROR() << "Cannot recreate " << temp_path << " for interrupted transfer "
+                                     << info.transfer_id;
+                return nullptr;
+            }
+        }
+        for (uint64_t index : corrupt_chunks) {
+            received.remove(index * info.files[i].chunk_size, info.files[i].chunk_size);
+        }
+        
+        state->temp_paths.push_back(temp_path);
+        state->file_progress[i] = std::min(received.covered(), size);
+        info.total_bytes += size;
+        info.transferred_bytes += state->file_progress[i];
+    }
+    
+    info.total_bytes = std::max(info.total_bytes, announced_bytes);
+    
+    // Duplicates of files still to land wait for them again; those whose source
+    // landed before the restart are left for the sender to send
+    for (size_t i = 0; i < info.files.size(); ++i) {
+        int64_t source = duplicate_source(info.files, 0, i);
+        if (source >= 0 && !state->file_completed[i] && !state->file_completed[static_cast<size_t>(source)]) {
+            state->duplicates[static_cast<size_t>(source)].push_back(i);
+        }
+    }
+    
+    if (info.completed_files == info.file_count) {
+        std::remove(journal_path.c_str()); // Only the bookkeeping was left
+        return nullptr;
+    }
+    
+    auto journal = std::make_shared<TransferJournal>();
+    if (!journal->reopen(journal_path)) {
+        LOG_TRANSFER_WARN() << "Cannot reopen journal " << journal_path;
+        return nullptr;
+    }
+    state->journal = journal;
+    state->info = info;
+    state->limit_peer_id = info.peer_device_id;
+    
+    LOG_TRANSFER_INFO() << "Restored interrupted transfer " << info.transfer_id << ": " << info.transferred_bytes
+                        << " of " << info.total_bytes << " bytes already received";
+    return state;
+}
+
+bool TransferManager::get_receive_status(const std::string& transfer_id, TransferReceiveStatus& status) const {
+    status.transfer_id = transfer_id;
+    status.files.clear();
+    
+    auto completed_recently = [&]() {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        if (std::find(recently_completed_.begin(), recently_completed_.end(), transfer_id) ==
+            recently_completed_.end()) {
+            return false;
+        }
+        status.status = "completed";
+        return true;
+    };
+    
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return completed_recently();
+    }
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    const TransferInfo& info = state->info;
+    if (state->finished) {
+        // Retired but still in the map while a completed receive wraps up
+        lock.unlock();
+        return completed_recently();
+    }
+    if (info.direction != TransferDirection::RECEIVING) {
+        return false;
+    }
+    
+    bool ready = info.status == TransferStatus::APPROVED && !state->temp_paths.empty();
+    status.status = ready ? "ready_to_receive" : "pending_approval";
+    for (size_t i = 0; i < info.files.size(); ++i) {
+        FileReceiveStatus file;
+        file.size = info.files[i].size;
+        if (i < state->received_ranges.size()) {
+            file.received_bytes = std::min(state->received_ranges[i].covered(), file.size);
+            file.complete = state->file_completed[i];
+            file.missing = state->received_ranges[i].missing(file.size);
+        } else {
+            file.missing.emplace_back(0, file.size);
+        }
+        status.files.push_back(file);
+    }
+    
+    // Large sync files that nothing has arrived for yet can be sent as a delta
+    // if the destination already has an older copy; checked without the lock
+    std::vector<std::pair<size_t, std::string>> bases;
+    if (ready && info.sync) {
+        for (size_t i = 0; i < status.files.size(); ++i) {
+            const FileReceiveStatus& file = status.files[i];
+            if (!file.complete && file.received_bytes == 0 && file.size >= DELTA_MIN_SIZE) {
+                bases.emplace_back(i, info.destination_folder + "/" + info.files[i].name);
+            }
+        }
+    }
+    lock.unlock();
+    
+    for (const auto& [index, path] : bases) {
+        FileIdentity basis;
+        status.files[index].delta_basis = HashCache::identify(path, basis) &&
+                                          basis.size >= delta_block_size(basis.size);
+    }
+    return true;
+}
+
+std::string TransferManager::generate_transfer_id() {
+    return utils::generate_uuid();
+}
+
+std::shared_ptr<TransferManager::TransferState> TransferManager::find_transfer(const std::string& transfer_id) const {
+    std::lock_guard<std::mutex> lock(transfers_mutex_);
+    auto it = transfers_.find(transfer_id);
+    return it != transfers_.end() ? it->second : nullptr;
+}
+
+void TransferManager::run_outgoing_transfer(const std::string& transfer_id, std::shared_ptr<TransferState> state) {
+    std::shared_ptr<OutgoingTransfer> outgoing = state->outgoing;
+    
+    // Only the first page of the manifest goes with the request. The rest is
+    // hashed while the receiver's user decides and posted once they accept.
+    TransferRequest request;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->finished) {
+            return;
+        }
+        request.files = state->info.files;
+        request.file_count = state->info.file_count;
+        request.total_bytes = state->info.total_bytes;
+        request.bulk_io = state->info.bulk_io;
+        request.sync = state->info.sync;
+        request.delete_extras = state->info.delete_extras;
+    }
+    request.sender_device_id = device_id_;
+    if (outgoing->compression) {
+        request.compression = supported_compression_codecs();
+    }
+    
+    size_t file_count = request.files.size();
+    size_t first_page = manifest_page_end(request.files, 0);
+    if (!hash_outgoing_files(*state, 0, first_page)) {
+        finish_outgoing_transfer(transfer_id, *state, false, "Cannot read files to send");
+        return;
+    }
+    std::future<bool> rest_hashed = std::async(std::launch::async, [&]() {
+        for (size_t begin = first_page; begin < file_count && !outgoing->cancelled;) {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->finished) {
+                    return false; // Declined or failed; stop reading
+                }
+            }
+            size_t end = manifest_page_end(request.files, begin);
+            if (!hash_outgoing_files(*state, begin, end)) {
+                return false;
+            }
+            begin = end;
+        }
+        return true;
+    });
+    
+    TransferRequest first_request;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        first_request = request;
+        first_request.files.assign(state->info.files.begin(), state->info.files.begin() + first_page);
+    }
+    
+    LOG_TRANSFER_INFO() << "Requesting transfer " << transfer_id << " of " << file_count
+                        << " file(s) to " << outgoing->peer_host << ":" << outgoing->peer_port;
+    
+    APIResponse response = api_client_->request_transfer(outgoing->peer_host, outgoing->peer_port,
+                                                         outgoing->peer_fingerprint, first_request);
+    if (outgoing->cancelled) {
+        return;
+    }
+    
+    if (!response.success) {
+        finish_outgoing_transfer(transfer_id, *state, false, response.status_code == 403 ?
+            "Transfer declined by peer" : "Transfer request failed: " + response.error_message);
+        return;
+    }
+    
+    TransferSession session;
+    if (!utils::parse_transfer_session(response.body, session)) {
+        finish_outgoing_transfer(transfer_id, *state, false, "Invalid transfer response from peer");
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->finished) {
+            return;
+        }
+        state->info.status = TransferStatus::IN_PROGRESS;
+        start_rate_meter(*state);
+        
+        CompressionCodec codec = parse_compression_codec(session.compression);
+        if (codec != CompressionCodec::NONE) {
+            outgoing->compressor = std::make_shared<TransferCompressor>(codec);
+        }
+    }
+    if (outgoing->compressor) {
+        LOG_TRANSFER_INFO() << "Transfer " << transfer_id << " uploads are compressed with " << session.compression;
+    }
+    outgoing->started_at = std::chrono::steady_clock::now();
+    
+    if (!rest_hashed.get()) {
+        if (!outgoing->cancelled) {
+            finish_outgoing_transfer(transfer_id, *state, false, "Cannot read files to send");
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        request.files = state->info.files;
+    }
+    
+    // Uploads start once the receiver has the whole manifest
+    std::string error_message;
+    bool manifest_sent = send_manifest(*outgoing, session.transfer_id, request.files, first_page, error_message);
+    
+    // The receiver may still hold part of these files from an interrupted
+    // attempt, or from an earlier sync; only what it reports missing is sent.
+    // A sync whose files all match completes as soon as its manifest is in.
+    TransferReceiveStatus remote_status;
+    bool have_status = false;
+    bool up_to_date = false;
+    if (manifest_sent) {
+        response = api_client_->get_transfer_status(outgoing->peer_host, outgoing->peer_port,
+                                                    outgoing->peer_fingerprint, session.transfer_id);
+        if (response.success && utils::parse_transfer_receive_status(response.body, remote_status)) {
+            up_to_date = remote_status.status == "completed";
+            have_status = remote_status.files.size() == request.files.size();
+        }
+    }
+    
+    bool sent = manifest_sent &&
+                (up_to_date ||
+                 (run_upload_pass(transfer_id, state, session.transfer_id, request,
+                                  have_status ? &remote_status : nullptr, error_message) &&
+                  confirm_received(*outgoing, session.transfer_id, error_message)));
+    
+    // A dropped connection doesn't end the transfer: ask the receiver what
+    // arrived and resend the rest, backing off between attempts
+    std::chrono::seconds backoff = RESUME_BACKOFF;
+    for (int attempt = 1; !sent && attempt <= RESUME_ATTEMPTS && !outgoing->cancelled; ++attempt) {
+        LOG_TRANSFER_WARN() << "Transfer " << transfer_id << " interrupted (" << error_message << "), resuming in "
+                            << backoff.count() << " s (attempt " << attempt << " of " << RESUME_ATTEMPTS << ")";
+        if (!sleep_unless_cancelled(outgoing->cancelled, backoff)) {
+            break;
+        }
+        backoff = std::min(backoff * 2, RESUME_BACKOFF_MAX);
+        
+        response = api_client_->get_transfer_status(outgoing->peer_host, outgoing->peer_port,
+                                                    outgoing->peer_fingerprint, session.transfer_id);
+        if (!response.success) {
+            if (response.status_code == 404) {
+                error_message = "Receiver no longer has the transfer";
+                break;
+            }
+            continue; // Still unreachable
+        }
+        
+        if (!utils::parse_transfer_receive_status(response.body, remote_status)) {
+            error_message = "Invalid transfer status from peer";
+            break;
+        }
+        if (remote_status.status == "completed") {
+            sent = true; // Everything landed; only the last response was lost
+            break;
+        }
+        
+        // A receiver that restarted may have lost the manifest pages it hadn't journaled
+        if (remote_status.status == "ready_to_receive" && remote_status.files.size() < request.files.size()) {
+            if (!send_manifest(*outgoing, session.transfer_id, request.files, remote_status.files.size(),
+                               error_message)) {
+                continue;
+            }
+            response = api_client_->get_transfer_status(outgoing->peer_host, outgoing->peer_port,
+                                                        outgoing->peer_fingerprint, session.transfer_id);
+            if (!response.success || !utils::parse_transfer_receive_status(response.body, remote_status)) {
+                continue;
+            }
+        }
+        if (remote_status.status != "ready_to_receive" || remote_status.files.size() != request.files.size()) {
+            continue;
+        }
+        
+        sent = run_upload_pass(transfer_id, state, session.transfer_id, request, &remote_status, error_message) &&
+               confirm_received(*outgoing, session.transfer_id, error_message);
+    }
+    
+    if (outgoing->cancelled) {
+        return;
+    }
+    
+    finish_outgoing_transfer(transfer_id, *state, sent, sent ? "" : error_message);
+}
+
+bool TransferManager::run_upload_pass(const std::string& transfer_id, const std::shared_ptr<TransferState>& state,
+                                      const std::string& remote_transfer_id, const TransferRequest& request,
+                                      const TransferReceiveStatus* remote_status, std::string& error_message) {
+    std::shared_ptr<OutgoingTransfer> outgoing = state->outgoing;
+    
+    // Work out what each file still needs. Bytes the receiver holds count as
+    // sent; a file it holds entirely but hasn't finalized is sent again. A
+    // duplicate goes with its source, which the receiver copies it from, unless
+    // the receiver already has the source and still lacks the duplicate.
+    std::vector<std::vector<RangeSet::Range>> missing(request.files.size());
+    std::vector<bool> needed(request.files.size(), true);
+    std::unordered_map<size_t, std::vector<size_t>> copies; // source -> duplicates not sent
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->finished) {
+            return false;
+        }
+        
+        uint64_t transferred_bytes = 0;
+        uint64_t completed_files = 0;
+        for (size_t index = 0; index < request.files.size(); ++index) {
+            uint64_t size = request.files[index].size;
+            if (remote_status && remote_status->files[index].complete) {
+                needed[index] = false;
+            } else if (remote_status && !remote_status->files[index].missing.empty()) {
+                missing[index] = remote_status->files[index].missing;
+            } else if (size > 0) {
+                missing[index].emplace_back(0, size);
+            }
+            
+            int64_t source = request.files[index].duplicate_of;
+            bool copied = needed[index] && source >= 0 &&
+                          !(remote_status && remote_status->files[static_cast<size_t>(source)].complete);
+            if (copied) {
+                needed[index] = false;
+                copies[static_cast<size_t>(source)].push_back(index);
+            }
+            
+            uint64_t missing_bytes = 0;
+            for (const auto& range : missing[index]) {
+                missing_bytes += range.second;
+            }
+            uint64_t held = size - std::min(size, missing_bytes);
+            state->file_progress[index] = held;
+            transferred_bytes += held;
+            completed_files += needed[index] || copied ? 0 : 1;
+        }
+        state->info.transferred_bytes = transferred_bytes;
+        state->info.completed_files = completed_files;
+    }
+    if (!copies.empty()) {
+        size_t duplicates = 0;
+        for (const auto& [source, files] : copies) {
+            duplicates += files.size();
+        }
+        LOG_TRANSFER_DEBUG() << "Transfer " << transfer_id << " leaves " << duplicates
+                             << " duplicate file(s) for the receiver to copy";
+    }
+    
+    // Files of at least SMALL_FILE_THRESHOLD are one task each, largest first
+    // and dealt round-robin, so every worker starts on a big file. Runs of
+    // small files are packed into bundles sent as one request each; idle
+    // workers steal those from the back of the other queues. Files the
+    // receiver holds part of are a task of their own covering just the gaps.
+    struct UploadTask {
+        std::vector<size_t> files;
+        std::vector<RangeSet::Range> ranges; // set for a partially received file
+        uint64_t bytes = 0;                  // bytes this task sends
+        uint64_t held = 0;                   // bytes of a partial file the receiver already has
+        bool delta = false;                  // sent as a delta against the receiver's older copy
+    };
+    
+    std::vector<size_t> order;
+    for (size_t index = 0; index < request.files.size(); ++index) {
+        if (needed[index]) {
+            order.push_back(index);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return request.files[a].size > request.files[b].size;
+    });
+    
+    std::vector<UploadTask> tasks;
+    uint64_t bundle_bytes = 0;
+    bool bundling = false;
+    for (size_t index : order) {
+        uint64_t size = request.files[index].size;
+        bool whole = missing[index].empty() || (missing[index].size() == 1 && missing[index][0].second == size);
+        if (!whole) {
+            UploadTask task;
+            task.files = {index};
+            task.ranges = missing[index];
+            for (const auto& range : task.ranges) {
+                task.bytes += range.second;
+            }
+            task.held = size - std::min(size, task.bytes);
+            tasks.push_back(task);
+            bundling = false; // small files after it start a bundle of their own
+            continue;
+        }
+        if (size >= SMALL_FILE_THRESHOLD) {
+            UploadTask task;
+            task.files = {index};
+            task.bytes = size;
+            task.delta = remote_status && remote_status->files[index].delta_basis;
+            tasks.push_back(task);
+            bundling = false;
+            continue;
+        }
+        if (!bundling || bundle_bytes + size > BUNDLE_MAX_BYTES || tasks.back().files.size() >= BUNDLE_MAX_FILES) {
+            tasks.emplace_back();
+            bundle_bytes = 0;
+            bundling = true;
+        }
+        tasks.back().files.push_back(index);
+        tasks.back().bytes += size;
+        bundle_bytes += size;
+    }
+    
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t remaining = tasks.size();
+    std::atomic<bool> failed{false};
+    std::vector<uint64_t> task_sent(tasks.size(), 0); // guarded by state->mutex
+    
+    for (size_t task_index = 0; task_index < tasks.size(); ++task_index) {
+        upload_pool_->submit([&, task_index]() {
+            const UploadTask& task = tasks[task_index];
+            
+            // The bandwidth limits are charged here, in every send loop, for what
+            // each step sent; a delta charges its literal bytes itself instead
+            bool paced = !task.delta;
+            auto report_progress = [&](uint64_t bytes_sent) {
+                if (outgoing->cancelled || failed) {
+                    return false;
+                }
+                
+                // Bundle progress includes frame headers, which aren't file bytes
+                bytes_sent = std::min(bytes_sent, task.bytes);
+                
+                TransferStats stats;
+                uint64_t advanced = 0;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (state->finished) {
+                        return false;
+                    }
+                    TransferInfo& transfer = state->info;
+                    transfer.transferred_bytes = transfer.transferred_bytes - task_sent[task_index] + bytes_sent;
+                    advanced = bytes_sent - std::min(bytes_sent, task_sent[task_index]);
+                    task_sent[task_index] = bytes_sent;
+                    
+                    // A bundle sends its files back to back
+                    uint64_t left = task.held + bytes_sent;
+                    for (size_t index : task.files) {
+                        uint64_t part = std::min(left, request.files[index].size);
+                        state->file_progress[index] = part;
+                        left -= part;
+                    }
+                    
+                    record_progress(*state);
+                    stats = snapshot_stats(*state, false);
+                }
+                update_transfer_progress(transfer_id, stats);
+                return !paced || throttle(*state, advanced);
+            };
+            
+            if (!failed && !outgoing->cancelled) {
+                APIResponse upload;
+                size_t first = task.files.front();
+                if (!task.ranges.empty()) {
+                    uint64_t range_base = 0;
+                    for (const auto& [offset, length] : task.ranges) {
+                        upload = api_client_->upload_file_range(
+                            outgoing->peer_host, outgoing->peer_port, outgoing->peer_fingerprint,
+                            remote_transfer_id, static_cast<int>(first), outgoing->source_paths[first],
+                            offset, length, outgoing->bulk_io, compressor_for(*outgoing, request, task.files),
+                            [&, range_base](uint64_t bytes_sent) { return report_progress(range_base + bytes_sent); });
+                        if (!upload.success) {
+                            break;
+                        }
+                        range_base += length;
+                    }
+                } else if (task.delta) {
+                    upload = upload_delta_file(*state, remote_transfer_id, *outgoing, static_cast<int>(first),
+                                               request.files[first], report_progress);
+                    if (!upload.success && !outgoing->cancelled && !failed) {
+                        // The receiver's copy may have changed or gone; send the whole file instead
+                        LOG_TRANSFER_WARN() << "Delta of " << request.files[first].name << " failed ("
+                                            << upload.error_message << "), sending it whole";
+                        paced = true;
+                        upload = upload_outgoing_file(transfer_id, remote_transfer_id, *outgoing,
+                                                      static_cast<int>(first), request.files[first], report_progress);
+                    }
+                } else if (request.files[first].size >= SMALL_FILE_THRESHOLD) {
+                    upload = upload_outgoing_file(transfer_id, remote_transfer_id, *outgoing,
+                                                  static_cast<int>(first), request.files[first], report_progress);
+                } else {
+                    std::vector<BundleEntry> entries;
+                    for (size_t index : task.files) {
+                        entries.push_back({static_cast<int>(index), outgoing->source_paths[index],
+                                           request.files[index].size});
+                    }
+                    upload = api_client_->upload_bundle(outgoing->peer_host, outgoing->peer_port,
+                                                        outgoing->peer_fingerprint, remote_transfer_id,
+                                                        entries, outgoing->bulk_io,
+                                                        compressor_for(*outgoing, request, task.files),
+                                                        report_progress);
+                }
+                
+                if (upload.success) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->info.completed_files += task.files.size();
+                    for (size_t index : task.files) {
+                        state->file_progress[index] = request.files[index].size;
+                        
+                        // The receiver copied the file's duplicates as it landed
+                        auto copied = copies.find(index);
+                        if (copied == copies.end()) {
+                            continue;
+                        }
+                        for (size_t copy : copied->second) {
+                            uint64_t size = request.files[copy].size;
+                            state->info.transferred_bytes += size - std::min(size, state->file_progress[copy]);
+                            state->file_progress[copy] = size;
+                            state->info.completed_files++;
+                        }
+                    }
+                } else if (!outgoing->cancelled && !failed.exchange(true)) {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    error_message = "Failed to send " + request.files[first].name +
+                                    (task.files.size() > 1 ?
+                                        " and " + std::to_string(task.files.size() - 1) + " other file(s)" : "") +
+                                    ": " + upload.error_message;
+                }
+            }
+            
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if (--remaining == 0) {
+                done_cv.notify_all();
+            }
+        });
+    }
+    
+    {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&]() { return remaining == 0; });
+    }
+    
+    return !failed && !outgoing->cancelled;
+}
+
+bool TransferManager::confirm_received(const OutgoingTransfer& outgoing, const std::string& remote_transfer_id,
+                                       std::string& error_message) {
+    APIResponse response = api_client_->get_transfer_status(outgoing.peer_host, outgoing.peer_port,
+                                                            outgoing.peer_fingerprint, remote_transfer_id);
+    TransferReceiveStatus status;
+    if (response.success && utils::parse_transfer_receive_status(response.body, status) &&
+        status.status == "completed") {
+        return true;
+    }
+    
+    error_message = response.success ? "Receiver discarded data that failed verification"
+                                     : "Cannot confirm delivery: " + response.error_message;
+    return false;
+}
+
+APIResponse TransferManager::upload_outgoing_file(const std::string& transfer_id, const std::string& remote_transfer_id,
+                                                  const OutgoingTransfer& outgoing, int file_index, const FileMetadata& file,
+                                                  std::function<bool(uint64_t bytes_sent)> progress_callback) {
+    const std::string& source_path = outgoing.source_paths[file_index];
+    TransferCompressor* compressor = is_precompressed_file(file.name) ? nullptr : outgoing.compressor.get();
+    
+    if (file.size >= PARALLEL_UPLOAD_THRESHOLD) {
+        MultiStreamUploader uploader(*api_client_, outgoing.peer_host, outgoing.peer_port,
+                                     outgoing.peer_fingerprint, outgoing.bulk_io, compressor);
+        return uploader.upload(remote_transfer_id, file_index, source_path, file.size, file.chunk_size,
+                               progress_callback,
+                               [&](const std::vector<StreamStats>& streams) {
+                                   if (stream_stats_callback_) {
+                                       stream_stats_callback_(transfer_id, file_index, streams);
+                                   }
+                               });
+    }
+    
+    return api_client_->upload_file_range(outgoing.peer_host, outgoing.peer_port, outgoing.peer_fingerprint,
+                                          remote_transfer_id, file_index, source_path, 0, file.size,
+                                          outgoing.bulk_io, compressor, progress_callback);
+}
+
+APIResponse TransferManager::upload_delta_file(TransferState& state, const std::string& remote_transfer_id,
+                                               const OutgoingTransfer& outgoing, int file_index,
+                                               const FileMetadata& file,
+                                               std::function<bool(uint64_t bytes_sent)> progress_callback) {
+    APIResponse response = api_client_->get_delta_signature(outgoing.peer_host, outgoing.peer_port,
+                                                            outgoing.peer_fingerprint, remote_transfer_id, file_index);
+    if (!response.success) {
+        return response;
+    }
+    
+    DeltaSignature signature;
+    if (!parse_delta_signature(response.body, signature)) {
+        response.success = false;
+        response.error_message = "Invalid delta signature from peer";
+        return response;
+    }
+    DeltaEncoder encoder(signature);
+    if (!encoder.open(outgoing.source_paths[file_index], file.size, outgoing.bulk_io)) {
+        response.success = false;
+        response.error_message = "Cannot open " + outgoing.source_paths[file_index];
+        return response;
+    }
+    
+    // Literal runs may still compress. They are what the bandwidth limits are
+    // charged for; the ops that copy basis blocks are a few bytes each.
+    TransferCompressor* compressor = is_precompressed_file(file.name) ? nullptr : outgoing.compressor.get();
+    uint64_t charged = 0;
+    response = api_client_->upload_delta(outgoing.peer_host, outgoing.peer_port, outgoing.peer_fingerprint,
+                                         remote_transfer_id, file_index, encoder, compressor,
+                                         [&](uint64_t bytes_sent) {
+                                             uint64_t literal = encoder.literal_bytes();
+                                             bool within = throttle(state, literal - charged);
+                                             charged = literal;
+                                             return within && progress_callback(bytes_sent);
+                                         });
+    if (response.success) {
+        LOG_TRANSFER_INFO() << "Sent " << file.name << " as a delta: " << encoder.literal_bytes() << " of "
+                            << file.size << " bytes were new";
+    }
+    return response;
+}
+
+TransferCompressor* TransferManager::compressor_for(const OutgoingTransfer& outgoing, const TransferRequest& request,
+                                                    const std::vector<size_t>& files) {
+    if (!outgoing.compressor) {
+        return nullptr;
+    }
+    for (size_t index : files) {
+        if (!is_precompressed_file(request.files[index].name)) {
+            return outgoing.compressor.get();
+        }
+    }
+    return nullptr;
+}
+
+void TransferManager::finish_outgoing_transfer(const std::string& transfer_id, TransferState& state,
+                                               bool success, const std::string& error_message) {
+    uint64_t completed_files = 0;
+    double elapsed_seconds = 0.0;
+    std::vector<std::string> temp_paths;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return;
+        }
+        
+        elapsed_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - state.outgoing->started_at).count();
+        completed_files = state.info.completed_files;
+        
+        state.info.status = success ? TransferStatus::COMPLETED : TransferStatus::FAILED;
+        temp_paths = retire_transfer(state);
+    }
+    cleanup_transfer(transfer_id, temp_paths);
+    
+    if (success) {
+        LOG_TRANSFER_INFO() << "Transfer " << transfer_id << " completed: " << completed_files << " file(s) in "
+                            << elapsed_seconds << " s ("
+                            << (elapsed_seconds > 0 ? completed_files / elapsed_seconds : 0.0) << " files/s)";
+        if (api_client_) {
+            LOG_TRANSFER_DEBUG() << "Send paths so far: " << api_client_->get_zero_copy_bytes() << " bytes zero-copy, "
+                                 << api_client_->get_copied_bytes() << " bytes buffered";
+        }
+    } else {
+        LOG_TRANSFER_ERROR() << "Transfer " << transfer_id << " failed: " << error_message;
+    }
+    
+    if (completion_callback_) {
+        completion_callback_(transfer_id, success, error_message);
+    }
+}
+
+std::string TransferManager::temporary_directory() const {
+    return download_folder_ + "/.warpdeck_temp";
+}
+
+std::string TransferManager::temporary_file_path(const std::string& transfer_id, int file_index) const {
+    return temporary_directory() + "/" + transfer_id + "_" + std::to_string(file_index) + ".tmp";
+}
+
+std::string TransferManager::create_temporary_file(const std::string& transfer_id, int file_index, uint64_t file_size) {
+    if (!utils::create_directory(temporary_directory())) {
+        return "";
+    }
+    
+    std::string temp_path = temporary_file_path(transfer_id, file_index);
+    
+    // Create the temporary file at its final size so chunks can be written at any offset
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return "";
+    }
+    
+    bool allocated = utils::preallocate_file(fd, file_size);
+    ::close(fd);
+    if (!allocated) {
+        LOG_TRANSFER_ERROR() << "Cannot allocate " << file_size << " bytes for " << temp_path;
+        std::remove(temp_path.c_str());
+        return "";
+    }
+    
+    return temp_path;
+}
+
+bool TransferManager::finalize_received_file(const std::string& temp_path, const std::string& final_path,
+                                             const FileMetadata& file, const std::vector<bool>& verified,
+                                             bool bulk_io, std::vector<uint64_t>& corrupt_chunks) {
+    corrupt_chunks.clear();
+    
+    // Most leaves were checked as they were written; only those no single
+    // request covered whole, or that arrived before a restart, are read back
+    if (!file.chunk_hashes.empty()) {
+        std::vector<uint64_t> unverified;
+        for (uint64_t index = 0; index < file.chunk_hashes.size(); ++index) {
+            if (index >= verified.size() || !verified[index]) {
+                unverified.push_back(index);
+            }
+        }
+        
+        std::vector<std::string> hashes;
+        if (!unverified.empty() &&
+            !hasher_->hash_chunks(temp_path, file.size, file.chunk_size, unverified, bulk_io, hashes)) {
+            return false;
+        }
+        for (size_t i = 0; i < unverified.size(); ++i) {
+            if (hashes[i] != file.chunk_hashes[unverified[i]]) {
+                corrupt_chunks.push_back(unverified[i]);
+            }
+        }
+        
+        if (!corrupt_chunks.empty()) {
+            LOG_TRANSFER_ERROR() << file.name << " failed verification: " << corrupt_chunks.size() << " of "
+                                 << file.chunk_hashes.size() << " chunk(s) do not match";
+            return false;
+        }
+        LOG_TRANSFER_DEBUG() << "Verified " << file.name << ", " << unverified.size() << " of "
+                             << file.chunk_hashes.size() << " chunk(s) read back";
+    }
+    
+    try {
+        // Ensure destination directory exists
+        std::string dest_dir = utils::get_parent_directory(final_path);
+        if (!utils::create_directory(dest_dir)) {
+            return false;
+        }
+        
+        // Move temporary file to final destination
+        std::filesystem::rename(temp_path, final_path);
+        
+        // A synced file keeps the sender's modification time, and its hash is
+        // cached so the next sync of this folder needn't read it back
+        if (file.mtime_ns > 0 && !file.chunk_hashes.empty()) {
+            struct timespec times[2];
+            times[0].tv_sec = 0;
+            times[0].tv_nsec = UTIME_OMIT;
+            times[1].tv_sec = static_cast<time_t>(file.mtime_ns / 1000000000);
+            times[1].tv_nsec = static_cast<long>(file.mtime_ns % 1000000000);
+            FileIdentity identity;
+            if (::utimensat(AT_FDCWD, final_path.c_str(), times, 0) == 0 &&
+                HashCache::identify(final_path, identity)) {
+                TreeHash hash;
+                hash.root = file.hash;
+                hash.chunk_size = file.chunk_size;
+                hash.chunk_hashes = file.chunk_hashes;
+                hash_cache_.store(identity, hash);
+            }
+        }
+        
+        // Without reflinks the copy into the store can outlast the sender's
+        // read timeout, so it must not hold up the upload's response
+        if (chunk_store_.is_open() && !file.chunk_hashes.empty()) {
+            chunk_store_pool_->submit([this, final_path, file]() {
+                chunk_store_.store_file(final_path, file);
+            });
+        }
+        return true;
+    
+    } catch (const std::exception& e) {
+        std::cerr << "Error finalizing file: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool TransferManager::copy_duplicate(const std::string& source_path, const std::string& temp_path, uint64_t size) {
+    struct stat st;
+    if (::stat(source_path.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != size) {
+        return false;
+    }
+    
+    // Never write through an earlier attempt's hardlink to the source
+    std::error_code error;
+    std::filesystem::remove(temp_path, error);
+    if (hardlink_duplicates_ && ::link(source_path.c_str(), temp_path.c_str()) == 0) {
+        return true;
+    }
+    
+    // Without hardlinks, or where they fail (another filesystem, FAT), the data is
+    // copied; copy_file_data makes that a reflink where the filesystem has them
+    int in_fd = ::open(source_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        return false;
+    }
+    int out_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool copied = out_fd >= 0 && utils::copy_file_data(in_fd, 0, out_fd, 0, size);
+    if (out_fd >= 0) {
+        ::close(out_fd);
+    }
+    ::close(in_fd);
+    return copied;
+}
+
+std::vector<std::string> TransferManager::retire_transfer(TransferState& state) {
+    state.finished = true;
+    
+    // Stop any sender thread still working on this transfer
+    if (state.outgoing) {
+        state.outgoing->cancelled = true;
+    }
+    
+    state.received_ranges.clear();
+    state.file_completed.clear();
+    state.file_progress.clear();
+    state.duplicates.clear();
+    
+    std::vector<std::string> paths = std::move(state.temp_paths);
+    if (state.journal) {
+        paths.push_back(state.journal->path());
+        state.journal.reset();
+    }
+    return paths;
+}
+
+void TransferManager::cleanup_transfer(const std::string& transfer_id, const std::vector<std::string>& temp_paths) {
+    // Remove from active transfers
+    {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        transfers_.erase(transfer_id);
+    }
+    
+    // Remove temporary files; finalized ones were already moved away
+    for (const auto& temp_path : temp_paths) {
+        try {
+            if (utils::file_exists(temp_path)) {
+                std::filesystem::remove(temp_path);
+            }
+        } catch (const std::exception&) {
+            // Ignore cleanup errors
+        }
+    }
+}
+
+bool TransferManager::add_received_bytes(const std::string& transfer_id, TransferState& state,
+                                         int file_index, uint64_t bytes) {
+    TransferStats stats;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return false;
+        }
+        state.info.transferred_bytes += bytes;
+        if (file_index >= 0) {
+            state.file_progress[file_index] += bytes;
+        }
+        record_progress(state);
+        stats = snapshot_stats(state, false);
+    }
+    
+    update_transfer_progress(transfer_id, stats);
+    return true;
+}
+
+bool TransferManager::throttle(TransferState& state, uint64_t bytes) {
+    uint64_t version = limits_version_;
+    if (version == 0 || bytes == 0) {
+        return true;
+    }
+    
+    std::string peer_device_id;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished) {
+            return false;
+        }
+        peer_device_id = state.limit_peer_id;
+    }
+    std::shared_ptr<TokenBucket> peer_limit;
+    {
+        std::lock_guard<std::mutex> lock(peer_limits_mutex_);
+        auto it = peer_limits_.find(peer_device_id);
+        if (it != peer_limits_.end()) {
+            peer_limit = it->second;
+        }
+    }
+    
+    // Every limit that applies is charged; the strictest sets the wait
+    std::chrono::nanoseconds wait = std::max(bandwidth_limit_.take(bytes), state.bandwidth_limit.take(bytes));
+    if (peer_limit) {
+        wait = std::max(wait, peer_limit->take(bytes));
+    }
+    if (wait < MIN_THROTTLE_WAIT) {
+        return true;
+    }
+    
+    // A changed limit ends the wait; the new rate starts with a full bucket
+    auto deadline = std::chrono::steady_clock::now() + wait;
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline || limits_version_ != version) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(deadline - now, THROTTLE_STEP));
+        
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.finished || (state.outgoing && state.outgoing->cancelled)) {
+            return false;
+        }
+    }
+}
+
+BodyReader TransferManager::paced_body_reader(const std::string& transfer_id, const BodyReader& read_body) {
+    auto state = find_transfer(transfer_id);
+    if (!state) {
+        return read_body; // The receive itself turns the request down
+    }
+    return [this, state, &read_body](std::function<bool(const char*, size_t)> receiver) {
+        return read_body([&](const char* data, size_t length) {
+            return throttle(*state, length) && receiver(data, length);
+        });
+    };
+}
+
+void TransferManager::update_transfer_progress(const std::string& transfer_id, const TransferStats& stats) {
+    if (progress_callback_) {
+        progress_callback_(transfer_id, stats);
+    }
+}
+
+void TransferManager::start_rate_meter(TransferState& state) {
+    RateMeter& rate = state.rate;
+    auto now = std::chrono::steady_clock::now();
+    rate.started = true;
+    rate.started_at = now;
+    rate.sampled_at = now;
+    rate.progressed_at = now;
+    rate.sampled_bytes = state.info.transferred_bytes;
+    rate.bytes_per_second = 0.0;
+}
+
+void TransferManager::record_progress(TransferState& state) {
+    if (!state.rate.started) {
+        start_rate_meter(state);
+    }
+    
+    RateMeter& rate = state.rate;
+    auto now = std::chrono::steady_clock::now();
+    rate.progressed_at = now;
+    
+    // Fold the bytes since the last sample into the average once enough time
+    // has passed for the instantaneous rate to mean something
+    std::chrono::duration<double> elapsed = now - rate.sampled_at;
+    if (elapsed < RATE_SAMPLE_INTERVAL) {
+        return;
+    }
+    
+    uint64_t transferred = state.info.transferred_bytes;
+    double instant = transferred > rate.sampled_bytes ?
+        (transferred - rate.sampled_bytes) / elapsed.count() : 0.0;
+    if (rate.sampled_at == rate.started_at) {
+        rate.bytes_per_second = instant; // First sample seeds the average
+    } else {
+        double weight = 1.0 - std::exp(-elapsed.count() / RATE_TIME_CONSTANT_SECONDS);
+        rate.bytes_per_second += weight * (instant - rate.bytes_per_second);
+    }
+    rate.sampled_at = now;
+    rate.sampled_bytes = transferred;
+}
+
+TransferStats TransferManager::snapshot_stats(const TransferState& state, bool include_files) {
+    const TransferInfo& info = state.info;
+    const RateMeter& rate = state.rate;
+    auto now = std::chrono::steady_clock::now();
+    
+    TransferStats stats;
+    stats.transfer_id = info.transfer_id;
+    stats.total_bytes = info.total_bytes;
+    stats.transferred_bytes = info.transferred_bytes;
+    stats.total_files = info.file_count;
+    stats.completed_files = info.completed_files;
+    stats.progress_percent = info.total_bytes > 0 ?
+        std::min(100.0f, (static_cast<float>(info.transferred_bytes) / info.total_bytes) * 100.0f) : 0.0f;
+    if (include_files) {
+        stats.file_transferred_bytes = state.file_progress;
+    }
+    if (state.outgoing && state.outgoing->compressor) {
+        CompressionStats compression = state.outgoing->compressor->stats();
+        stats.compression = compression_codec_name(state.outgoing->compressor->codec());
+        if (compression.wire_bytes > 0) {
+            stats.compression_ratio = static_cast<double>(compression.raw_bytes) / compression.wire_bytes;
+        }
+        stats.compression_cpu_seconds = compression.cpu_seconds;
+    }
+    
+    if (!rate.started) {
+        return stats;
+    }
+    stats.elapsed_seconds = std::chrono::duration<double>(now - rate.started_at).count();
+    
+    // Bytes not folded in yet, or none at all while stalled, pull the average
+    // toward their rate as if a sample were taken now
+    double bytes_per_second = rate.bytes_per_second;
+    std::chrono::duration<double> since_sample = now - rate.sampled_at;
+    if (since_sample >= RATE_SAMPLE_INTERVAL) {
+        double instant = info.transferred_bytes > rate.sampled_bytes ?
+            (info.transferred_bytes - rate.sampled_bytes) / since_sample.count() : 0.0;
+        double weight = 1.0 - std::exp(-since_sample.count() / RATE_TIME_CONSTANT_SECONDS);
+        bytes_per_second = rate.sampled_at == rate.started_at ?
+            instant : bytes_per_second + weight * (instant - bytes_per_second);
+    }
+    stats.bytes_per_second = bytes_per_second;
+    
+    uint64_t remaining = info.total_bytes - std::min(info.total_bytes, info.transferred_bytes);
+    if (remaining == 0) {
+        stats.eta_seconds = 0.0;
+    } else if (bytes_per_second > 0.0) {
+        stats.eta_seconds = remaining / bytes_per_second;
+    }
+    
+    bool running = info.status == TransferStatus::APPROVED || info.status == TransferStatus::IN_PROGRESS;
+    stats.stalled = running && remaining > 0 && now - rate.progressed_at >= STALL_TIMEOUT;
+    return stats;
 }
 
 } // namespace warpdeck
\ No newline at end of file
@@ -2,20 +2,53 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <functional>
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
 #include "api_server.h"
+#include "multi_stream_uploader.h"
+#include "worker_pool.h"
+#include "tree_hash.h"
+#include "hash_cache.h"
+#include "chunk_store.h"
+#include "token_bucket.h"
+#include "compression.h"
+#include "transfer_journal.h"
+#include "directory_walker.h"
 
 namespace warpdeck {
 
+class APIClient;
+
 enum class TransferDirection {
     SENDING,
     RECEIVING
 };
 
+// Page cache policy for a transfer's file I/O; AUTO turns bulk mode on for
+// transfers of at least BULK_IO_THRESHOLD bytes
+enum class BulkIOMode {
+    AUTO,
+    ENABLED,
+    DISABLED
+};
+
+// What a send does about files the receiver already has: COPY sends everything,
+// SYNC skips files whose content matches, MIRROR also deletes the files under
+// the sent directories that the sender doesn't have
+enum class SyncMode {
+    COPY,
+    SYNC,
+    MIRROR
+};
+
 enum class TransferStatus {
     PENDING_APPROVAL,
     APPROVED,
@@ -31,59 +64,359 @@ struct TransferInfo {
     std::string peer_name;
     TransferDirection direction;
     TransferStatus status;
-    std::vector<FileMetadata> files;
+    std::vector<FileMetadata> files;  // a receive lists only the manifest pages that arrived
+    uint64_t file_count;              // files in the whole manifest
     uint64_t total_bytes;
     uint64_t transferred_bytes;
+    uint64_t completed_files;
+    bool bulk_io;
+    bool sync;            // mirror mode; see TransferRequest
+    bool delete_extras;
     std::string error_message;
     std::string destination_folder;
 };
 
+// Point-in-time view of a transfer's progress. The rate is an exponentially
+// weighted moving average of the byte count over the monotonic clock.
+struct TransferStats {
+    std::string transfer_id;
+    uint64_t total_bytes = 0;
+    uint64_t transferred_bytes = 0;
+    uint64_t total_files = 0;
+    uint64_t completed_files = 0;
+    float progress_percent = 0.0f;
+    double bytes_per_second = 0.0;
+    double eta_seconds = -1.0;      // negative until a rate has been measured
+    double elapsed_seconds = 0.0;
+    bool stalled = false;           // no bytes moved for STALL_TIMEOUT
+    std::string compression;        // codec of block-encoded uploads; empty if sent raw
+    double compression_ratio = 1.0; // bytes encoded per byte on the wire
+    double compression_cpu_seconds = 0.0;
+    std::vector<uint64_t> file_transferred_bytes;  // per file; only filled by get_transfer_stats
+};
+
 class TransferManager {
 public:
-    using ProgressCallback = std::function<void(const std::string& transfer_id, float progress_percent, uint64_t bytes_transferred)>;
+    using ProgressCallback = std::function<void(const std::string& transfer_id, const TransferStats& stats)>;
     using CompletionCallback = std::function<void(const std::string& transfer_id, bool success, const std::string& error_message)>;
-    using IncomingRequestCallback = std::function<void(const std::string& transfer_id, const std::string& peer_name, const std::vector<FileMetadata>& files)>;
+    using IncomingRequestCallback = std::function<void(const std::string& transfer_id, const std::string& peer_name, const TransferRequest& request)>;
+    using StreamStatsCallback = std::function<void(const std::string& transfer_id, int file_index, const std::vector<StreamStats>& streams)>;
 
+    // Files at least this large are sent over several parallel connections
+    static constexpr uint64_t PARALLEL_UPLOAD_THRESHOLD = 64 * 1024 * 1024;
+    
+    // Files uploaded concurrently, shared by all outgoing transfers
+    static constexpr size_t UPLOAD_WORKER_COUNT = 4;
+    
+    // Files smaller than this are packed into bundles of up to BUNDLE_MAX_BYTES / BUNDLE_MAX_FILES
+    static constexpr uint64_t SMALL_FILE_THRESHOLD = 256 * 1024;
+    static constexpr uint64_t BUNDLE_MAX_BYTES = 8 * 1024 * 1024;
+    static constexpr size_t BUNDLE_MAX_FILES = 1024;
+    
+    // A sync sends files at least this large that the receiver holds an older
+    // copy of as a delta against that copy (see delta.h)
+    static constexpr uint64_t DELTA_MIN_SIZE = 16 * 1024 * 1024;
+    
+    // Threads listing directories when a transfer is initiated
+    static constexpr size_t DIRECTORY_WALK_THREADS = 8;
+    
+    // Transfers this large stream through the page cache without evicting it
+    static constexpr uint64_t BULK_IO_THRESHOLD = 1024ULL * 1024 * 1024;
+    
+    // Throughput is resampled at most this often and smoothed with this time
+    // constant; a running transfer counts as stalled after STALL_TIMEOUT without bytes
+    static constexpr std::chrono::milliseconds RATE_SAMPLE_INTERVAL{250};
+    static constexpr double RATE_TIME_CONSTANT_SECONDS = 3.0;
+    static constexpr std::chrono::seconds STALL_TIMEOUT{10};
+
+    // An interrupted upload asks the receiver what it has and resends the rest,
+    // up to RESUME_ATTEMPTS times with a doubling backoff
+    static constexpr int RESUME_ATTEMPTS = 6;
+    static constexpr std::chrono::seconds RESUME_BACKOFF{2};
+    static constexpr std::chrono::seconds RESUME_BACKOFF_MAX{30};
+    
+    // Bandwidth limits are waited out in steps of at most THROTTLE_STEP, so a
+    // cancel or a changed limit takes effect promptly; waits shorter than
+    // MIN_THROTTLE_WAIT aren't slept but add up until one is long enough
+    static constexpr std::chrono::milliseconds THROTTLE_STEP{100};
+    static constexpr std::chrono::microseconds MIN_THROTTLE_WAIT{1000};
+    
+    // Receive journals older than this are discarded along with their temp files
+    static constexpr std::chrono::hours JOURNAL_MAX_AGE{7 * 24};
+    
+    // Completed receives answer status queries for a while, so a sender whose
+    // last response was lost learns that everything arrived
+    static constexpr size_t RECENTLY_COMPLETED_LIMIT = 64;
+    
     TransferManager();
     ~TransferManager();
 
     void set_download_folder(const std::string& folder);
+    // This device's discovery ID, which outgoing requests name their sender by
+    void set_device_id(const std::string& device_id);
+    // Remembers file hashes across runs in `directory`; without it every send rehashes
+    bool open_hash_cache(const std::string& directory);
+    // Keeps up to max_size bytes of received chunks in `directory` to rebuild later
+    // receives from (see ChunkStore); 0 turns the store off and empties it
+    bool set_chunk_store(const std::string& directory, uint64_t max_size);
+    // Files a sender marks as repeating another file's content are copied from
+    // that file once it lands (as a reflink where the filesystem has them);
+    // allowing hardlinks makes them share its inode instead, so that editing
+    // one edits all of them
+    void set_hardlink_duplicates(bool allow);
+    // Bandwidth limits in bytes per second, 0 for none: for all transfers
+    // together, per peer device and per transfer, each counting sends and
+    // receives alike. A transfer moves at the strictest limit that applies.
+    // A receive counts against the peer its request names. Nothing proves
+    // that claim, so it only picks the limit; the peer the receive is shown
+    // and journaled as is the one handle_incoming_request is given.
+    // Sends count file bytes before compression, and deltas only their
+    // literals. Limits may change at any time, mid-transfer included.
+    void set_bandwidth_limit(uint64_t bytes_per_second);
+    void set_peer_bandwidth_limit(const std::string& peer_device_id, uint64_t bytes_per_second);
+    bool set_transfer_bandwidth_limit(const std::string& transfer_id, uint64_t bytes_per_second);
     void set_progress_callback(ProgressCallback callback);
     void set_completion_callback(CompletionCallback callback);
     void set_incoming_request_callback(IncomingRequestCallback callback);
+    void set_api_client(APIClient* api_client);
+    void set_stream_stats_callback(StreamStatsCallback callback);
+    
+    // Picks up receives that were interrupted by a restart from their journals
+    // in the download folder; they continue as soon as the sender reconnects
+    void restore_interrupted_transfers();
 
-    // Outgoing transfers
+    // Outgoing transfers; directories among file_paths are sent with everything under them
     std::string initiate_transfer(const std::string& peer_device_id, const std::string& peer_name,
-                                 const std::vector<std::string>& file_paths);
+                                 const std::string& peer_host, int peer_port,
+                                 const std::string& peer_fingerprint,
+                                 const std::vector<std::string>& file_paths,
+                                 BulkIOMode bulk_io_mode, bool allow_compression, SyncMode sync_mode);
     
     // Incoming transfers
     std::string handle_incoming_request(const std::string& peer_device_id, const std::string& peer_name,
                                        const TransferRequest& request);
     void respond_to_transfer(const std::string& transfer_id, bool accept);
+    // Appends a page of an accepted receive's manifest; pages the receive already has are ignored
+    bool handle_manifest_page(const std::string& transfer_id, uint64_t first_file,
+                              const std::vector<FileMetadata>& files);
+    
+    // Blocks until the user answers the request; returns true if it was accepted
+    bool wait_for_response(const std::string& transfer_id, std::chrono::seconds timeout);
+    
+    // File upload handling: streams the request body straight into the file's temp file
+    bool handle_file_upload(const std::string& transfer_id, int file_index,
+                            uint64_t content_length, const BodyReader& read_body);
     
-    // File upload handling
-    bool handle_file_upload(const std::string& transfer_id, int file_index, const std::vector<uint8_t>& data);
+    // Offset-addressed chunk handling: writes the body at [offset, offset + length)
+    // of the preallocated temp file, so chunks may arrive in any order
+    bool handle_chunk_upload(const std::string& transfer_id, int file_index,
+                             uint64_t offset, uint64_t length, const BodyReader& read_body);
+    
+    // Unpacks a framed bundle of small files (see BUNDLE_FRAME_HEADER_SIZE) as it streams in
+    bool handle_bundle_upload(const std::string& transfer_id, const BodyReader& read_body);
+    
+    // Delta uploads: the signature of the destination's older copy of a file,
+    // then the delta that rebuilds the file from it into the temp file
+    bool get_delta_signature(const std::string& transfer_id, int file_index, std::string& signature);
+    bool handle_delta_upload(const std::string& transfer_id, int file_index, const BodyReader& read_body);
+    
+    // What a receive holds so far, for the status endpoint
+    bool get_receive_status(const std::string& transfer_id, TransferReceiveStatus& status) const;
     
     // Transfer management
     void cancel_transfer(const std::string& transfer_id);
     std::map<std::string, TransferInfo> get_active_transfers() const;
     TransferInfo get_transfer_info(const std::string& transfer_id) const;
+    // Includes per-file progress; false if the transfer is unknown or already finished
+    bool get_transfer_stats(const std::string& transfer_id, TransferStats& stats) const;
 
 private:
+    // Sender-side state that lives alongside the TransferInfo of an outgoing transfer
+    struct OutgoingTransfer {
+        std::string peer_host;
+        int peer_port;
+        std::string peer_fingerprint;
+        std::vector<std::string> source_paths;
+        std::vector<FileIdentity> identities; // of source_paths when walked, for the hash cache
+        // Tree hash root -> first file with that content; guarded by the state's mutex
+        std::unordered_map<std::string, size_t> content_files;
+        bool bulk_io = false;
+        bool compression = false; // offer the receiver block-encoded uploads
+        // Set under the state's mutex once the receiver accepts a codec
+        std::shared_ptr<TransferCompressor> compressor;
+        std::chrono::steady_clock::time_point started_at;
+        std::atomic<bool> cancelled{false};
+    };
+    
+    // Feeds TransferStats; guarded by the owning TransferState's mutex
+    struct RateMeter {
+        bool started = false;
+        std::chrono::steady_clock::time_point started_at;
+        std::chrono::steady_clock::time_point sampled_at;     // last EWMA update
+        std::chrono::steady_clock::time_point progressed_at;  // last time bytes moved
+        uint64_t sampled_bytes = 0;
+        double bytes_per_second = 0.0;
+    };
+    
+    // Everything tracked for one transfer. transfers_mutex_ only guards the map;
+    // each transfer's own mutex guards its state, so concurrent transfers never
+    // wait on each other. Neither lock is held across disk I/O or callbacks.
+    struct TransferState {
+        std::mutex mutex;
+        std::condition_variable response_cv;
+        TransferInfo info;
+        std::vector<std::string> temp_paths;
+        std::vector<RangeSet> received_ranges;  // per file, the ranges written to its temp file
+        std::vector<bool> file_completed;       // set once a file is claimed for finalizing
+        std::vector<std::vector<bool>> verified_chunks; // per file, leaves whose hash matched on the way in
+        std::vector<uint64_t> file_progress;    // per file, bytes sent or received so far
+        // Per file still to land, the duplicates of it waiting to be copied from it (receives only)
+        std::unordered_map<size_t, std::vector<size_t>> duplicates;
+        TokenBucket bandwidth_limit; // this transfer's own; locks itself
+        std::string limit_peer_id;   // the peer whose bandwidth limit applies
+        RateMeter rate;
+        std::shared_ptr<OutgoingTransfer> outgoing;
+        std::shared_ptr<TransferJournal> journal; // receives only
+        bool responding = false;  // temp files are being created for an accepted request
+        bool extending = false;   // temp files are being created for a manifest page
+        bool finished = false;    // being removed from the map; uploads must stop touching it
+    };
+    
     std::string generate_transfer_id();
-    bool create_temporary_file(const std::string& transfer_id, int file_index);
-    bool finalize_received_file(const std::string& transfer_id, int file_index);
-    void cleanup_transfer(const std::string& transfer_id);
-    void update_transfer_progress(const std::string& transfer_id);
+    std::shared_ptr<TransferState> find_transfer(const std::string& transfer_id) const;
+    void run_outgoing_transfer(const std::string& transfer_id, std::shared_ptr<TransferState> state);
+    // Fills in the tree hashes of files [begin, end), from the hash cache where it can
+    bool hash_outgoing_files(TransferState& state, size_t begin, size_t end);
+    // Posts the manifest pages from file `begin` on
+    bool send_manifest(const OutgoingTransfer& outgoing, const std::string& remote_transfer_id,
+                       const std::vector<FileMetadata>& files, size_t begin, std::string& error_message);
+    // Sends what the receiver lacks (everything if remote_status is null); false if any upload failed
+    bool run_upload_pass(const std::string& transfer_id, const std::shared_ptr<TransferState>& state,
+                         const std::string& remote_transfer_id, const TransferRequest& request,
+                         const TransferReceiveStatus* remote_status, std::string& error_message);
+    // The receiver verifies each file before keeping it and drops the chunks that fail,
+    // so a pass only counts once it reports the whole transfer complete
+    bool confirm_received(const OutgoingTransfer& outgoing, const std::string& remote_transfer_id,
+                          std::string& error_message);
+    APIResponse upload_outgoing_file(const std::string& transfer_id, const std::string& remote_transfer_id,
+                                     const OutgoingTransfer& outgoing, int file_index, const FileMetadata& file,
+                                     std::function<bool(uint64_t bytes_sent)> progress_callback);
+    // Sends a file as a delta against the receiver's older copy of it
+    APIResponse upload_delta_file(TransferState& state, const std::string& remote_transfer_id,
+                                  const OutgoingTransfer& outgoing, int file_index, const FileMetadata& file,
+                                  std::function<bool(uint64_t bytes_sent)> progress_callback);
+    // The transfer's compressor, unless none of these files would shrink
+    static TransferCompressor* compressor_for(const OutgoingTransfer& outgoing, const TransferRequest& request,
+                                              const std::vector<size_t>& files);
+    void finish_outgoing_transfer(const std::string& transfer_id, TransferState& state,
+                                  bool success, const std::string& error_message);
+    std::string temporary_directory() const;
+    std::string temporary_file_path(const std::string& transfer_id, int file_index) const;
+    std::string create_temporary_file(const std::string& transfer_id, int file_index, uint64_t file_size);
+    std::shared_ptr<TransferState> restore_transfer(const std::string& journal_path);
+    bool receive_file_range(const std::string& transfer_id, int file_index, bool append,
+                            uint64_t offset, uint64_t length, const BodyReader& read_body);
+    // The destination's older copy of a file a sync hasn't received any of yet
+    bool find_delta_basis(const std::string& transfer_id, int file_index, std::string& basis_path,
+                          uint64_t& file_size, bool& bulk_io) const;
+    // false if any leaf hashed while a range was written differs from the sender's
+    bool match_chunk_hashes(const std::string& transfer_id, TransferState& state, int file_index,
+                            const std::vector<ChunkHash>& chunks);
+    // Files of a sync receive whose destination copy already has the same tree
+    // hash; the hash cache spares reading those unchanged since they were hashed
+    std::vector<bool> find_unchanged_files(const std::string& destination_folder,
+                                           const std::vector<FileMetadata>& files, bool bulk_io);
+    // Copies the leaves of these files that the chunk store holds into their temp
+    // files, recording the ranges filled in `stored`. Files it rebuilds entirely
+    // are finalized straight away and flagged in `in_place`.
+    void fill_from_chunk_store(const std::vector<FileMetadata>& files, const std::vector<std::string>& temp_paths,
+                               const std::string& destination_folder, bool bulk_io, std::vector<bool>& in_place,
+                               std::vector<std::vector<RangeSet::Range>>& stored);
+    // Copies duplicates in this manifest page whose source is in_place into
+    // their temp files and finalizes them, flagging them in_place too
+    void place_page_duplicates(const std::vector<FileMetadata>& files, uint64_t first_file,
+                               const std::vector<std::string>& temp_paths, const std::string& destination_folder,
+                               bool bulk_io, std::vector<bool>& in_place,
+                               std::vector<std::vector<RangeSet::Range>>& stored);
+    // Queues the duplicates from first_file on that aren't in_place behind their
+    // source, or claims them if it landed already; the caller holds state.mutex
+    static std::vector<std::pair<size_t, size_t>> claim_duplicates(TransferState& state, size_t first_file,
+                                                                   const std::vector<bool>& in_place);
+    // Copies the landed sources onto the claimed (duplicate, source) files and
+    // counts those that made it; completes the receive if nothing is left
+    void place_duplicates(const std::string& transfer_id, TransferState& state,
+                          const std::vector<std::pair<size_t, size_t>>& duplicates);
+    // Hardlinks or copies a landed file over a duplicate's temp file
+    bool copy_duplicate(const std::string& source_path, const std::string& temp_path, uint64_t size);
+    // Counts those ranges as received, from first_file on; the caller holds state.mutex
+    static void mark_stored_chunks(TransferState& state, size_t first_file,
+                                   const std::vector<std::vector<RangeSet::Range>>& stored);
+    // Counts the files from first_file on that find_unchanged_files matched as received;
+    // the caller holds state.mutex. True if that leaves nothing to receive.
+    static bool mark_unchanged_files(TransferState& state, size_t first_file, const std::vector<bool>& unchanged);
+    // Announces a receive that was just retired as completed; a mirror sync also
+    // deletes what the sender doesn't have (mirrored_names lists what it sent)
+    void complete_receive(const std::string& transfer_id, const std::vector<std::string>& temp_paths,
+                          const std::string& destination_folder, const std::vector<std::string>& mirrored_names);
+    void delete_extra_files(const std::string& destination_folder, const std::vector<std::string>& names);
+    // false if the range completed the file and it could not be finalized; leaves
+    // that failed verification are dropped from the received ranges to be sent again
+    bool complete_file_range(const std::string& transfer_id, TransferState& state, int file_index,
+                             uint64_t offset, uint64_t length, const std::vector<ChunkHash>& chunks);
+    // Checks the leaves not in `verified` against the file's tree hash before the
+    // rename; corrupt_chunks lists those that didn't match
+    bool finalize_received_file(const std::string& temp_path, const std::string& final_path,
+                                const FileMetadata& file, const std::vector<bool>& verified, bool bulk_io,
+                                std::vector<uint64_t>& corrupt_chunks);
+    
+    // Marks the transfer finished and hands back its temp files and journal; the caller holds
+    // state.mutex and passes the result to cleanup_transfer once it has let go
+    std::vector<std::string> retire_transfer(TransferState& state);
+    void cleanup_transfer(const std::string& transfer_id, const std::vector<std::string>& temp_paths);
+    
+    // The caller holds state.mutex for these three
+    static void start_rate_meter(TransferState& state);
+    static void record_progress(TransferState& state);
+    static TransferStats snapshot_stats(const TransferState& state, bool include_files);
+    
+    // Charges bytes a transfer moved to the bandwidth limits that apply to it and
+    // waits as long as the strictest one asks; false if the transfer ended meanwhile
+    bool throttle(TransferState& state, uint64_t bytes);
+    // read_body, throttled as the body comes in
+    BodyReader paced_body_reader(const std::string& transfer_id, const BodyReader& read_body);
+    
+    void update_transfer_progress(const std::string& transfer_id, const TransferStats& stats);
+    // file_index < 0 for bytes that span several files (bundles)
+    bool add_received_bytes(const std::string& transfer_id, TransferState& state, int file_index, uint64_t bytes);
     
     mutable std::mutex transfers_mutex_;
-    std::map<std::string, TransferInfo> active_transfers_;
-    std::map<std::string, std::vector<std::string>> temp_file_paths_;
+    std::map<std::string, std::shared_ptr<TransferState>> transfers_;
+    std::deque<std::string> recently_completed_; // guarded by transfers_mutex_
+    
+    std::mutex sender_threads_mutex_;
+    std::map<std::string, std::thread> sender_threads_; // by transfer ID
+    std::vector<std::string> finished_senders_; // their threads are joined by the next send
+    std::unique_ptr<WorkerPool> upload_pool_;
+    std::unique_ptr<TreeHasher> hasher_;
+    std::unique_ptr<DirectoryWalker> walker_;
+    HashCache hash_cache_;
+    ChunkStore chunk_store_;
+    // Copies received files into chunk_store_ after their uploads are answered
+    std::unique_ptr<WorkerPool> chunk_store_pool_;
+    std::atomic<bool> hardlink_duplicates_{false};
+    
+    TokenBucket bandwidth_limit_;
+    std::mutex peer_limits_mutex_;
+    std::map<std::string, std::shared_ptr<TokenBucket>> peer_limits_;
+    std::atomic<uint64_t> limits_version_{0}; // bumped by every change; 0 while no limit was ever set
     
+    APIClient* api_client_;
+    std::string device_id_;
     std::string download_folder_;
     ProgressCallback progress_callback_;
     CompletionCallback completion_callback_;
     IncomingRequestCallback incoming_request_callback_;
+    StreamStatsCallback stream_stats_callback_;
 };
 
 } // namespace warpdeck
\ No newline at end of file
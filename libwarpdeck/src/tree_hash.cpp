@@ -0,0 +1,258 @@
+#include "tree_hash.h"
+#include "file_io.h"
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <openssl/evp.h>
+
+namespace warpdeck {
+
+namespace {
+
+constexpr unsigned char LEAF_PREFIX = 0x00;
+constexpr unsigned char NODE_PREFIX = 0x01;
+
+} // namespace
+
+std::string digest_to_hex(const unsigned char* digest) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(HASH_DIGEST_SIZE * 2);
+    for (size_t i = 0; i < HASH_DIGEST_SIZE; ++i) {
+        hex.push_back(digits[digest[i] >> 4]);
+        hex.push_back(digits[digest[i] & 0x0f]);
+    }
+    return hex;
+}
+
+bool digest_from_hex(const std::string& hex, unsigned char* digest) {
+    if (hex.size() != HASH_DIGEST_SIZE * 2) {
+        return false;
+    }
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < HASH_DIGEST_SIZE; ++i) {
+        int high = nibble(hex[2 * i]);
+        int low = nibble(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        digest[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+uint64_t hash_chunk_size(uint64_t file_size) {
+    uint64_t chunk_size = HASH_CHUNK_SIZE;
+    while (file_size / chunk_size >= MAX_HASH_CHUNKS) {
+        chunk_size *= 2;
+    }
+    return chunk_size;
+}
+
+uint64_t hash_chunk_count(uint64_t file_size, uint64_t chunk_size) {
+    if (file_size == 0 || chunk_size == 0) {
+        return 1;
+    }
+    return (file_size + chunk_size - 1) / chunk_size;
+}
+
+Sha256::Sha256() : context_(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(context_, EVP_sha256(), nullptr);
+}
+
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(context_);
+}
+
+void Sha256::update(const void* data, size_t length) {
+    EVP_DigestUpdate(context_, data, length);
+}
+
+std::string Sha256::finish() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    EVP_DigestFinal_ex(context_, digest, &digest_length);
+    EVP_DigestInit_ex(context_, EVP_sha256(), nullptr);
+    return digest_to_hex(digest);
+}
+
+void begin_leaf_hash(Sha256& hasher) {
+    hasher.update(&LEAF_PREFIX, 1);
+}
+
+std::string tree_hash_root(const std::vector<std::string>& chunk_hashes) {
+    if (chunk_hashes.empty()) {
+        return "";
+    }
+
+    std::vector<std::string> level = chunk_hashes;
+    Sha256 hasher;
+    while (level.size() > 1) {
+        std::vector<std::string> parents;
+        parents.reserve((level.size() + 1) / 2);
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            unsigned char left[HASH_DIGEST_SIZE];
+            unsigned char right[HASH_DIGEST_SIZE];
+            if (!digest_from_hex(level[i], left) || !digest_from_hex(level[i + 1], right)) {
+                return "";
+            }
+            hasher.update(&NODE_PREFIX, 1);
+            hasher.update(left, sizeof(left));
+            hasher.update(right, sizeof(right));
+            parents.push_back(hasher.finish());
+        }
+        if (level.size() % 2 == 1) {
+            parents.push_back(level.back());
+        }
+        level.swap(parents);
+    }
+    return level.front();
+}
+
+TreeHasher::TreeHasher(size_t thread_count) : pool_(std::make_unique<WorkerPool>(thread_count)) {}
+
+bool TreeHasher::hash_files(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes,
+                            bool bulk_io, std::vector<TreeHash>& hashes) {
+    hashes.assign(paths.size(), TreeHash());
+    std::vector<Leaf> leaves;
+    for (size_t file = 0; file < paths.size(); ++file) {
+        uint64_t chunk_size = hash_chunk_size(sizes[file]);
+        uint64_t count = hash_chunk_count(sizes[file], chunk_size);
+        hashes[file].chunk_size = chunk_size;
+        hashes[file].chunk_hashes.resize(count);
+        for (uint64_t index = 0; index < count; ++index) {
+            uint64_t offset = index * chunk_size;
+            leaves.push_back({&paths[file], offset, std::min(chunk_size, sizes[file] - std::min(sizes[file], offset)),
+                              &hashes[file].chunk_hashes[index]});
+        }
+    }
+
+    if (!hash_leaves(leaves, bulk_io)) {
+        return false;
+    }
+    for (auto& hash : hashes) {
+        hash.root = tree_hash_root(hash.chunk_hashes);
+    }
+    return true;
+}
+
+bool TreeHasher::hash_chunks(const std::string& path, uint64_t file_size, uint64_t chunk_size,
+                             const std::vector<uint64_t>& indices, bool bulk_io, std::vector<std::string>& hashes) {
+    hashes.assign(indices.size(), std::string());
+    std::vector<Leaf> leaves;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        uint64_t offset = indices[i] * chunk_size;
+        leaves.push_back({&path, offset, std::min(chunk_size, file_size - std::min(file_size, offset)), &hashes[i]});
+    }
+    return hash_leaves(leaves, bulk_io);
+}
+
+bool TreeHasher::hash_leaves(const std::vector<Leaf>& leaves, bool bulk_io) {
+    // Every leaf is a task of its own; the pool spreads them over its threads
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t remaining = leaves.size();
+    std::atomic<bool> failed{false};
+
+    for (const Leaf& leaf : leaves) {
+        pool_->submit([&, leaf]() {
+            if (!failed) {
+                Sha256 hasher;
+                begin_leaf_hash(hasher);
+                FileReader reader;
+                uint64_t hashed = 0;
+                if (reader.open(*leaf.path, leaf.offset, leaf.length, bulk_io)) {
+                    const char* data = nullptr;
+                    size_t size = 0;
+                    while (hashed < leaf.length && reader.next(data, size)) {
+                        hasher.update(data, size);
+                        hashed += size;
+                    }
+                    reader.close();
+                }
+
+                if (hashed == leaf.length) {
+                    *leaf.hash = hasher.finish();
+                } else if (!failed.exchange(true)) {
+                    LOG_TRANSFER_ERROR() << "Cannot read " << *leaf.path << " for hashing";
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if (--remaining == 0) {
+                done_cv.notify_all();
+            }
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&]() { return remaining == 0; });
+    }
+    return !failed;
+}
+
+ChunkStreamHasher::ChunkStreamHasher(uint64_t chunk_size, uint64_t file_size, uint64_t offset)
+    : chunk_size_(0), file_size_(0), position_(0), hashing_(false) {
+    reset(chunk_size, file_size, offset);
+}
+
+void ChunkStreamHasher::reset(uint64_t chunk_size, uint64_t file_size, uint64_t offset) {
+    if (hashing_) {
+        hasher_.finish(); // Drop the unfinished leaf
+    }
+    chunk_size_ = chunk_size;
+    file_size_ = file_size;
+    position_ = offset;
+    hashing_ = false;
+    chunks_.clear();
+    if (chunk_size_ > 0 && file_size_ == 0) {
+        // The one leaf of an empty file is complete before any byte arrives
+        begin_leaf_hash(hasher_);
+        chunks_.push_back({0, hasher_.finish()});
+    }
+}
+
+void ChunkStreamHasher::update(const char* data, size_t length) {
+    if (chunk_size_ == 0) {
+        return;
+    }
+
+    while (length > 0 && position_ < file_size_) {
+        uint64_t leaf_start = position_ / chunk_size_ * chunk_size_;
+        uint64_t leaf_end = std::min(leaf_start + chunk_size_, file_size_);
+        // A leaf is hashed only if the stream reaches its first byte
+        if (position_ == leaf_start && !hashing_) {
+            begin_leaf_hash(hasher_);
+            hashing_ = true;
+        }
+
+        size_t take = static_cast<size_t>(std::min<uint64_t>(length, leaf_end - position_));
+        if (hashing_) {
+            hasher_.update(data, take);
+        }
+        data += take;
+        length -= take;
+        position_ += take;
+
+        if (position_ == leaf_end) {
+            if (hashing_) {
+                chunks_.push_back({leaf_start / chunk_size_, hasher_.finish()});
+            }
+            hashing_ = false;
+        }
+    }
+}
+
+const std::vector<ChunkHash>& ChunkStreamHasher::chunks() const {
+    return chunks_;
+}
+
+} // namespace warpdeck
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "worker_pool.h"
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+namespace warpdeck {
+
+// Files are hashed as a Merkle tree over fixed-size leaves (chunks), so each
+// chunk can be checked on its own as it arrives. Leaves are at least
+// HASH_CHUNK_SIZE and grow in powers of two to keep a file under
+// MAX_HASH_CHUNKS leaves.
+constexpr uint64_t HASH_CHUNK_SIZE = 4 * 1024 * 1024;
+constexpr uint64_t MAX_HASH_CHUNKS = 4096;
+constexpr size_t HASH_DIGEST_SIZE = 32;
+
+uint64_t hash_chunk_size(uint64_t file_size);
+// An empty file still has one (empty) leaf
+uint64_t hash_chunk_count(uint64_t file_size, uint64_t chunk_size);
+
+// Conversions between raw HASH_DIGEST_SIZE digests and their lowercase hex
+std::string digest_to_hex(const unsigned char* digest);
+bool digest_from_hex(const std::string& hex, unsigned char* digest);
+
+// Incremental SHA-256 producing lowercase hex
+class Sha256 {
+public:
+    Sha256();
+    ~Sha256();
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void update(const void* data, size_t length);
+    // Returns the digest and starts over
+    std::string finish();
+
+private:
+    EVP_MD_CTX* context_;
+};
+
+// Leaf hashes are SHA-256(0x00 || chunk) and inner nodes SHA-256(0x01 || left || right),
+// with an unpaired node carried up a level unchanged (as in RFC 6962)
+void begin_leaf_hash(Sha256& hasher);
+std::string tree_hash_root(const std::vector<std::string>& chunk_hashes);
+
+struct TreeHash {
+    std::string root;
+    uint64_t chunk_size = 0;
+    std::vector<std::string> chunk_hashes;
+};
+
+struct ChunkHash {
+    uint64_t index;
+    std::string hash;
+};
+
+// Hashes the leaves of many files at once on its own threads, so both one big
+// file and many small ones use every core
+class TreeHasher {
+public:
+    explicit TreeHasher(size_t thread_count);
+
+    // false if any file could not be read in full; bulk_io keeps the pass out of the page cache
+    bool hash_files(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes,
+                    bool bulk_io, std::vector<TreeHash>& hashes);
+    // Hashes some leaves of one file; hashes[i] is the leaf at indices[i]
+    bool hash_chunks(const std::string& path, uint64_t file_size, uint64_t chunk_size,
+                     const std::vector<uint64_t>& indices, bool bulk_io, std::vector<std::string>& hashes);
+
+private:
+    struct Leaf {
+        const std::string* path;
+        uint64_t offset;
+        uint64_t length;
+        std::string* hash;
+    };
+
+    bool hash_leaves(const std::vector<Leaf>& leaves, bool bulk_io);
+
+    std::unique_ptr<WorkerPool> pool_;
+};
+
+// Hashes leaves from bytes as they are written, so a receiver can check them
+// without reading the file back. Only leaves that lie entirely within the
+// stream are hashed; the partial ones at either end are skipped.
+class ChunkStreamHasher {
+public:
+    // A chunk_size of 0 hashes nothing
+    ChunkStreamHasher(uint64_t chunk_size, uint64_t file_size, uint64_t offset);
+
+    ChunkStreamHasher(const ChunkStreamHasher&) = delete;
+    ChunkStreamHasher& operator=(const ChunkStreamHasher&) = delete;
+
+    void reset(uint64_t chunk_size, uint64_t file_size, uint64_t offset);
+    void update(const char* data, size_t length);
+
+    // Leaves completed so far, in order
+    const std::vector<ChunkHash>& chunks() const;
+
+private:
+    uint64_t chunk_size_;
+    uint64_t file_size_;
+    uint64_t position_;
+    bool hashing_;
+    Sha256 hasher_;
+    std::vector<ChunkHash> chunks_;
+};
+
+} // namespace warpdeck
\ No newline at end of file
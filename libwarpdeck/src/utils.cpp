@@ -3,22 +3,28 @@
 #include "api_server.h"
 #include "security_manager.h"
 #include "transfer_manager.h"
+#include "tree_hash.h"
+#include <algorithm>
 #include <random>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
 #include <filesystem>
 #include <chrono>
-#include <openssl/sha.h>
+#include <cerrno>
 
 #ifdef WARPDECK_PLATFORM_MACOS
 #include <CoreFoundation/CoreFoundation.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <fcntl.h>
 #elif defined(WARPDECK_PLATFORM_LINUX)
 #include <unistd.h>
 #include <pwd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #endif
 
 namespace warpdeck {
@@ -87,8 +93,35 @@ std::string transfer_request_to_json(const TransferRequest& request) {
         if (!file.hash.empty()) {
             file_json["hash"] = file.hash;
         }
+        if (!file.chunk_hashes.empty()) {
+            file_json["chunk_size"] = file.chunk_size;
+            file_json["chunk_hashes"] = file.chunk_hashes;
+        }
+        if (file.mtime_ns != 0) {
+            file_json["mtime_ns"] = file.mtime_ns;
+        }
+        if (file.duplicate_of >= 0) {
+            file_json["duplicate_of"] = file.duplicate_of;
+        }
         j["files"].push_back(file_json);
     }
+    if (request.bulk_io) {
+        j["bulk_io"] = true;
+    }
+    if (!request.compression.empty()) {
+        j["compression"] = request.compression;
+    }
+    if (request.sync) {
+        j["sync"] = true;
+        j["delete_extras"] = request.delete_extras;
+    }
+    if (!request.sender_device_id.empty()) {
+        j["sender_id"] = request.sender_device_id;
+    }
+    if (request.file_count > request.files.size()) {
+        j["file_count"] = request.file_count;
+        j["total_bytes"] = request.total_bytes;
+    }
     
     return j.dump();
 }
@@ -100,6 +133,16 @@ std::string file_metadata_to_json(const FileMetadata& file) {
     if (!file.hash.empty()) {
         j["hash"] = file.hash;
     }
+    if (!file.chunk_hashes.empty()) {
+        j["chunk_size"] = file.chunk_size;
+        j["chunk_hashes"] = file.chunk_hashes;
+    }
+    if (file.mtime_ns != 0) {
+        j["mtime_ns"] = file.mtime_ns;
+    }
+    if (file.duplicate_of >= 0) {
+        j["duplicate_of"] = file.duplicate_of;
+    }
     return j.dump();
 }
 
@@ -117,6 +160,126 @@ std::string trusted_peers_to_json(const std::map<std::string, TrustedPeer>& peer
     return j.dump();
 }
 
+std::string transfer_stats_to_json(const TransferStats& stats) {
+    nlohmann::json j;
+    j["transfer_id"] = stats.transfer_id;
+    j["total_bytes"] = stats.total_bytes;
+    j["transferred_bytes"] = stats.transferred_bytes;
+    j["total_files"] = stats.total_files;
+    j["completed_files"] = stats.completed_files;
+    j["progress_percent"] = stats.progress_percent;
+    j["bytes_per_second"] = static_cast<uint64_t>(stats.bytes_per_second);
+    j["elapsed_seconds"] = stats.elapsed_seconds;
+    if (stats.eta_seconds >= 0.0) {
+        j["eta_seconds"] = stats.eta_seconds;
+    } else {
+        j["eta_seconds"] = nullptr;
+    }
+    j["stalled"] = stats.stalled;
+    if (!stats.compression.empty()) {
+        j["compression"] = stats.compression;
+        j["compression_ratio"] = stats.compression_ratio;
+        j["compression_cpu_seconds"] = stats.compression_cpu_seconds;
+    }
+    
+    if (!stats.file_transferred_bytes.empty()) {
+        j["files"] = nlohmann::json::array();
+        for (size_t i = 0; i < stats.file_transferred_bytes.size(); ++i) {
+            j["files"].push_back({{"index", i}, {"transferred_bytes", stats.file_transferred_bytes[i]}});
+        }
+    }
+    
+    return j.dump();
+}
+
+std::string transfer_receive_status_to_json(const TransferReceiveStatus& status) {
+    nlohmann::json j;
+    j["transfer_id"] = status.transfer_id;
+    j["status"] = status.status;
+    j["files"] = nlohmann::json::array();
+    
+    for (const auto& file : status.files) {
+        nlohmann::json file_json;
+        file_json["size"] = file.size;
+        file_json["received_bytes"] = file.received_bytes;
+        file_json["complete"] = file.complete;
+        if (file.delta_basis) {
+            file_json["delta_basis"] = true;
+        }
+        file_json["missing"] = nlohmann::json::array();
+        for (const auto& [offset, length] : file.missing) {
+            file_json["missing"].push_back({offset, length});
+        }
+        j["files"].push_back(file_json);
+    }
+    
+    return j.dump();
+}
+
+std::string transfer_journal_header_to_json(const TransferInfo& transfer) {
+    nlohmann::json j;
+    j["transfer_id"] = transfer.transfer_id;
+    j["peer_device_id"] = transfer.peer_device_id;
+    j["peer_name"] = transfer.peer_name;
+    j["destination_folder"] = transfer.destination_folder;
+    j["bulk_io"] = transfer.bulk_io;
+    j["sync"] = transfer.sync;
+    j["delete_extras"] = transfer.delete_extras;
+    j["file_count"] = transfer.file_count;
+    j["total_bytes"] = transfer.total_bytes;
+    j["files"] = nlohmann::json::array();
+    
+    for (const auto& file : transfer.files) {
+        nlohmann::json file_json;
+        file_json["name"] = file.name;
+        file_json["size"] = file.size;
+        if (!file.hash.empty()) {
+            file_json["hash"] = file.hash;
+        }
+        if (!file.chunk_hashes.empty()) {
+            file_json["chunk_size"] = file.chunk_size;
+            file_json["chunk_hashes"] = file.chunk_hashes;
+        }
+        if (file.mtime_ns != 0) {
+            file_json["mtime_ns"] = file.mtime_ns;
+        }
+        if (file.duplicate_of >= 0) {
+            file_json["duplicate_of"] = file.duplicate_of;
+        }
+        j["files"].push_back(file_json);
+    }
+    
+    return j.dump();
+}
+
+std::string manifest_page_to_json(const std::vector<FileMetadata>& files, size_t begin, size_t end) {
+    nlohmann::json j;
+    j["files"] = nlohmann::json::array();
+    
+    for (size_t i = begin; i < end && i < files.size(); ++i) {
+        const FileMetadata& file = files[i];
+        nlohmann::json file_json;
+        file_json["name"] = file.name;
+        file_json["size"] = file.size;
+        if (!file.hash.empty()) {
+            file_json["hash"] = file.hash;
+        }
+        if (!file.chunk_hashes.empty()) {
+            file_json["chunk_size"] = file.chunk_size;
+            file_json["chunk_hashes"] = file.chunk_hashes;
+        }
+        if (file.mtime_ns != 0) {
+            file_json["mtime_ns"] = file.mtime_ns;
+        }
+        if (file.duplicate_of >= 0) {
+            file_json["duplicate_of"] = file.duplicate_of;
+        }
+        j["files"].push_back(file_json);
+    }
+    
+    return j.dump();
+}
+
 bool parse_transfer_request(const std::string& json, TransferRequest& request) {
     try {
         nlohmann::json j = nlohmann::json::parse(json);
@@ -125,13 +288,20 @@ bool parse_transfer_request(const std::string& json, TransferRequest& request) {
             return false;
         }
         
-        request.files.clear();
-        for (const auto& file_json : j["files"]) {
-            FileMetadata file;
-            if (!parse_file_metadata(file_json, file)) {
-                return false;
-            }
-            request.files.push_back(file);
+        if (!parse_file_list(j["files"], request.files)) {
+            return false;
+        }
+        request.bulk_io = j.value("bulk_io", false);
+        request.compression = j.value("compression", std::vector<std::string>());
+        request.sync = j.value("sync", false);
+        request.delete_extras = request.sync && j.value("delete_extras", false);
+        request.sender_device_id = j.value("sender_id", std::string());
+        // Only a request whose manifest continues in pages carries the full count
+        request.file_count = j.value("file_count", static_cast<uint64_t>(request.files.size()));
+        request.total_bytes = j.value("total_bytes", static_cast<uint64_t>(0));
+        if (request.file_count < request.files.size() || request.file_count > MAX_MANIFEST_FILES ||
+            request.total_bytes > MAX_TRANSFER_BYTES) {
+            return false;
         }
         
         return true;
@@ -148,10 +318,96 @@ bool parse_file_metadata(const nlohmann::json& json, FileMetadata& file) {
         
         file.name = json["name"];
         file.size = json["size"];
+        if (!is_safe_relative_path(file.name) || file.size > MAX_TRANSFER_BYTES) {
+            return false;
+        }
         
         if (json.contains("hash")) {
             file.hash = json["hash"];
         }
+        file.mtime_ns = json.value("mtime_ns", static_cast<int64_t>(0));
+        file.duplicate_of = json.value("duplicate_of", static_cast<int64_t>(-1));
+        
+        // Chunk hashes only count if they cover the whole file and add up to its
+        // root, so a receiver that matches every chunk has matched the file
+        if (json.contains("chunk_hashes") && json.contains("chunk_size")) {
+            file.chunk_size = json["chunk_size"];
+            file.chunk_hashes = json["chunk_hashes"].get<std::vector<std::string>>();
+            if (file.chunk_size == 0 || file.chunk_hashes.size() > MAX_HASH_CHUNKS ||
+                file.chunk_hashes.size() != hash_chunk_count(file.size, file.chunk_size) ||
+                tree_hash_root(file.chunk_hashes) != file.hash) {
+                file.chunk_size = 0;
+                file.chunk_hashes.clear();
+            }
+        }
+        
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool parse_file_list(const nlohmann::json& json, std::vector<FileMetadata>& files) {
+    files.clear();
+    uint64_t total_bytes = 0;
+    for (const auto& file_json : json) {
+        FileMetadata file;
+        if (!parse_file_metadata(file_json, file)) {
+            return false;
+        }
+        // Each size is at most MAX_TRANSFER_BYTES, so the sum can't wrap before this fails
+        total_bytes += file.size;
+        if (total_bytes > MAX_TRANSFER_BYTES) {
+            return false;
+        }
+        files.push_back(file);
+    }
+    return true;
+}
+
+bool parse_transfer_session(const std::string& json, TransferSession& session) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(json);
+        
+        if (!j.contains("transfer_id")) {
+            return false;
+        }
+        
+        session.transfer_id = j["transfer_id"];
+        session.status = j.value("status", "");
+        session.expires_at = j.value("expires_at", "");
+        session.compression = j.value("compression", "");
+        
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool parse_transfer_receive_status(const std::string& json, TransferReceiveStatus& status) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(json);
+        
+        if (!j.contains("transfer_id") || !j.contains("files") || !j["files"].is_array()) {
+            return false;
+        }
+        
+        status.transfer_id = j["transfer_id"];
+        status.status = j.value("status", "");
+        status.files.clear();
+        for (const auto& file_json : j["files"]) {
+            FileReceiveStatus file;
+            file.size = file_json.value("size", uint64_t(0));
+            file.received_bytes = file_json.value("received_bytes", uint64_t(0));
+            file.complete = file_json.value("complete", false);
+            file.delta_basis = file_json.value("delta_basis", false);
+            if (file_json.contains("missing")) {
+                for (const auto& range : file_json["missing"]) {
+                    file.missing.emplace_back(range.at(0).get<uint64_t>(), range.at(1).get<uint64_t>());
+                }
+            }
+            status.files.push_back(file);
+        }
         
         return true;
     } catch (const std::exception&) {
@@ -159,6 +415,79 @@ bool parse_file_metadata(const nlohmann::json& json, FileMetadata& file) {
     }
 }
 
+bool parse_transfer_journal_header(const std::string& json, TransferInfo& transfer) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(json);
+        
+        if (!j.contains("transfer_id") || !j.contains("files") || !j["files"].is_array()) {
+            return false;
+        }
+        
+        transfer.transfer_id = j["transfer_id"];
+        transfer.peer_device_id = j.value("peer_device_id", "");
+        transfer.peer_name = j.value("peer_name", "");
+        transfer.destination_folder = j.value("destination_folder", "");
+        transfer.bulk_io = j.value("bulk_io", false);
+        transfer.sync = j.value("sync", false);
+        transfer.delete_extras = j.value("delete_extras", false);
+        transfer.file_count = j.value("file_count", static_cast<uint64_t>(0));
+        transfer.total_bytes = j.value("total_bytes", static_cast<uint64_t>(0));
+        if (!parse_file_list(j["files"], transfer.files)) {
+            return false;
+        }
+        
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool parse_manifest_page(const std::string& json, std::vector<FileMetadata>& files) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(json);
+        
+        if (!j.contains("files") || !j["files"].is_array()) {
+            return false;
+        }
+        
+        if (!parse_file_list(j["files"], files)) {
+            return false;
+        }
+        
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+std::vector<std::string> parse_file_paths(const std::string& json) {
+    std::vector<std::string> paths;
+    
+    try {
+        nlohmann::json j = nlohmann::json::parse(json);
+        if (j.is_object() && j.contains("files")) {
+            j = j["files"]; // {"files": [...], ...options}
+        }
+        if (!j.is_array()) {
+            return {json};
+        }
+        
+        // Accept either plain path strings or file objects carrying a "path"
+        for (const auto& entry : j) {
+            if (entry.is_string()) {
+                paths.push_back(entry.get<std::string>());
+            } else if (entry.is_object() && entry.contains("path")) {
+                paths.push_back(entry["path"].get<std::string>());
+            }
+        }
+    } catch (const std::exception&) {
+        // Not JSON, treat the whole argument as a single path
+        paths.push_back(json);
+    }
+    
+    return paths;
+}
+
 bool file_exists(const std::string& path) {
     return std::filesystem::exists(path);
 }
@@ -169,8 +498,11 @@ bool create_directory(const std::string& path) {
         if (std::filesystem::exists(path)) {
             return std::filesystem::is_directory(path);
         }
-        // Create the directory and return success
-        return std::filesystem::create_directories(path);
+        // Create the directory; another thread finalizing a file of the same
+        // directory may have created it first
+        std::error_code error;
+        std::filesystem::create_directories(path, error);
+        return std::filesystem::is_directory(path);
     } catch (const std::exception&) {
         return false;
     }
@@ -184,6 +516,26 @@ std::string get_filename(const std::string& path) {
     return std::filesystem::path(path).filename().string();
 }
 
+bool is_safe_relative_path(const std::string& path) {
+    if (path.empty() || path.size() > 4096 || path.front() == '/' || path.find('\0') != std::string::npos) {
+        return false;
+    }
+    
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::string component = path.substr(start, end - start);
+        if (component.empty() || component == "." || component == "..") {
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
 uint64_t get_file_size(const std::string& path) {
     try {
         return std::filesystem::file_size(path);
@@ -192,29 +544,125 @@ uint64_t get_file_size(const std::string& path) {
     }
 }
 
-std::string calculate_file_hash(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
-        return "";
+bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool pwrite_all(int fd, const char* data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t written = ::pwrite(fd, data, length, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        offset += static_cast<uint64_t>(written);
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool pread_all(int fd, char* data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t count = ::pread(fd, data, length, static_cast<off_t>(offset));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (count == 0) {
+            return false;
+        }
+        data += count;
+        offset += static_cast<uint64_t>(count);
+        length -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+bool preallocate_file(int fd, uint64_t size) {
+    if (size == 0) {
+        return true;
     }
     
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    
-    char buffer[8192];
-    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
-        SHA256_Update(&sha256, buffer, file.gcount());
+#ifdef WARPDECK_PLATFORM_MACOS
+    // Ask for contiguous space first, then any space
+    fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fd, F_PREALLOCATE, &store);
+    }
+#elif defined(WARPDECK_PLATFORM_LINUX)
+    // Reserve the extents up front so out-of-order writes don't fragment the file
+    if (fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0) {
+        return true;
     }
+#endif
     
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_Final(hash, &sha256);
+    // Filesystems without preallocation support (e.g. FAT) still get the final size
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
+
+bool copy_file_data(int in_fd, uint64_t in_offset, int out_fd, uint64_t out_offset, uint64_t length) {
+#ifdef WARPDECK_PLATFORM_LINUX
+#ifdef FICLONERANGE
+    // btrfs and XFS clone block-aligned ranges (or ones ending at EOF) without copying
+    struct file_clone_range clone;
+    clone.src_fd = in_fd;
+    clone.src_offset = in_offset;
+    clone.src_length = length;
+    clone.dest_offset = out_offset;
+    if (length > 0 && ::ioctl(out_fd, FICLONERANGE, &clone) == 0) {
+        return true;
+    }
+#endif
     
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    // In-kernel copy; across filesystems older kernels refuse it, so fall through
+    while (length > 0) {
+        loff_t in = static_cast<loff_t>(in_offset);
+        loff_t out = static_cast<loff_t>(out_offset);
+        ssize_t copied = ::copy_file_range(in_fd, &in, out_fd, &out, static_cast<size_t>(length), 0);
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (copied == 0) {
+            return false; // Source ended early
+        }
+        in_offset += static_cast<uint64_t>(copied);
+        out_offset += static_cast<uint64_t>(copied);
+        length -= static_cast<uint64_t>(copied);
     }
+#endif
     
-    return ss.str();
+    std::vector<char> buffer(static_cast<size_t>(std::min<uint64_t>(length, 1024 * 1024)));
+    while (length > 0) {
+        size_t piece = static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+        if (!pread_all(in_fd, buffer.data(), piece, in_offset) ||
+            !pwrite_all(out_fd, buffer.data(), piece, out_offset)) {
+            return false;
+        }
+        in_offset += piece;
+        out_offset += piece;
+        length -= piece;
+    }
+    return true;
 }
 
 std::string get_platform_name() {
@@ -11,8 +11,12 @@ namespace warpdeck {
 struct PeerInfo;
 struct DeviceInfo;
 struct TransferRequest;
+struct TransferSession;
 struct FileMetadata;
 struct TrustedPeer;
+struct TransferStats;
+struct TransferInfo;
+struct TransferReceiveStatus;
 
 namespace utils {
 
@@ -25,18 +29,40 @@ std::string device_info_to_json(const DeviceInfo& device);
 std::string transfer_request_to_json(const TransferRequest& request);
 std::string file_metadata_to_json(const FileMetadata& file);
 std::string trusted_peers_to_json(const std::map<std::string, TrustedPeer>& peers);
+std::string transfer_stats_to_json(const TransferStats& stats);
+std::string transfer_receive_status_to_json(const TransferReceiveStatus& status);
+std::string transfer_journal_header_to_json(const TransferInfo& transfer);
+// Files [begin, end) as one manifest page
+std::string manifest_page_to_json(const std::vector<FileMetadata>& files, size_t begin, size_t end);
 
 // JSON parsing
 bool parse_transfer_request(const std::string& json, TransferRequest& request);
 bool parse_file_metadata(const nlohmann::json& json, FileMetadata& file);
+// A "files" array; false if any entry is invalid or together they exceed MAX_TRANSFER_BYTES
+bool parse_file_list(const nlohmann::json& json, std::vector<FileMetadata>& files);
+bool parse_transfer_session(const std::string& json, TransferSession& session);
+bool parse_transfer_receive_status(const std::string& json, TransferReceiveStatus& status);
+bool parse_transfer_journal_header(const std::string& json, TransferInfo& transfer);
+bool parse_manifest_page(const std::string& json, std::vector<FileMetadata>& files);
+std::vector<std::string> parse_file_paths(const std::string& json);
 
 // File utilities
 bool file_exists(const std::string& path);
 bool create_directory(const std::string& path);
 std::string get_parent_directory(const std::string& path);
 std::string get_filename(const std::string& path);
+// A '/'-separated relative path that stays inside whatever folder it is joined to
+bool is_safe_relative_path(const std::string& path);
 uint64_t get_file_size(const std::string& path);
-std::string calculate_file_hash(const std::string& path);
+bool write_all(int fd, const char* data, size_t length);
+bool pwrite_all(int fd, const char* data, size_t length, uint64_t offset);
+// false on error or if the file ends before `length` bytes were read
+bool pread_all(int fd, char* data, size_t length, uint64_t offset);
+bool preallocate_file(int fd, uint64_t size);
+// Copies [in_offset, in_offset + length) of one file into another: as a reflink
+// sharing the blocks where the filesystem can, else with copy_file_range, else
+// through a buffer
+bool copy_file_data(int in_fd, uint64_t in_offset, int out_fd, uint64_t out_offset, uint64_t length);
 
 // Platform utilities
 std::string get_platform_name();
@@ -4,16 +4,27 @@
 #include "api_client.h"
 #include "security_manager.h"
 #include "transfer_manager.h"
+#include "event_dispatcher.h"
 #include "utils.h"
 #include "logger.h"
 #include <memory>
 #include <string>
 #include <cstring>
 #include <map>
+#include <chrono>
+#include <atomic>
+#include <netdb.h>
+#include <sys/socket.h>
 
 using namespace warpdeck;
 
 struct WarpDeckHandle {
+    // Set at any time by the application; read when a stats event is delivered
+    std::atomic<on_transfer_stats_update_callback> stats_callback{nullptr};
+    
+    // Declared after stats_callback and before the managers so it outlives
+    // every manager that posts into it and never outlives what it reads
+    std::unique_ptr<EventDispatcher> event_dispatcher;
     std::unique_ptr<DiscoveryManager> discovery_manager;
     std::unique_ptr<APIServer> api_server;
     std::unique_ptr<APIClient> api_client;
@@ -42,6 +53,87 @@ void safe_call_callback(Callback callback, Args... args) {
     }
 }
 
+// Queues an error for the application; delivered in order with transfer events
+void post_error(WarpDeckHandle* handle, const std::string& message) {
+    on_error_callback callback = handle->callbacks.on_error;
+    handle->event_dispatcher->post([callback, message]() {
+        safe_call_callback(callback, message.c_str());
+    });
+}
+
+// Reads the optional "bulk_io" flag of an initiate_transfer files argument
+BulkIOMode parse_bulk_io_mode(const char* files_json) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(files_json);
+        if (j.is_object() && j.contains("bulk_io") && j["bulk_io"].is_boolean()) {
+            return j["bulk_io"].get<bool>() ? BulkIOMode::ENABLED : BulkIOMode::DISABLED;
+        }
+    } catch (const std::exception&) {
+        // Plain path or array; the size threshold decides
+    }
+    return BulkIOMode::AUTO;
+}
+
+// Reads the optional "compression" flag of an initiate_transfer files argument;
+// compression is offered unless it is false
+bool parse_compression_allowed(const char* files_json) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(files_json);
+        if (j.is_object() && j.contains("compression") && j["compression"].is_boolean()) {
+            return j["compression"].get<bool>();
+        }
+    } catch (const std::exception&) {
+        // Plain path or array
+    }
+    return true;
+}
+
+// Reads the optional "sync" option of an initiate_transfer files argument:
+// true skips files the receiver already has, "mirror" also deletes its extras
+SyncMode parse_sync_mode(const char* files_json) {
+    try {
+        nlohmann::json j = nlohmann::json::parse(files_json);
+        if (j.is_object() && j.contains("sync")) {
+            const nlohmann::json& sync = j["sync"];
+            if (sync.is_string() && sync.get<std::string>() == "mirror") {
+                return SyncMode::MIRROR;
+            }
+            if (sync.is_boolean() && sync.get<bool>()) {
+                return SyncMode::SYNC;
+            }
+        }
+    } catch (const std::exception&) {
+        // Plain path or array
+    }
+    return SyncMode::COPY;
+}
+
+// Whether a connection from `address` can come from the discovered peer: its
+// advertised host name has to resolve to that address
+bool peer_has_address(const PeerInfo& peer, std::string address) {
+    // An IPv4 client of a dual-stack socket shows up as an IPv4-mapped IPv6 address
+    if (address.rfind("::ffff:", 0) == 0 && address.find('.') != std::string::npos) {
+        address = address.substr(7);
+    }
+    
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(peer.host_address.c_str(), nullptr, &hints, &addresses) != 0) {
+        return false;
+    }
+    
+    bool found = false;
+    for (struct addrinfo* entry = addresses; entry && !found; entry = entry->ai_next) {
+        char host[NI_MAXHOST];
+        found = getnameinfo(entry->ai_addr, entry->ai_addrlen, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0 &&
+                address == host;
+    }
+    freeaddrinfo(addresses);
+    return found;
+}
+
 // Helper function to copy string for C API
 char* copy_string(const std::string& str) {
     char* result = new char[str.length() + 1];
@@ -70,6 +162,7 @@ WarpDeckHandle* warpdeck_create(const Callbacks* callbacks, const char* config_d
         handle->api_client = std::make_unique<APIClient>();
         handle->security_manager = std::make_unique<SecurityManager>();
         handle->transfer_manager = std::make_unique<TransferManager>();
+        handle->transfer_manager->set_device_id(handle->device_id);
         
         // Initialize security manager
         if (!handle->security_manager->initialize(config_dir)) {
@@ -81,76 +174,168 @@ WarpDeckHandle* warpdeck_create(const Callbacks* callbacks, const char* config_d
             return nullptr;
         }
         
+        if (!handle->transfer_manager->open_hash_cache(config_dir)) {
+            LOG_CORE_WARN() << "Hash cache unavailable, files will be rehashed on every send";
+        }
+        
+        // Callbacks run on the dispatcher thread; they capture the function
+        // pointers by value so draining the queue never touches the handle
+        Callbacks app = handle->callbacks;
+        handle->event_dispatcher = std::make_unique<EventDispatcher>();
+        
         // Set up discovery manager callbacks
         handle->discovery_manager->set_peer_discovered_callback(
-            [handle = handle.get()](const PeerInfo& peer) {
+            [handle = handle.get(), app](const PeerInfo& peer) {
                 LOG_CORE_INFO() << "Peer discovered: " << peer.name << " (ID: " << peer.id << ")";
                 std::string json = utils::peer_info_to_json(peer);
-                safe_call_callback(handle->callbacks.on_peer_discovered, json.c_str());
+                handle->event_dispatcher->post([app, json]() {
+                    safe_call_callback(app.on_peer_discovered, json.c_str());
+                });
             });
             
         handle->discovery_manager->set_peer_lost_callback(
-            [handle = handle.get()](const std::string& device_id) {
+            [handle = handle.get(), app](const std::string& device_id) {
                 LOG_CORE_INFO() << "Peer lost: " << device_id;
-                safe_call_callback(handle->callbacks.on_peer_lost, device_id.c_str());
+                handle->event_dispatcher->post([app, device_id]() {
+                    safe_call_callback(app.on_peer_lost, device_id.c_str());
+                });
             });
         
-        // Set up transfer manager callbacks
+        // Set up transfer manager callbacks; progress is coalesced per transfer,
+        // requests and completions are delivered in order after it
         handle->transfer_manager->set_progress_callback(
-            [handle = handle.get()](const std::string& transfer_id, float progress, uint64_t bytes) {
-                safe_call_callback(handle->callbacks.on_transfer_progress_update, 
-                                 transfer_id.c_str(), progress, bytes);
+            [handle = handle.get(), app](const std::string& transfer_id, const TransferStats& stats) {
+                handle->event_dispatcher->post_progress(transfer_id, [handle, app, stats]() {
+                    safe_call_callback(app.on_transfer_progress_update, stats.transfer_id.c_str(),
+                                     stats.progress_percent, stats.transferred_bytes);
+                    on_transfer_stats_update_callback stats_callback = handle->stats_callback.load();
+                    if (stats_callback) {
+                        std::string json = utils::transfer_stats_to_json(stats);
+                        safe_call_callback(stats_callback, stats.transfer_id.c_str(), json.c_str());
+                    }
+                });
             });
             
         handle->transfer_manager->set_completion_callback(
-            [handle = handle.get()](const std::string& transfer_id, bool success, const std::string& error) {
-                safe_call_callback(handle->callbacks.on_transfer_completed, 
-                                 transfer_id.c_str(), success, error.empty() ? nullptr : error.c_str());
+            [handle = handle.get(), app](const std::string& transfer_id, bool success, const std::string& error) {
+                handle->event_dispatcher->post_for_transfer(transfer_id, [app, transfer_id, success, error]() {
+                    safe_call_callback(app.on_transfer_completed,
+                                     transfer_id.c_str(), success, error.empty() ? nullptr : error.c_str());
+                });
             });
             
         handle->transfer_manager->set_incoming_request_callback(
-            [handle = handle.get()](const std::string& transfer_id, const std::string& peer_name, 
-                                   const std::vector<FileMetadata>& files) {
-                // Create JSON for the transfer request
+            [handle = handle.get(), app](const std::string& transfer_id, const std::string& peer_name, 
+                                   const TransferRequest& incoming) {
+                // Create JSON for the transfer request; a paged manifest lists its
+                // first page, with file_count and total_bytes covering the rest
                 TransferRequest request;
-                request.files = files;
-                std::string json = utils::transfer_request_to_json(request);
-                safe_call_callback(handle->callbacks.on_incoming_transfer_request, json.c_str());
+                request.files = incoming.files;
+                request.file_count = incoming.file_count;
+                request.total_bytes = incoming.total_bytes;
+                request.sync = incoming.sync;
+                request.delete_extras = incoming.delete_extras;
+                nlohmann::json json = nlohmann::json::parse(utils::transfer_request_to_json(request));
+                json["transfer_id"] = transfer_id;
+                json["peer_name"] = peer_name;
+                std::string request_json = json.dump();
+                handle->event_dispatcher->post_for_transfer(transfer_id, [app, request_json]() {
+                    safe_call_callback(app.on_incoming_transfer_request, request_json.c_str());
+                });
+            });
+        
+        handle->transfer_manager->set_api_client(handle->api_client.get());
+        
+        handle->transfer_manager->set_stream_stats_callback(
+            [](const std::string& transfer_id, int file_index, const std::vector<StreamStats>& streams) {
+                for (const auto& stream : streams) {
+                    LOG_TRANSFER_DEBUG() << "Transfer " << transfer_id << " file " << file_index
+                                         << " stream " << stream.stream_index << ": "
+                                         << static_cast<uint64_t>(stream.bytes_per_second) << " B/s";
+                }
             });
         
         // Set up API server callbacks
         handle->api_server->set_transfer_request_callback(
-            [handle = handle.get()](const std::string& client_fingerprint, 
+            [handle = handle.get()](const std::string& /* client_fingerprint */, 
+                                   const std::string& remote_address,
                                    const TransferRequest& request,
                                    std::function<void(bool, const std::string&)> response_callback) {
-                // Check if peer is trusted
-                bool is_trusted = false;
-                for (const auto& file : request.files) {
-                    // For simplicity, we'll determine peer info from the first request
-                    // In a real implementation, we'd extract this from the TLS session
-                    break;
+                // The sender names itself by its discovery ID, which anyone on
+                // the network can see and claim. The request is shown as that
+                // peer's only if it comes from the peer's address; otherwise
+                // the claim just picks the bandwidth limit it counts against.
+                std::string peer_device_id = "unknown_peer";
+                std::string peer_name = "Unknown Peer";
+                if (!request.sender_device_id.empty()) {
+                    auto peers = handle->discovery_manager->get_discovered_peers();
+                    auto peer_it = peers.find(request.sender_device_id);
+                    if (peer_it != peers.end() && peer_has_address(peer_it->second, remote_address)) {
+                        peer_device_id = peer_it->second.id;
+                        peer_name = peer_it->second.name;
+                    } else {
+                        LOG_CORE_WARN() << "Transfer request from " << remote_address << " claims to come from "
+                                        << request.sender_device_id << ", which isn't a peer at that address";
+                    }
                 }
                 
                 // Handle the incoming request through transfer manager
                 std::string transfer_id = handle->transfer_manager->handle_incoming_request(
-                    "unknown_peer", "Unknown Peer", request);
+                    peer_device_id, peer_name, request);
                 
-                if (!is_trusted) {
-                    // Will trigger the incoming request callback to UI
-                    response_callback(false, ""); // Will be handled by respond_to_transfer
-                } else {
-                    response_callback(true, transfer_id);
-                }
+                // Hold the request open until the user accepts or declines it
+                bool approved = handle->transfer_manager->wait_for_response(
+                    transfer_id, std::chrono::seconds(TRANSFER_APPROVAL_TIMEOUT_SECONDS));
+                response_callback(approved, approved ? transfer_id : "");
             });
             
         handle->api_server->set_file_upload_callback(
             [handle = handle.get()](const std::string& transfer_id, int file_index, 
-                                   const std::string& data,
+                                   uint64_t content_length, const BodyReader& read_body,
                                    std::function<void(bool, const std::string&)> response_callback) {
-                std::vector<uint8_t> file_data(data.begin(), data.end());
-                bool success = handle->transfer_manager->handle_file_upload(transfer_id, file_index, file_data);
+                bool success = handle->transfer_manager->handle_file_upload(
+                    transfer_id, file_index, content_length, read_body);
                 response_callback(success, success ? "" : "Failed to write file");
             });
+            
+        handle->api_server->set_chunk_upload_callback(
+            [handle = handle.get()](const std::string& transfer_id, int file_index,
+                                   uint64_t offset, uint64_t length, const BodyReader& read_body,
+                                   std::function<void(bool, const std::string&)> response_callback) {
+                bool success = handle->transfer_manager->handle_chunk_upload(
+                    transfer_id, file_index, offset, length, read_body);
+                response_callback(success, success ? "" : "Failed to write chunk");
+            });
+            
+        handle->api_server->set_bundle_upload_callback(
+            [handle = handle.get()](const std::string& transfer_id, const BodyReader& read_body,
+                                   std::function<void(bool, const std::string&)> response_callback) {
+                bool success = handle->transfer_manager->handle_bundle_upload(transfer_id, read_body);
+                response_callback(success, success ? "" : "Failed to unpack bundle");
+            });
+        
+        handle->api_server->set_transfer_status_callback(
+            [handle = handle.get()](const std::string& transfer_id, TransferReceiveStatus& status) {
+                return handle->transfer_manager->get_receive_status(transfer_id, status);
+            });
+        
+        handle->api_server->set_delta_signature_callback(
+            [handle = handle.get()](const std::string& transfer_id, int file_index, std::string& signature) {
+                return handle->transfer_manager->get_delta_signature(transfer_id, file_index, signature);
+            });
+        
+        handle->api_server->set_delta_upload_callback(
+            [handle = handle.get()](const std::string& transfer_id, int file_index, const BodyReader& read_body,
+                                   std::function<void(bool, const std::string&)> response_callback) {
+                bool success = handle->transfer_manager->handle_delta_upload(transfer_id, file_index, read_body);
+                response_callback(success, success ? "" : "Failed to apply delta");
+            });
+        
+        handle->api_server->set_manifest_page_callback(
+            [handle = handle.get()](const std::string& transfer_id, uint64_t first_file,
+                                   const std::vector<FileMetadata>& files) {
+                return handle->transfer_manager->handle_manifest_page(transfer_id, first_file, files);
+            });
         
         return handle.release();
         
@@ -183,6 +368,9 @@ int warpdeck_start(WarpDeckHandle* handle, const char* device_name, int desired_
         handle->api_server->set_ssl_certificate(cert_file, key_file);
         handle->api_client->set_client_certificate(cert_file, key_file);
         
+        // Receives interrupted by a restart continue when their senders reconnect
+        handle->transfer_manager->restore_interrupted_transfers();
+        
         // Start API server
         DeviceInfo device_info;
         device_info.id = handle->device_id;
@@ -217,7 +405,7 @@ int warpdeck_start(WarpDeckHandle* handle, const char* device_name, int desired_
         return handle->current_port;
         
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
         return -1;
     }
 }
@@ -232,7 +420,7 @@ void warpdeck_stop(WarpDeckHandle* handle) {
         handle->api_server->stop();
         handle->started = false;
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
     }
 }
 
@@ -247,7 +435,7 @@ void warpdeck_set_device_name(WarpDeckHandle* handle, const char* new_name) {
             handle->discovery_manager->set_device_name(new_name);
         }
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
     }
 }
 
@@ -257,16 +445,21 @@ void warpdeck_initiate_transfer(WarpDeckHandle* handle, const char* device_id, c
     }
     
     try {
-        // Parse files JSON to get file paths
-        // For now, assume files_json is a simple array of file paths
-        // In a full implementation, this would parse the FileMetadata JSON
-        std::vector<std::string> file_paths = {files_json}; // Simplified
+        // Accepts a JSON array of paths or of file objects with a "path" field,
+        // or {"files": [...], "bulk_io": true|false, "compression": true|false,
+        // "sync": true|false|"mirror"} to choose the I/O mode, whether uploads may be
+        // compressed and whether files the receiver already has are skipped. A
+        // directory path sends every file under it, named relative to the directory's parent.
+        std::vector<std::string> file_paths = utils::parse_file_paths(files_json);
+        BulkIOMode bulk_io_mode = parse_bulk_io_mode(files_json);
+        bool allow_compression = parse_compression_allowed(files_json);
+        SyncMode sync_mode = parse_sync_mode(files_json);
         
         // Get peer info
         auto peers = handle->discovery_manager->get_discovered_peers();
         auto peer_it = peers.find(device_id);
         if (peer_it == peers.end()) {
-            safe_call_callback(handle->callbacks.on_error, "Peer not found");
+            post_error(handle, "Peer not found");
             return;
         }
         
@@ -274,14 +467,101 @@ void warpdeck_initiate_transfer(WarpDeckHandle* handle, const char* device_id, c
         
         // Initiate transfer through transfer manager
         std::string transfer_id = handle->transfer_manager->initiate_transfer(
-            device_id, peer.name, file_paths);
+            device_id, peer.name, peer.host_address, peer.port, peer.fingerprint, file_paths, bulk_io_mode,
+            allow_compression, sync_mode);
             
         if (transfer_id.empty()) {
-            safe_call_callback(handle->callbacks.on_error, "Failed to initiate transfer");
+            post_error(handle, "Failed to initiate transfer");
         }
         
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
+    }
+}
+
+void warpdeck_set_progress_update_rate(WarpDeckHandle* handle, double updates_per_second) {
+    if (!handle) {
+        return;
+    }
+    
+    handle->event_dispatcher->set_progress_rate(updates_per_second);
+}
+
+void warpdeck_set_transfer_stats_callback(WarpDeckHandle* handle, on_transfer_stats_update_callback callback) {
+    if (!handle) {
+        return;
+    }
+    
+    handle->stats_callback.store(callback);
+}
+
+void warpdeck_set_chunk_store_size(WarpDeckHandle* handle, uint64_t max_bytes) {
+    if (!handle) {
+        return;
+    }
+    
+    if (!handle->transfer_manager->set_chunk_store(handle->config_dir + "/chunks", max_bytes)) {
+        post_error(handle, "Cannot open the chunk store");
+    }
+}
+
+void warpdeck_set_hardlink_duplicates(WarpDeckHandle* handle, bool allow) {
+    if (!handle) {
+        return;
+    }
+    
+    handle->transfer_manager->set_hardlink_duplicates(allow);
+}
+
+void warpdeck_set_zero_copy(WarpDeckHandle* handle, bool enabled) {
+    if (!handle) {
+        return;
+    }
+    
+    handle->api_client->set_zero_copy_enabled(enabled);
+}
+
+void warpdeck_set_bandwidth_limit(WarpDeckHandle* handle, uint64_t bytes_per_second) {
+    if (!handle) {
+        return;
+    }
+    
+    handle->transfer_manager->set_bandwidth_limit(bytes_per_second);
+}
+
+void warpdeck_set_peer_bandwidth_limit(WarpDeckHandle* handle, const char* device_id, uint64_t bytes_per_second) {
+    if (!handle || !device_id) {
+        return;
+    }
+    
+    handle->transfer_manager->set_peer_bandwidth_limit(device_id, bytes_per_second);
+}
+
+void warpdeck_set_transfer_bandwidth_limit(WarpDeckHandle* handle, const char* transfer_id,
+                                           uint64_t bytes_per_second) {
+    if (!handle || !transfer_id) {
+        return;
+    }
+    
+    if (!handle->transfer_manager->set_transfer_bandwidth_limit(transfer_id, bytes_per_second)) {
+        post_error(handle, "Transfer not found");
+    }
+}
+
+const char* warpdeck_get_transfer_stats(WarpDeckHandle* handle, const char* transfer_id) {
+    if (!handle || !transfer_id) {
+        return nullptr;
+    }
+    
+    try {
+        TransferStats stats;
+        if (!handle->transfer_manager->get_transfer_stats(transfer_id, stats)) {
+            return nullptr;
+        }
+        return copy_string(utils::transfer_stats_to_json(stats));
+    } catch (const std::exception& e) {
+        post_error(handle, e.what());
+        return nullptr;
     }
 }
 
@@ -293,7 +573,7 @@ void warpdeck_respond_to_transfer(WarpDeckHandle* handle, const char* transfer_i
     try {
         handle->transfer_manager->respond_to_transfer(transfer_id, accept);
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
     }
 }
 
@@ -305,7 +585,7 @@ void warpdeck_cancel_transfer(WarpDeckHandle* handle, const char* transfer_id) {
     try {
         handle->transfer_manager->cancel_transfer(transfer_id);
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
     }
 }
 
@@ -319,7 +599,7 @@ const char* warpdeck_get_trusted_devices(WarpDeckHandle* handle) {
         std::string json = utils::trusted_peers_to_json(trusted_peers);
         return copy_string(json);
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
         return nullptr;
     }
 }
@@ -332,7 +612,7 @@ void warpdeck_remove_trusted_device(WarpDeckHandle* handle, const char* device_i
     try {
         handle->security_manager->remove_trusted_peer(device_id);
     } catch (const std::exception& e) {
-        safe_call_callback(handle->callbacks.on_error, e.what());
+        post_error(handle, e.what());
     }
 }
 
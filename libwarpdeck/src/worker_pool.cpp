@@ -0,0 +1,90 @@
+#include "worker_pool.h"
+#include <algorithm>
+
+namespace warpdeck {
+
+WorkerPool::WorkerPool(size_t worker_count) : next_queue_(0), queued_tasks_(0), stopping_(false) {
+    worker_count = std::max<size_t>(worker_count, 1);
+    for (size_t i = 0; i < worker_count; ++i) {
+        queues_.push_back(std::make_unique<TaskQueue>());
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.emplace_back(&WorkerPool::worker_loop, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_cv_.notify_all();
+
+    for (auto& worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void WorkerPool::submit(Task task) {
+    size_t index = next_queue_++ % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        ++queued_tasks_;
+    }
+    wake_cv_.notify_one();
+}
+
+size_t WorkerPool::worker_count() const {
+    return workers_.size();
+}
+
+void WorkerPool::worker_loop(size_t index) {
+    while (true) {
+        Task task;
+        if (try_take(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_cv_.wait(lock, [this]() { return stopping_ || queued_tasks_ > 0; });
+        if (stopping_ && queued_tasks_ == 0) {
+            return;
+        }
+    }
+}
+
+bool WorkerPool::try_take(size_t index, Task& task) {
+    // Own work first, oldest task first
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        size_t victim = (index + i) % queues_.size();
+        TaskQueue& queue = *queues_[victim];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+
+        // Steal from the back so the owner keeps the work it is about to reach
+        if (victim == index) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+
+        std::lock_guard<std::mutex> wake_lock(wake_mutex_);
+        --queued_tasks_;
+        return true;
+    }
+    return false;
+}
+
+} // namespace warpdeck
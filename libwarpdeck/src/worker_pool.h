@@ -0,0 +1,46 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace warpdeck {
+
+// Fixed-size pool of worker threads, one task deque per worker. Tasks are
+// spread round-robin across the deques; a worker takes from the front of its
+// own deque and, once that is empty, steals from the back of the others.
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkerPool(size_t worker_count);
+    ~WorkerPool();
+
+    void submit(Task task);
+    size_t worker_count() const;
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void worker_loop(size_t index);
+    bool try_take(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    size_t queued_tasks_;
+    bool stopping_;
+};
+
+} // namespace warpdeck
@@ -0,0 +1,395 @@
+#include "zero_copy_sender.h"
+#include "logger.h"
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#ifdef WARPDECK_PLATFORM_MACOS
+#include <sys/uio.h>
+#elif defined(WARPDECK_PLATFORM_LINUX)
+#include <sys/sendfile.h>
+#include <pthread.h>
+#endif
+
+namespace warpdeck {
+
+namespace {
+
+constexpr size_t MAX_RESPONSE_HEADER_SIZE = 16 * 1024;
+
+#ifdef WARPDECK_PLATFORM_LINUX
+// sendfile and splice raise SIGPIPE when the peer goes away; keep it pending
+// while sending and swallow it afterwards instead of killing the process
+class ScopedSigpipeBlock {
+public:
+    ScopedSigpipeBlock() {
+        sigemptyset(&sigpipe_);
+        sigaddset(&sigpipe_, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe_, &previous_);
+    }
+
+    ~ScopedSigpipeBlock() {
+        struct timespec no_wait = {0, 0};
+        while (sigtimedwait(&sigpipe_, nullptr, &no_wait) > 0) {
+        }
+        pthread_sigmask(SIG_SETMASK, &previous_, nullptr);
+    }
+
+private:
+    sigset_t sigpipe_;
+    sigset_t previous_;
+};
+#endif
+
+bool is_unsupported_error(int error) {
+    return error == EINVAL || error == ENOSYS || error == EOPNOTSUPP;
+}
+
+// connect() bounded by timeout_seconds instead of the kernel's SYN retries,
+// which leave an unreachable peer hanging for minutes
+bool connect_with_timeout(int fd, const struct sockaddr* address, socklen_t address_length, int timeout_seconds) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return false;
+    }
+
+    bool connected = ::connect(fd, address, address_length) == 0;
+    if (!connected && errno == EINPROGRESS) {
+        struct pollfd poll_fd = {fd, POLLOUT, 0};
+        int ready;
+        do {
+            ready = ::poll(&poll_fd, 1, timeout_seconds * 1000);
+        } while (ready < 0 && errno == EINTR);
+
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        connected = ready > 0 &&
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == 0 && error == 0;
+    }
+
+    return connected && fcntl(fd, F_SETFL, flags) == 0;
+}
+
+std::string lowercase(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return value;
+}
+
+} // namespace
+
+const char* send_path_name(SendPath path) {
+    switch (path) {
+        case SendPath::SENDFILE: return "sendfile";
+        case SendPath::SPLICE: return "splice";
+        case SendPath::COPY: return "copy";
+    }
+    return "unknown";
+}
+
+ZeroCopyConnection::ZeroCopyConnection(const std::string& host, int port)
+    : host_(host), port_(port), socket_fd_(-1), pipe_fds_{-1, -1},
+      send_path_(SendPath::SENDFILE), keep_alive_(true) {}
+
+ZeroCopyConnection::~ZeroCopyConnection() {
+    close_socket();
+    for (int fd : pipe_fds_) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+bool ZeroCopyConnection::connect() {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+
+    for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+        int fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect_with_timeout(fd, address->ai_addr, address->ai_addrlen, SOCKET_TIMEOUT_SECONDS)) {
+            socket_fd_ = fd;
+            break;
+        }
+        ::close(fd);
+    }
+    freeaddrinfo(addresses);
+
+    if (socket_fd_ < 0) {
+        return false;
+    }
+
+    int enable = 1;
+    setsockopt(socket_fd_, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+#ifdef WARPDECK_PLATFORM_MACOS
+    setsockopt(socket_fd_, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+    struct timeval timeout = {SOCKET_TIMEOUT_SECONDS, 0};
+    setsockopt(socket_fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket_fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+#ifndef WARPDECK_PLATFORM_LINUX
+    // splice is Linux-only
+    if (send_path_ == SendPath::SPLICE) {
+        send_path_ = SendPath::COPY;
+    }
+#endif
+
+    keep_alive_ = true;
+    LOG_API_DEBUG() << "Zero-copy connection to " << host_ << ":" << port_
+                    << " using " << send_path_name(send_path_);
+    return true;
+}
+
+bool ZeroCopyConnection::is_alive() const {
+    if (socket_fd_ < 0) {
+        return false;
+    }
+
+    // An idle keep-alive socket must have nothing to read; EOF means the server closed it
+    char probe;
+    ssize_t result = ::recv(socket_fd_, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+bool ZeroCopyConnection::is_reusable() const {
+    return socket_fd_ >= 0 && keep_alive_;
+}
+
+SendPath ZeroCopyConnection::send_path() const {
+    return send_path_;
+}
+
+bool ZeroCopyConnection::post_file_range(const std::string& path, int file_fd, uint64_t offset, uint64_t length,
+                                         const ProgressCallback& progress_callback, int& status, std::string& body) {
+    if (socket_fd_ < 0) {
+        return false;
+    }
+
+    std::string request = "POST " + path + " HTTP/1.1\r\n"
+                          "Host: " + host_ + ":" + std::to_string(port_) + "\r\n"
+                          "Content-Type: application/octet-stream\r\n"
+                          "Content-Length: " + std::to_string(length) + "\r\n"
+                          "Connection: keep-alive\r\n"
+                          "\r\n";
+
+    if (!send_all(request.data(), request.size()) ||
+        !send_body(file_fd, offset, length, progress_callback) ||
+        !read_response(status, body)) {
+        close_socket();
+        return false;
+    }
+
+    if (!keep_alive_) {
+        close_socket();
+    }
+    return true;
+}
+
+bool ZeroCopyConnection::send_all(const char* data, size_t length) {
+    while (length > 0) {
+#ifdef WARPDECK_PLATFORM_LINUX
+        ssize_t sent = ::send(socket_fd_, data, length, MSG_NOSIGNAL);
+#else
+        ssize_t sent = ::send(socket_fd_, data, length, 0);
+#endif
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool ZeroCopyConnection::send_body(int file_fd, uint64_t offset, uint64_t length,
+                                   const ProgressCallback& progress_callback) {
+#ifdef WARPDECK_PLATFORM_LINUX
+    ScopedSigpipeBlock sigpipe_block;
+#endif
+
+    uint64_t sent = 0;
+    while (sent < length) {
+        size_t slice = static_cast<size_t>(std::min<uint64_t>(SEND_SLICE_SIZE, length - sent));
+        if (!send_slice(file_fd, offset + sent, slice)) {
+            return false;
+        }
+        sent += slice;
+
+        if (progress_callback && !progress_callback(sent)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ZeroCopyConnection::send_slice(int file_fd, uint64_t offset, size_t length) {
+    size_t done = 0;
+
+    while (done < length) {
+        ssize_t result = -1;
+        size_t remaining = length - done;
+
+        if (send_path_ == SendPath::SENDFILE) {
+#ifdef WARPDECK_PLATFORM_LINUX
+            off_t file_offset = static_cast<off_t>(offset + done);
+            result = ::sendfile(socket_fd_, file_fd, &file_offset, remaining);
+#elif defined(WARPDECK_PLATFORM_MACOS)
+            off_t bytes = static_cast<off_t>(remaining);
+            int rc = ::sendfile(file_fd, socket_fd_, static_cast<off_t>(offset + done), &bytes, nullptr, 0);
+            // Partial sends report their length even when interrupted
+            result = (rc == 0 || bytes > 0) ? static_cast<ssize_t>(bytes) : -1;
+#else
+            errno = ENOSYS;
+#endif
+        } else if (send_path_ == SendPath::SPLICE) {
+#ifdef WARPDECK_PLATFORM_LINUX
+            if (pipe_fds_[0] < 0 && ::pipe(pipe_fds_) != 0) {
+                pipe_fds_[0] = pipe_fds_[1] = -1;
+                errno = ENOSYS;
+            } else {
+                loff_t file_offset = static_cast<loff_t>(offset + done);
+                result = ::splice(file_fd, &file_offset, pipe_fds_[1], nullptr, remaining,
+                                  SPLICE_F_MOVE | SPLICE_F_MORE);
+                // Drain the pipe into the socket before pulling more from the file
+                ssize_t in_pipe = result;
+                while (in_pipe > 0) {
+                    ssize_t moved = ::splice(pipe_fds_[0], nullptr, socket_fd_, nullptr,
+                                             static_cast<size_t>(in_pipe), SPLICE_F_MOVE | SPLICE_F_MORE);
+                    if (moved < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (moved <= 0) {
+                        return false; // The pipe now holds data the socket never got
+                    }
+                    in_pipe -= moved;
+                }
+            }
+#else
+            errno = ENOSYS;
+#endif
+        } else {
+            char buffer[64 * 1024];
+            ssize_t read_bytes = ::pread(file_fd, buffer, std::min(remaining, sizeof(buffer)),
+                                         static_cast<off_t>(offset + done));
+            if (read_bytes > 0 && !send_all(buffer, static_cast<size_t>(read_bytes))) {
+                return false;
+            }
+            result = read_bytes;
+        }
+
+        if (result > 0) {
+            done += static_cast<size_t>(result);
+            continue;
+        }
+        if (result == 0) {
+            return false; // File is shorter than announced
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+
+        // Nothing of this attempt reached the socket, so a slower path can take over
+        if (is_unsupported_error(errno) && send_path_ != SendPath::COPY) {
+            SendPath previous = send_path_;
+#ifdef WARPDECK_PLATFORM_LINUX
+            send_path_ = send_path_ == SendPath::SENDFILE ? SendPath::SPLICE : SendPath::COPY;
+#else
+            send_path_ = SendPath::COPY;
+#endif
+            LOG_API_INFO() << "Connection to " << host_ << ":" << port_ << " falling back from "
+                           << send_path_name(previous) << " to " << send_path_name(send_path_)
+                           << ": " << std::strerror(errno);
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool ZeroCopyConnection::read_response(int& status, std::string& body) {
+    char buffer[4096];
+    size_t header_end;
+    while ((header_end = read_buffer_.find("\r\n\r\n")) == std::string::npos) {
+        if (read_buffer_.size() > MAX_RESPONSE_HEADER_SIZE) {
+            return false;
+        }
+        ssize_t received = ::recv(socket_fd_, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        read_buffer_.append(buffer, static_cast<size_t>(received));
+    }
+
+    std::string headers = lowercase(read_buffer_.substr(0, header_end));
+    read_buffer_.erase(0, header_end + 4);
+
+    // Status line: HTTP/1.1 200 OK
+    size_t space = headers.find(' ');
+    if (space == std::string::npos) {
+        return false;
+    }
+    status = std::atoi(headers.c_str() + space + 1);
+
+    uint64_t content_length = 0;
+    size_t length_pos = headers.find("\r\ncontent-length:");
+    if (length_pos != std::string::npos) {
+        content_length = std::strtoull(headers.c_str() + length_pos + 17, nullptr, 10);
+    } else if (headers.find("\r\ntransfer-encoding:") != std::string::npos) {
+        return false; // Not produced by our server for these endpoints
+    }
+    keep_alive_ = headers.find("\r\nconnection: close") == std::string::npos;
+
+    while (read_buffer_.size() < content_length) {
+        ssize_t received = ::recv(socket_fd_, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        read_buffer_.append(buffer, static_cast<size_t>(received));
+    }
+
+    body = read_buffer_.substr(0, content_length);
+    read_buffer_.erase(0, content_length);
+    return true;
+}
+
+void ZeroCopyConnection::close_socket() {
+    if (socket_fd_ >= 0) {
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+    }
+    read_buffer_.clear();
+}
+
+} // namespace warpdeck
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <cstdint>
+
+namespace warpdeck {
+
+// How a connection moves file bytes into the socket
+enum class SendPath {
+    SENDFILE, // kernel copies page cache -> socket
+    SPLICE,   // page cache -> pipe -> socket, still without a userspace copy
+    COPY      // pread into a userspace buffer, then send
+};
+
+const char* send_path_name(SendPath path);
+
+// Minimal HTTP/1.1 client connection that sends request bodies straight from a
+// file descriptor with sendfile (or splice), so file data never passes through
+// a userspace buffer. Used for plain-text upload connections; the sender falls
+// back to httplib whenever this connection cannot be used. The send path is
+// downgraded per connection (sendfile -> splice -> copy) when the kernel or the
+// source filesystem does not support the faster one.
+class ZeroCopyConnection {
+public:
+    using ProgressCallback = std::function<bool(uint64_t bytes_sent)>;
+
+    static constexpr uint64_t SEND_SLICE_SIZE = 1024 * 1024;
+    static constexpr int SOCKET_TIMEOUT_SECONDS = 30;
+
+    ZeroCopyConnection(const std::string& host, int port);
+    ~ZeroCopyConnection();
+
+    ZeroCopyConnection(const ZeroCopyConnection&) = delete;
+    ZeroCopyConnection& operator=(const ZeroCopyConnection&) = delete;
+
+    bool connect();
+    bool is_alive() const;
+    bool is_reusable() const;
+    SendPath send_path() const;
+
+    // POSTs [offset, offset + length) of file_fd to `path`; returns false on
+    // transport errors, otherwise fills in the response status and body
+    bool post_file_range(const std::string& path, int file_fd, uint64_t offset, uint64_t length,
+                         const ProgressCallback& progress_callback, int& status, std::string& body);
+
+private:
+    bool send_all(const char* data, size_t length);
+    bool send_body(int file_fd, uint64_t offset, uint64_t length, const ProgressCallback& progress_callback);
+    bool send_slice(int file_fd, uint64_t offset, size_t length);
+    bool read_response(int& status, std::string& body);
+    void close_socket();
+
+    std::string host_;
+    int port_;
+    int socket_fd_;
+    int pipe_fds_[2];
+    SendPath send_path_;
+    bool keep_alive_;
+    std::string read_buffer_;
+};
+
+} // namespace warpdeck
@@ -80,10 +80,33 @@ int CLIApplication::handle_listen(const ParsedCommand& cmd) {
         download_path_ = path_it->second;
     }
     
+    uint64_t chunk_store_gib = 0;
+    auto store_it = cmd.options.find("chunk-store");
+    if (store_it != cmd.options.end()) {
+        try {
+            chunk_store_gib = std::stoull(store_it->second);
+        } catch (const std::exception&) {
+            std::cerr << "Invalid --chunk-store size: " << store_it->second << std::endl;
+            return 1;
+        }
+    }
+    
     if (!initialize_warpdeck(device_name)) {
         return 1;
     }
     
+    // Content pushed here before is rebuilt from the store instead of received again
+    if (store_it != cmd.options.end()) {
+        warpdeck_set_chunk_store_size(warpdeck_handle_, chunk_store_gib * 1024ULL * 1024 * 1024);
+    }
+    // Otherwise files a transfer repeats are copied (reflinked where possible)
+    if (cmd.options.count("hardlink-duplicates")) {
+        warpdeck_set_hardlink_duplicates(warpdeck_handle_, true);
+    }
+    if (!apply_bandwidth_limit(cmd)) {
+        return 1;
+    }
+    
     InteractiveUI::print_discovery_status(true);
     
     running_ = true;
@@ -141,9 +164,12 @@ int CLIApplication::handle_send(const ParsedCommand& cmd) {
         device_name = name_it->second;
     }
     
-    if (!initialize_warpdeck(device_name)) {
+    if (!initialize_warpdeck(device_name) || !apply_bandwidth_limit(cmd)) {
         return 1;
     }
+    if (cmd.options.count("no-zero-copy")) {
+        warpdeck_set_zero_copy(warpdeck_handle_, false);
+    }
     
     std::string target_id = cmd.options.at("to");
     
@@ -185,22 +211,40 @@ int CLIApplication::handle_send(const ParsedCommand& cmd) {
             return 1;
         }
         
-        auto file_size = std::filesystem::file_size(file_path);
         auto file_name = std::filesystem::path(file_path).filename().string();
         
         nlohmann::json file_info;
         file_info["name"] = file_name;
-        file_info["size"] = file_size;
         file_info["path"] = file_path;
         
+        // Directories are sent with everything under them
+        if (std::filesystem::is_directory(file_path)) {
+            files_json.push_back(file_info);
+            std::cout << "📁 " << file_name << "/\n";
+            continue;
+        }
+        
+        auto file_size = std::filesystem::file_size(file_path);
+        file_info["size"] = file_size;
+        
         files_json.push_back(file_info);
         
         std::cout << "📄 " << file_name << " (" << InteractiveUI::format_file_size(file_size) << ")\n";
     }
     
+    // Sync mode sends only what the peer doesn't already have
+    nlohmann::json transfer_json = files_json;
+    if (cmd.options.count("mirror")) {
+        transfer_json = {{"files", files_json}, {"sync", "mirror"}};
+        std::cout << "🔁 Mirroring: the peer's copies of these folders will match exactly\n";
+    } else if (cmd.options.count("sync")) {
+        transfer_json = {{"files", files_json}, {"sync", true}};
+        std::cout << "🔁 Syncing: unchanged files are skipped\n";
+    }
+    
     // Initiate transfer
     std::cout << "🚀 Initiating transfer...\n";
-    warpdeck_initiate_transfer(warpdeck_handle_, target_id.c_str(), files_json.dump().c_str());
+    warpdeck_initiate_transfer(warpdeck_handle_, target_id.c_str(), transfer_json.dump().c_str());
     
     running_ = true;
     wait_for_signal();
@@ -238,7 +282,6 @@ bool CLIApplication::initialize_warpdeck(const std::string& device_name, const s
     callbacks.on_peer_discovered = on_peer_discovered;
     callbacks.on_peer_lost = on_peer_lost;
     callbacks.on_incoming_transfer_request = on_incoming_transfer_request;
-    callbacks.on_transfer_progress_update = on_transfer_progress_update;
     callbacks.on_transfer_completed = on_transfer_completed;
     callbacks.on_error = on_error;
     
@@ -249,6 +292,9 @@ bool CLIApplication::initialize_warpdeck(const std::string& device_name, const s
         return false;
     }
     
+    // Progress comes from the stats event, which carries the smoothed rate
+    warpdeck_set_transfer_stats_callback(warpdeck_handle_, on_transfer_stats_update);
+    
     // Start warpdeck
     int port = warpdeck_start(warpdeck_handle_, device_name_.c_str(), 0);
     if (port <= 0) {
@@ -321,7 +367,12 @@ void CLIApplication::on_incoming_transfer_request(const char* transfer_request_j
             files.push_back(file);
         }
         
-        bool accepted = InteractiveUI::prompt_transfer_acceptance(peer_name, files);
+        // A large manifest arrives in pages; the request lists the first one
+        uint64_t total_files = j.value("file_count", static_cast<uint64_t>(files.size()));
+        
+        bool accepted = InteractiveUI::prompt_transfer_acceptance(peer_name, files, total_files,
+                                                                  j.value("sync", false),
+                                                                  j.value("delete_extras", false));
         
         // Respond to transfer
         warpdeck_respond_to_transfer(instance_->warpdeck_handle_, transfer_id.c_str(), accepted);
@@ -338,13 +389,20 @@ void CLIApplication::on_incoming_transfer_request(const char* transfer_request_j
     }
 }
 
-void CLIApplication::on_transfer_progress_update(const char* transfer_id, float progress_percent, uint64_t bytes_transferred) {
+void CLIApplication::on_transfer_stats_update(const char* transfer_id, const char* stats_json) {
     if (!instance_) return;
     
     auto it = instance_->pending_transfers_.find(transfer_id);
-    if (it != instance_->pending_transfers_.end()) {
-        // For simplicity, show progress for the first file
-        InteractiveUI::print_transfer_progress("transfer", progress_percent, bytes_transferred);
+    if (it == instance_->pending_transfers_.end()) {
+        return;
+    }
+    
+    try {
+        nlohmann::json stats = nlohmann::json::parse(stats_json);
+        InteractiveUI::print_transfer_progress("transfer", stats.value("progress_percent", 0.0f),
+                                               stats.value("bytes_per_second", uint64_t(0)));
+    } catch (const std::exception&) {
+        // Malformed stats; skip this update
     }
 }
 
@@ -576,4 +634,26 @@ void CLIApplication::wait_for_signal() {
     while (running_) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+}
+
+bool CLIApplication::apply_bandwidth_limit(const ParsedCommand& cmd) {
+    auto limit_it = cmd.options.find("limit");
+    if (limit_it == cmd.options.end()) {
+        return true;
+    }
+    
+    double mib_per_second = 0.0;
+    try {
+        mib_per_second = std::stod(limit_it->second);
+    } catch (const std::exception&) {
+        mib_per_second = -1.0;
+    }
+    if (mib_per_second <= 0.0) {
+        std::cerr << "Invalid --limit rate: " << limit_it->second << std::endl;
+        return false;
+    }
+    
+    warpdeck_set_bandwidth_limit(warpdeck_handle_, static_cast<uint64_t>(mib_per_second * 1024 * 1024));
+    std::cout << "🚦 Transfers limited to " << limit_it->second << " MiB/s\n";
+    return true;
 }
\ No newline at end of file
@@ -35,7 +35,7 @@ private:
     static void on_peer_discovered(const char* peer_json);
     static void on_peer_lost(const char* device_id);
     static void on_incoming_transfer_request(const char* transfer_request_json);
-    static void on_transfer_progress_update(const char* transfer_id, float progress_percent, uint64_t bytes_transferred);
+    static void on_transfer_stats_update(const char* transfer_id, const char* stats_json);
     static void on_transfer_completed(const char* transfer_id, bool success, const char* error_message);
     static void on_error(const char* error_message);
 
@@ -47,6 +47,8 @@ private:
     std::string get_device_name_from_config();
     bool save_device_name_to_config(const std::string& name);
     void wait_for_signal();
+    // Applies --limit <MiB/s> as the bandwidth limit of this session; false if it is invalid
+    bool apply_bandwidth_limit(const ParsedCommand& cmd);
     
     // Static instance for callbacks
     static CLIApplication* instance_;
@@ -74,12 +74,16 @@ bool CommandParser::parse_options(const std::vector<std::string>& args, size_t s
             std::string option = arg.substr(2);
             
             // Options that require a value
-            if (option == "to" || option == "name" || option == "path" || option == "set-name") {
+            if (option == "to" || option == "name" || option == "path" || option == "set-name" ||
+                option == "chunk-store" || option == "limit") {
                 if (i + 1 >= args.size()) {
                     result.error_message = "Option --" + option + " requires a value";
                     return false;
                 }
                 result.options[option] = args[++i];
+            } else if (option == "sync" || option == "mirror" || option == "hardlink-duplicates" ||
+                       option == "no-zero-copy") {
+                result.options[option] = "";
             } else {
                 result.error_message = "Unknown option: --" + option;
                 return false;
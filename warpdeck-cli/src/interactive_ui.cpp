@@ -6,7 +6,8 @@
 #include <cstdint>
 
 bool InteractiveUI::prompt_transfer_acceptance(const std::string& peer_name, 
-                                              const std::vector<FileInfo>& files) {
+                                              const std::vector<FileInfo>& files, uint64_t total_files,
+                                              bool sync, bool delete_extras) {
     std::cout << "\n━━━ Incoming Transfer Request ━━━\n";
     std::cout << "From: " << peer_name << "\n";
     std::cout << "Files:\n";
@@ -14,6 +15,14 @@ bool InteractiveUI::prompt_transfer_acceptance(const std::string& peer_name,
     for (const auto& file : files) {
         std::cout << "  • " << file.name << " (" << file.size_formatted << ")\n";
     }
+    if (total_files > files.size()) {
+        std::cout << "  … and " << (total_files - files.size()) << " more file(s)\n";
+    }
+    if (delete_extras) {
+        std::cout << "Mirror sync: files in these folders that the sender lacks will be DELETED\n";
+    } else if (sync) {
+        std::cout << "Sync: files you already have are skipped\n";
+    }
     
     std::cout << "\nAccept transfer? (y/N): ";
     std::string input = get_user_input("");
@@ -14,7 +14,8 @@ struct FileInfo {
 class InteractiveUI {
 public:
     static bool prompt_transfer_acceptance(const std::string& peer_name, 
-                                         const std::vector<FileInfo>& files);
+                                         const std::vector<FileInfo>& files, uint64_t total_files,
+                                         bool sync, bool delete_extras);
     
     static void print_discovery_status(bool listening);
     static void print_peer_discovered(const std::string& name, const std::string& id, const std::string& platform);
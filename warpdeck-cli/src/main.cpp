@@ -64,11 +64,18 @@ void print_usage(const char* program_name) {
     std::cout << "Options:\n";
     std::cout << "  --name <name>                 Override device name for this session\n";
     std::cout << "  --path <path>                 Set download directory for this session\n";
+    std::cout << "  --chunk-store <GiB>           With listen, keep received chunks to rebuild repeat pushes locally\n";
+    std::cout << "  --limit <MiB/s>               Cap the bandwidth transfers use, sending and receiving\n";
+    std::cout << "  --hardlink-duplicates         With listen, hardlink files received with identical content\n";
+    std::cout << "  --no-zero-copy                With send, copy file data through user space instead of sendfile\n";
+    std::cout << "  --sync                        Send only files the peer lacks or has in another version\n";
+    std::cout << "  --mirror                      Like --sync, and delete the peer's files the sent folders lack\n";
     std::cout << "  --help                        Show this help message\n\n";
     std::cout << "Examples:\n";
     std::cout << "  " << program_name << " listen\n";
     std::cout << "  " << program_name << " list\n";
     std::cout << "  " << program_name << " send --to abc123 file1.txt file2.jpg\n";
+    std::cout << "  " << program_name << " send --to abc123 --sync ~/Emulation/roms\n";
     std::cout << "  " << program_name << " config --set-name \"My Device\"\n";
 }
 